@@ -0,0 +1,100 @@
+// Compare the throughput of batched SIMD evaluation against the scalar
+// interpreter, in points per second, and report the largest difference
+// between their values and gradients.
+
+#include <apex/autodiff_program.hxx>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+using namespace apex;
+
+typedef std::chrono::steady_clock clock_type;
+
+static double elapsed(clock_type::time_point t0) {
+  return std::chrono::duration<double>(clock_type::now() - t0).count();
+}
+
+// Relative error, with an absolute floor so values near zero don't dominate.
+static double rel_error(double x, double y) {
+  if(x == y) return 0;
+  return std::abs(x - y) / std::max(std::abs(y), 1.0);
+}
+
+int main(int argc, char** argv) {
+  size_t count = argc > 1 ? atoi(argv[1]) : 1<< 20;
+  int reps = argc > 2 ? atoi(argv[2]) : 5;
+
+  std::vector<autodiff_var_t> vars { { "x", 0 }, { "y", 0 }, { "z", 0 } };
+  const char* formulas[] {
+    "sq(x / y) * sin(x * y)",
+    "sin(x / y + z) / sq(x + y + z)",
+    "tanh(sin(x) * exp(y / z))",
+    "norm(x, y, z) * exp((y - sq(x - y)) / z)",
+    "log(x * y + z) * cos(x - z) + tan(y / 2)",
+    "sinh(x) * cosh(y) - tanh(z * x) + sqrt(y + z)",
+    "sin(100 * x) * cos(1000 * y * z)",
+  };
+
+  // Inputs in [0.1, 3).
+  std::mt19937_64 rng(2020);
+  std::uniform_real_distribution<double> dist(.1, 3);
+  std::vector<double> x(3 * count);
+  for(double& v : x) v = dist(rng);
+  const double* inputs[3] { x.data(), x.data() + count, 
+    x.data() + 2 * count };
+
+  std::vector<double> values(count), grad_data(3 * count);
+  double* grads[3] { grad_data.data(), grad_data.data() + count,
+    grad_data.data() + 2 * count };
+
+  printf("%-48s %12s %12s %8s %10s %10s\n", "formula", "scalar pts/s",
+    "batch pts/s", "speedup", "value err", "grad err");
+
+  for(const char* formula : formulas) {
+    autodiff_program_t program =
+      make_autodiff_program(make_autodiff(formula, vars));
+
+    // Scalar path.
+    std::vector<double> scratch(program.num_slots);
+    std::vector<double> values1(count), grad_data1(3 * count);
+    double scalar_time = 1e30;
+    for(int rep = 0; rep < reps; ++rep) {
+      auto t0 = clock_type::now();
+      for(size_t i = 0; i < count; ++i) {
+        double point[3] { inputs[0][i], inputs[1][i], inputs[2][i] };
+        double grad[3];
+        values1[i] = autodiff_eval(program, point, grad, scratch.data());
+        for(int j = 0; j < 3; ++j)
+          grad_data1[j * count + i] = grad[j];
+      }
+      scalar_time = std::min(scalar_time, elapsed(t0));
+    }
+
+    // Batch path.
+    std::vector<double> batch_scratch(autodiff_batch_scratch_size(program));
+    double batch_time = 1e30;
+    for(int rep = 0; rep < reps; ++rep) {
+      auto t0 = clock_type::now();
+      autodiff_eval_batch(program, count, inputs, values.data(), grads,
+        batch_scratch.data());
+      batch_time = std::min(batch_time, elapsed(t0));
+    }
+
+    double value_err = 0, grad_err = 0;
+    for(size_t i = 0; i < count; ++i) {
+      value_err = std::max(value_err, rel_error(values[i], values1[i]));
+      for(int j = 0; j < 3; ++j)
+        grad_err = std::max(grad_err, rel_error(grads[j][i],
+          grad_data1[j * count + i]));
+    }
+
+    printf("%-48s %12.4g %12.4g %8.2f %10.2g %10.2g\n", formula, 
+      count / scalar_time, count / batch_time, scalar_time / batch_time,
+      value_err, grad_err);
+  }
+
+  return 0;
+}
@@ -0,0 +1,105 @@
+// Measure batch tape construction. Build tapes for a set of random formulas,
+// one after another with make_autodiff and then with build_autodiffs on
+// thread pools of increasing size, and report wall time and speedup. One
+// formula in a hundred names an unknown variable, so every run also collects
+// errors.
+
+#include <apex/autodiff_build.hxx>
+#include <apex/thread_pool.hxx>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <thread>
+
+using namespace apex;
+
+static const char* var_names[] { "x", "y", "z" };
+static const char* unary_funcs[] {
+  "sq", "sqrt", "exp", "log", "sin", "cos", "tan", "sinh", "cosh", "tanh"
+};
+static const char binary_ops[] { '+', '-', '*', '/' };
+
+static std::string random_formula(std::mt19937& rng, int depth) {
+  std::uniform_int_distribution<int> pick(0, 99);
+  if(!depth || pick(rng) < 15) {
+    const char* var = var_names[pick(rng) % 3];
+    if(pick(rng) < 75)
+      return var;
+    else
+      return format("%d.%d * %s", pick(rng) % 10, pick(rng), var);
+  }
+
+  if(pick(rng) < 55) {
+    char op = binary_ops[pick(rng) % 4];
+    return "(" + random_formula(rng, depth - 1) + " " + op + " " +
+      random_formula(rng, depth - 1) + ")";
+  } else
+    return std::string(unary_funcs[pick(rng) % 10]) + "(" +
+      random_formula(rng, depth - 1) + ")";
+}
+
+typedef std::chrono::steady_clock clock_type;
+
+static double elapsed(clock_type::time_point t0) {
+  return std::chrono::duration<double>(clock_type::now() - t0).count();
+}
+
+int main(int argc, char** argv) {
+  int num_formulas = argc > 1 ? atoi(argv[1]) : 10000;
+  int max_threads = argc > 2 ? atoi(argv[2]) :
+    std::max(1u, std::thread::hardware_concurrency());
+
+  std::vector<autodiff_var_t> vars { { "x", 0 }, { "y", 0 }, { "z", 0 } };
+  std::mt19937 rng(2021);
+  std::vector<autodiff_formula_t> formulas(num_formulas);
+  for(int i = 0; i < num_formulas; ++i) {
+    formulas[i].name = format("F%d", i);
+    formulas[i].formula = random_formula(rng, 6);
+    if(0 == i % 100)
+      formulas[i].formula += " + w";
+    formulas[i].vars = vars;
+  }
+
+  // The loop build_autodiffs replaces. Keep the tapes, as a batch does.
+  std::vector<autodiff_t> tapes;
+  tapes.reserve(num_formulas);
+  auto t0 = clock_type::now();
+  int serial_errors = 0;
+  for(const autodiff_formula_t& f : formulas) {
+    try {
+      tapes.push_back(make_autodiff(f.formula, f.vars));
+    } catch(const ad_exeption_t&) {
+      ++serial_errors;
+    }
+  }
+  double serial = elapsed(t0);
+  tapes.clear();
+
+  printf("%d formulas\n", num_formulas);
+  printf("%-10s %10s %12s %8s %8s\n", "threads", "ms", "formulas/s",
+    "speedup", "errors");
+  printf("%-10s %10.2f %12.0f %8.2f %8d\n", "serial", 1000 * serial,
+    num_formulas / serial, 1.0, serial_errors);
+
+  std::vector<int> thread_counts;
+  for(int n = 1; n < max_threads; n *= 2)
+    thread_counts.push_back(n);
+  thread_counts.push_back(max_threads);
+
+  for(int num_threads : thread_counts) {
+    thread_pool_t pool(num_threads);
+
+    t0 = clock_type::now();
+    std::vector<autodiff_build_t> builds = build_autodiffs(pool, formulas);
+    double seconds = elapsed(t0);
+
+    int errors = 0;
+    for(const autodiff_build_t& build : builds)
+      errors += !build;
+
+    printf("%-10d %10.2f %12.0f %8.2f %8d\n", num_threads, 1000 * seconds,
+      num_formulas / seconds, serial / seconds, errors);
+  }
+  return 0;
+}
@@ -0,0 +1,95 @@
+// Measure what the tape cache saves. Each formula is built from scratch with
+// make_autodiff, then looked up in an empty cache with a cache directory
+// (which builds and writes the tape), looked up again after dropping the
+// in-memory tapes (which loads the tape file), and looked up once more
+// (which finds the tape in memory).
+
+#include <apex/autodiff_cache.hxx>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <unistd.h>
+
+using namespace apex;
+
+typedef std::chrono::steady_clock clock_type;
+
+static double elapsed(clock_type::time_point t0) {
+  return std::chrono::duration<double>(clock_type::now() - t0).count();
+}
+
+static void remove_files(const char* dir) {
+  if(DIR* d = opendir(dir)) {
+    while(dirent* entry = readdir(d)) {
+      if('.' != entry->d_name[0])
+        unlink(format("%s/%s", dir, entry->d_name).c_str());
+    }
+    closedir(d);
+  }
+}
+
+int main(int argc, char** argv) {
+  int reps = argc > 1 ? atoi(argv[1]) : 200;
+
+  std::vector<autodiff_var_t> vars { { "x", 0 }, { "y", 0 }, { "z", 0 } };
+  const char* formulas[] {
+    "sq(x / y) * sin(x * y)",
+    "sin(x / y + z) / sq(x + y + z)",
+    "tanh(sin(x) * exp(y / z))",
+    "exp(x * x) + y / z",
+    "sqrt(sq(x) + sq(y) + sq(z))",
+    "sq(cos(x) + cos(x + y) + cos(x + y + z) - 1.5) + "
+      "sq(sin(x) + sin(x + y) + sin(x + y + z) - 1)",
+  };
+
+  char dir[] = "/tmp/apex_cache_XXXXXX";
+  if(!mkdtemp(dir)) {
+    perror("mkdtemp");
+    return 1;
+  }
+  set_autodiff_cache_dir(dir);
+
+  printf("%-44s %10s %10s %10s %10s\n", "formula", "build us", "write us",
+    "load us", "hit us");
+
+  for(const char* formula : formulas) {
+    double build = 1e30, write = 1e30, load = 1e30, hit = 1e30;
+    for(int rep = 0; rep < reps; ++rep) {
+      auto t0 = clock_type::now();
+      make_autodiff(formula, vars);
+      build = std::min(build, elapsed(t0));
+
+      // Remove the tape file, so the first lookup misses on disk too.
+      clear_autodiff_cache();
+      remove_files(dir);
+      t0 = clock_type::now();
+      make_cached_autodiff(formula, vars);
+      write = std::min(write, elapsed(t0));
+
+      clear_autodiff_cache();
+      t0 = clock_type::now();
+      make_cached_autodiff(formula, vars);
+      load = std::min(load, elapsed(t0));
+
+      t0 = clock_type::now();
+      make_cached_autodiff(formula, vars);
+      hit = std::min(hit, elapsed(t0));
+    }
+
+    std::string name = formula;
+    if(name.size() > 44) name = name.substr(0, 41) + "...";
+    printf("%-44s %10.2f %10.2f %10.2f %10.2f\n", name.c_str(), 1e6 * build,
+      1e6 * write, 1e6 * load, 1e6 * hit);
+  }
+
+  autodiff_cache_stats_t stats = autodiff_cache_stats();
+  printf("since the last clear: %lld hits, %lld disk hits, %lld misses, "
+    "%lld writes\n",
+    (long long)stats.hits, (long long)stats.disk_hits,
+    (long long)stats.misses, (long long)stats.disk_writes);
+
+  remove_files(dir);
+  rmdir(dir);
+  return 0;
+}
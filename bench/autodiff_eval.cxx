@@ -0,0 +1,92 @@
+// Measure the throughput of the runtime tape interpreter, evaluating the value
+// and full gradient of each formula at a stream of input points. Global
+// operator new is replaced to confirm that evaluation never allocates. The
+// register file size is reported before (vslots) and after (slots) slot
+// reuse, next to the tape length.
+
+#include <apex/autodiff_program.hxx>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace apex;
+
+static size_t num_allocs = 0;
+
+void* operator new(size_t size) {
+  ++num_allocs;
+  if(void* p = malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+typedef std::chrono::steady_clock clock_type;
+
+int main(int argc, char** argv) {
+  int num_evals = argc > 1 ? atoi(argv[1]) : 2000000;
+
+  std::vector<autodiff_var_t> vars { { "x", 0 }, { "y", 0 }, { "z", 0 } };
+  const char* formulas[] {
+    "sq(x / y) * sin(x * y)",
+    "sin(x / y + z) / sq(x + y + z)",
+    "tanh(sin(x) * exp(y / z))",
+    "norm(x, y, z) * exp((y - sq(x - y)) / z)",
+    "pow(x, y) + sqrt(x * y + z) * log(z)",
+    "sin(norm(x, y, z)) * cos(norm(x, y, z)) + norm(x, y, z)",
+    "pow(x - y, 3) + 2 * pow(y, 4) - pow(z, -2) + pow(x * z, 1.5)",
+  };
+
+  printf("%-56s %6s %6s %6s %6s %12s %10s %8s\n", "formula", "tape", 
+    "instrs", "vslots", "slots", "evals/sec", "ns/eval", "allocs");
+
+  for(const char* formula : formulas) {
+    autodiff_program_t program =
+      make_autodiff_program(make_autodiff(formula, vars));
+    std::vector<double> scratch(program.num_slots);
+
+    double sum = 0;
+    double grad[3];
+    size_t allocs = num_allocs;
+    auto t0 = clock_type::now();
+    for(int i = 0; i < num_evals; ++i) {
+      double t = 1e-6 * (i & 1023);
+      double inputs[3] { .3 + t, .5 + t, .7 + t };
+      sum += autodiff_eval(program, inputs, grad, scratch.data());
+      sum += grad[0] + grad[1] + grad[2];
+    }
+    double seconds =
+      std::chrono::duration<double>(clock_type::now() - t0).count();
+    allocs = num_allocs - allocs;
+
+    printf("%-56s %6d %6zu %6d %6d %12.4g %10.2f %8zu\n", formula,
+      program.stats.tape_length, program.instrs.size(), 
+      program.stats.virtual_slots, program.num_slots, num_evals / seconds,
+      1e9 * seconds / num_evals, allocs);
+
+    // Keep the loop from being optimized away.
+    if(sum == 12345) printf("\n");
+  }
+
+  // A formula with no inputs has an empty gradient.
+  for(autodiff_mode_t mode : { autodiff_mode_reverse, autodiff_mode_forward }) {
+    autodiff_program_t program =
+      make_autodiff_program(make_autodiff("2 + 3", { }, mode));
+    std::vector<double> scratch(program.num_slots);
+    double value = autodiff_eval(program, nullptr, nullptr, scratch.data());
+    if(0 != program.num_inputs || 5 != value) {
+      printf("\nconstant formula: %d inputs, value %f\n", program.num_inputs,
+        value);
+      return 1;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,100 @@
+// Compare ways of computing a Hessian. The dense baseline runs one 
+// Hessian-vector product per input with unit directions. The Hessian program
+// colors the columns of the structural sparsity pattern and runs one tangent
+// pass per color, computing only the lower triangle.
+
+#include <apex/autodiff_program.hxx>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace apex;
+
+typedef std::chrono::steady_clock clock_type;
+
+static double elapsed(clock_type::time_point t0) {
+  return std::chrono::duration<double>(clock_type::now() - t0).count();
+}
+
+static void report(const char* name, const std::string& formula, int n,
+  int num_evals) {
+
+  std::vector<autodiff_var_t> vars;
+  for(int i = 0; i < n; ++i)
+    vars.push_back({ format("x%d", i), 0 });
+
+  autodiff_t autodiff = make_autodiff(formula, vars, autodiff_mode_reverse, 2);
+  autodiff_program_t hvp = make_hvp_program(autodiff);
+  autodiff_program_t hessian = make_hessian_program(autodiff);
+
+  std::vector<double> inputs(n), grad(n), direction(n), column(n);
+  std::vector<double> hvp_scratch(hvp.num_slots);
+  std::vector<double> scratch(hessian.num_slots);
+  std::vector<double> entries(hessian.hessian_slots.size());
+  for(int i = 0; i < n; ++i)
+    inputs[i] = .5 + .01 * i;
+
+  // Keep the best of a few runs, to damp noise.
+  double dense_ns = 1e30, sparse_ns = 1e30, sum = 0;
+  for(int rep = 0; rep < 3; ++rep) {
+    auto t0 = clock_type::now();
+    for(int i = 0; i < num_evals; ++i) {
+      for(int k = 0; k < n; ++k) {
+        std::fill(direction.begin(), direction.end(), 0);
+        direction[k] = 1;
+        sum += autodiff_eval_hvp(hvp, inputs.data(), direction.data(), 
+          grad.data(), column.data(), hvp_scratch.data());
+      }
+    }
+    dense_ns = std::min(dense_ns, 1e9 * elapsed(t0) / num_evals);
+
+    t0 = clock_type::now();
+    for(int i = 0; i < num_evals; ++i)
+      sum += autodiff_eval_hessian(hessian, inputs.data(), grad.data(), 
+        entries.data(), scratch.data());
+    sparse_ns = std::min(sparse_ns, 1e9 * elapsed(t0) / num_evals);
+  }
+  if(sum == 12345) printf("\n");
+
+  printf("%-12s %6d %8zu %8d %10zu %10zu %10.1f %10.1f\n", name, n, 
+    entries.size(), hessian.num_colors, n * hvp.instrs.size(), 
+    hessian.instrs.size(), dense_ns, sparse_ns);
+}
+
+int main(int argc, char** argv) {
+  int num_evals = argc > 1 ? atoi(argv[1]) : 20000;
+
+  printf("%-12s %6s %8s %8s %10s %10s %10s %10s\n", "problem", "inputs", 
+    "nnz", "colors", "hvp ops", "hess ops", "hvp ns", "hess ns");
+
+  for(int n : { 4, 16, 64 }) {
+    // A chain of coupled terms gives a tridiagonal Hessian.
+    std::string chain;
+    for(int i = 0; i + 1 < n; ++i) {
+      if(i) chain += " + ";
+      chain += format("sq(x%d - sq(x%d)) + cos(x%d * x%d)", i + 1, i, i, 
+        i + 1);
+    }
+    report("chain", chain, n, num_evals);
+
+    // Separable terms give a diagonal Hessian.
+    std::string separable;
+    for(int i = 0; i < n; ++i) {
+      if(i) separable += " + ";
+      separable += format("exp(x%d) * sin(x%d)", i, i);
+    }
+    report("separable", separable, n, num_evals);
+
+    // A function of the sum of all inputs has a dense Hessian.
+    std::string dense = "exp(";
+    for(int i = 0; i < n; ++i) {
+      if(i) dense += " + ";
+      dense += format("x%d", i);
+    }
+    dense += ") / (1 + sq(x0))";
+    report("dense", dense, n, num_evals);
+  }
+
+  return 0;
+}
@@ -0,0 +1,87 @@
+// Measure the flat IR against the ad_t DAG it's built from. For random
+// formulas of increasing depth, report the number of distinct nodes, the
+// bytes the IR arrays take next to the ad_t objects in the tape's arena, and
+// the time to flatten the tape, to lower the IR into a program, and to
+// rebuild the ad_t nodes from the IR.
+
+#include <apex/autodiff_ir.hxx>
+#include <apex/autodiff_program.hxx>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+using namespace apex;
+
+static const char* var_names[] { "x", "y", "z" };
+static const char* unary_funcs[] {
+  "sq", "sqrt", "exp", "log", "sin", "cos", "tan", "sinh", "cosh", "tanh"
+};
+static const char binary_ops[] { '+', '-', '*', '/' };
+
+static std::string random_formula(std::mt19937& rng, int depth) {
+  std::uniform_int_distribution<int> pick(0, 99);
+  if(!depth || pick(rng) < 15)
+    return var_names[pick(rng) % 3];
+
+  if(pick(rng) < 60) {
+    char op = binary_ops[pick(rng) % 4];
+    return "(" + random_formula(rng, depth - 1) + " " + op + " " +
+      random_formula(rng, depth - 1) + ")";
+  } else
+    return std::string(unary_funcs[pick(rng) % 10]) + "(" +
+      random_formula(rng, depth - 1) + ")";
+}
+
+static size_t ir_bytes(const autodiff_ir_t& ir) {
+  return ir.ops.size() * (sizeof(uint8_t) + 2 * sizeof(int32_t)) +
+    ir.literals.size() * sizeof(double) +
+    ir.items.size() * sizeof(autodiff_ir_t::item_t) +
+    ir.grad_offsets.size() * sizeof(int) +
+    ir.grads.size() * sizeof(autodiff_ir_t::grad_t);
+}
+
+typedef std::chrono::steady_clock clock_type;
+
+static double elapsed(clock_type::time_point t0) {
+  return std::chrono::duration<double>(clock_type::now() - t0).count();
+}
+
+int main(int argc, char** argv) {
+  int reps = argc > 1 ? atoi(argv[1]) : 50;
+
+  std::vector<autodiff_var_t> vars { { "x", 0 }, { "y", 0 }, { "z", 0 } };
+  std::mt19937 rng(1);
+
+  printf("%5s %8s %8s %10s %10s %12s %12s %12s\n", "depth", "nodes",
+    "objects", "IR bytes", "tape", "flatten us", "lower us", "rebuild us");
+
+  for(int depth = 4; depth <= 12; depth += 2) {
+    // Skip formulas that happen to stop short of the depth.
+    autodiff_t autodiff;
+    do {
+      autodiff = make_autodiff(random_formula(rng, depth), vars);
+    } while(autodiff.tape.size() < 4u * depth);
+
+    double flatten = 1e30, lower = 1e30, rebuild = 1e30;
+    autodiff_ir_t ir;
+    for(int rep = 0; rep < reps; ++rep) {
+      auto t0 = clock_type::now();
+      ir = make_autodiff_ir(autodiff);
+      flatten = std::min(flatten, elapsed(t0));
+
+      t0 = clock_type::now();
+      make_autodiff_program(ir);
+      lower = std::min(lower, elapsed(t0));
+
+      t0 = clock_type::now();
+      make_autodiff(ir);
+      rebuild = std::min(rebuild, elapsed(t0));
+    }
+
+    printf("%5d %8d %8zu %10zu %10zu %12.2f %12.2f %12.2f\n", depth,
+      ir.size(), autodiff.arena.object_count(), ir_bytes(ir),
+      autodiff.tape.size(), 1e6 * flatten, 1e6 * lower, 1e6 * rebuild);
+  }
+  return 0;
+}
@@ -0,0 +1,138 @@
+// Measure startup with precompiled formulas. A set of generated formulas is
+// compiled from source (parse, tape and program), its tapes are saved and
+// loaded with save_autodiff and load_autodiff, and its programs are written
+// to a library file, which is then opened and evaluated in place. The
+// library's results are checked against the programs compiled from source,
+// and a formula with no inputs and a library with no programs must round
+// trip too.
+
+#include <apex/autodiff_library.hxx>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+using namespace apex;
+
+typedef std::chrono::steady_clock clock_type;
+
+static double elapsed(clock_type::time_point t0) {
+  return std::chrono::duration<double>(clock_type::now() - t0).count();
+}
+
+int main(int argc, char** argv) {
+  int count = argc > 1 ? atoi(argv[1]) : 5000;
+
+  std::vector<autodiff_var_t> vars { { "x", 0 }, { "y", 0 }, { "z", 0 } };
+  const char* templates[] {
+    "sq(x / y) * sin(x * y) + %d",
+    "sin(x / y + z) / sq(x + y + %d)",
+    "tanh(sin(x) * exp(y / z)) * %d",
+    "norm(x, y, z) * exp((y - sq(x - %d)) / z)",
+    "pow(x, 3) + sqrt(x * y + z) * log(z + %d)",
+  };
+
+  std::vector<std::string> names(count), formulas(count);
+  for(int i = 0; i < count; ++i) {
+    names[i] = format("f%d", i);
+    formulas[i] = format(templates[i % 5], i + 1);
+  }
+
+  auto t0 = clock_type::now();
+  std::vector<autodiff_t> tapes(count);
+  std::vector<autodiff_program_t> programs(count);
+  for(int i = 0; i < count; ++i) {
+    tapes[i] = make_autodiff(formulas[i], vars);
+    programs[i] = make_autodiff_program(tapes[i]);
+  }
+  double compile = elapsed(t0);
+
+  t0 = clock_type::now();
+  std::vector<std::string> saved(count);
+  size_t tape_bytes = 0;
+  for(int i = 0; i < count; ++i) {
+    saved[i] = save_autodiff(tapes[i]);
+    tape_bytes += saved[i].size();
+  }
+  double save_tapes = elapsed(t0);
+
+  t0 = clock_type::now();
+  for(int i = 0; i < count; ++i)
+    load_autodiff(saved[i].data(), saved[i].size());
+  double load_tapes = elapsed(t0);
+
+  char path[] = "/tmp/apex_library_XXXXXX";
+  int fd = mkstemp(path);
+  if(-1 == fd) {
+    perror("mkstemp");
+    return 1;
+  }
+  t0 = clock_type::now();
+  std::string data = save_autodiff_library(names, programs);
+  bool ok = data.size() == (size_t)write(fd, data.data(), data.size());
+  close(fd);
+  double save_library = elapsed(t0);
+  if(!ok) {
+    perror("write");
+    unlink(path);
+    return 1;
+  }
+
+  t0 = clock_type::now();
+  autodiff_library_t library = autodiff_library_t::open(path);
+  double open_library = elapsed(t0);
+
+  // Look up every program by name and evaluate it at one point.
+  double max_error = 0;
+  std::vector<double> scratch;
+  t0 = clock_type::now();
+  for(int i = 0; i < count; ++i) {
+    int index = library.find(names[i]);
+    autodiff_program_view_t view = library.program(index);
+    scratch.resize(view.num_slots);
+    double inputs[3] { 1.1, 1.3, 1.7 }, grad[3];
+    double value = autodiff_eval(view, inputs, grad, scratch.data());
+
+    scratch.resize(programs[i].num_slots);
+    double grad2[3];
+    double value2 = autodiff_eval(programs[i], inputs, grad2,
+      scratch.data());
+    max_error = std::max(max_error, std::abs(value - value2));
+    for(int j = 0; j < 3; ++j)
+      max_error = std::max(max_error, std::abs(grad[j] - grad2[j]));
+  }
+  double eval_library = elapsed(t0);
+
+  printf("%d formulas\n", count);
+  printf("%-32s %10.2f ms\n", "compile from source", 1e3 * compile);
+  printf("%-32s %10.2f ms (%zu bytes)\n", "save_autodiff", 1e3 * save_tapes,
+    tape_bytes);
+  printf("%-32s %10.2f ms\n", "load_autodiff", 1e3 * load_tapes);
+  printf("%-32s %10.2f ms (%zu bytes)\n", "write library",
+    1e3 * save_library, data.size());
+  printf("%-32s %10.2f ms\n", "open library", 1e3 * open_library);
+  printf("%-32s %10.2f ms\n", "find and evaluate twice", 1e3 * eval_library);
+  printf("max difference from source: %g\n", max_error);
+  unlink(path);
+
+  // Empty arrays. The constant formula has no inputs and no gradient.
+  std::string constant = save_autodiff(make_autodiff("2 + 3", { }));
+  autodiff_program_t program = make_autodiff_program(
+    load_autodiff(constant.data(), constant.size()));
+  scratch.resize(program.num_slots);
+  double value = autodiff_eval(program, nullptr, nullptr, scratch.data());
+
+  std::string empty = save_autodiff_library({ }, { });
+  std::vector<double> aligned(empty.size() / sizeof(double));
+  memcpy(aligned.data(), empty.data(), empty.size());
+  autodiff_library_t empty_library(aligned.data(), empty.size());
+  if(5 != value || empty_library.size()) {
+    printf("empty round trip: value %f, %zu programs\n", value,
+      empty_library.size());
+    return 1;
+  }
+
+  return max_error > 0 ? 1 : 0;
+}
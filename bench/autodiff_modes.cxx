@@ -0,0 +1,90 @@
+// Find the crossover between forward-mode and reverse-mode gradients. Each
+// formula is compiled both ways and run through the scalar interpreter.
+// Forward mode runs one tangent pass per input, while reverse mode runs one
+// adjoint sweep, so forward mode should win only for very few inputs.
+
+#include <apex/autodiff_program.hxx>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace apex;
+
+typedef std::chrono::steady_clock clock_type;
+
+static double time_program(const autodiff_program_t& program, int num_evals) {
+  int num_vars = program.vars.size();
+  std::vector<double> scratch(program.num_slots);
+  std::vector<double> inputs(num_vars), grad(num_vars);
+  double sum = 0;
+  auto t0 = clock_type::now();
+  for(int i = 0; i < num_evals; ++i) {
+    for(int j = 0; j < num_vars; ++j)
+      inputs[j] = .5 + 1e-6 * ((i + j) & 1023);
+    sum += autodiff_eval(program, inputs.data(), grad.data(), scratch.data());
+    sum += grad[0];
+  }
+  double seconds = 
+    std::chrono::duration<double>(clock_type::now() - t0).count();
+  if(sum == 12345) printf("\n");
+  return 1e9 * seconds / num_evals;
+}
+
+static void report(const std::string& formula, 
+  const std::vector<autodiff_var_t>& vars, int num_evals) {
+
+  autodiff_program_t forward = make_autodiff_program(
+    make_autodiff(formula, vars, autodiff_mode_forward));
+  autodiff_program_t reverse = make_autodiff_program(
+    make_autodiff(formula, vars, autodiff_mode_reverse));
+
+  // Interleave the runs and keep the best of each, to damp noise.
+  double forward_ns = 1e30, reverse_ns = 1e30;
+  for(int rep = 0; rep < 3; ++rep) {
+    forward_ns = std::min(forward_ns, time_program(forward, num_evals));
+    reverse_ns = std::min(reverse_ns, time_program(reverse, num_evals));
+  }
+  autodiff_mode_t selected = select_autodiff_mode(vars.size(), 1);
+
+  std::string name = formula.size() > 44 ? 
+    formula.substr(0, 41) + "..." : formula;
+  printf("%-44s %6zu %7zu %7zu %9.1f %9.1f %8s %8s\n", name.c_str(),
+    vars.size(), forward.instrs.size(), reverse.instrs.size(), forward_ns,
+    reverse_ns, forward_ns < reverse_ns ? "forward" : "reverse", 
+    autodiff_mode_forward == selected ? "forward" : "reverse");
+}
+
+int main(int argc, char** argv) {
+  int num_evals = argc > 1 ? atoi(argv[1]) : 500000;
+
+  printf("%-44s %6s %7s %7s %9s %9s %8s %8s\n", "formula", "inputs",
+    "fwd ops", "rev ops", "fwd ns", "rev ns", "faster", "selected");
+
+  // A ring of coupled terms over n inputs.
+  for(int n = 1; n <= 8; ++n) {
+    std::vector<autodiff_var_t> vars;
+    for(int i = 0; i < n; ++i)
+      vars.push_back({ format("x%d", i), 0 });
+
+    std::string formula;
+    for(int i = 0; i < n; ++i) {
+      std::string a = vars[i].name, b = vars[(i + 1) % n].name;
+      if(i) formula += " + ";
+      formula += "sin(" + a + " * " + b + ") * exp(" + a + " / (" + b + 
+        " + 2))";
+    }
+    report(formula, vars, num_evals);
+  }
+
+  // Deep compositions of a single input.
+  std::vector<autodiff_var_t> x { { "x", 0 } };
+  report("tanh(sin(exp(x) * x) + cos(x * x) / sqrt(x + 1))", x, num_evals);
+  report("sin(sin(sin(sin(sin(sin(x))))))", x, num_evals);
+
+  std::vector<autodiff_var_t> xy { { "x", 0 }, { "y", 0 } };
+  report("sq(x / y) * sin(x * y)", xy, num_evals);
+  report("log(x * y + 1) * tanh(x - y) + exp(x / (y + 2))", xy, num_evals);
+
+  return 0;
+}
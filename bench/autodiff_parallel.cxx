@@ -0,0 +1,71 @@
+// Measure how batch gradient evaluation scales across threads. Runs the
+// parallel driver at 1, 2, 4, ... threads up to the hardware concurrency
+// and reports points/sec, speedup and parallel efficiency.
+
+#include <apex/autodiff_program.hxx>
+#include <apex/thread_pool.hxx>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+using namespace apex;
+
+typedef std::chrono::steady_clock clock_type;
+
+int main(int argc, char** argv) {
+  size_t count = argc > 1 ? atoi(argv[1]) : 1<< 22;
+  int max_threads = argc > 2 ? atoi(argv[2]) : 
+    std::max<int>(1, std::thread::hardware_concurrency());
+  int reps = 5;
+
+  std::vector<autodiff_var_t> vars { { "x", 0 }, { "y", 0 }, { "z", 0 } };
+  const char* formula = "tanh(sin(x) * exp(y / z)) + norm(x, y, z) * log(z)";
+  autodiff_program_t program =
+    make_autodiff_program(make_autodiff(formula, vars));
+
+  std::mt19937_64 rng(2020);
+  std::uniform_real_distribution<double> dist(.1, 3);
+  std::vector<double> x(3 * count);
+  for(double& v : x) v = dist(rng);
+  const double* inputs[3] { x.data(), x.data() + count, 
+    x.data() + 2 * count };
+
+  std::vector<double> values(count), grad_data(3 * count);
+  double* grads[3] { grad_data.data(), grad_data.data() + count,
+    grad_data.data() + 2 * count };
+
+  std::vector<int> thread_counts;
+  for(int n = 1; n < max_threads; n *= 2)
+    thread_counts.push_back(n);
+  thread_counts.push_back(max_threads);
+
+  printf("%s, %zu points\n", formula, count);
+  printf("%8s %12s %8s %10s\n", "threads", "points/s", "speedup", 
+    "efficiency");
+
+  double base_rate = 0;
+  for(int num_threads : thread_counts) {
+    thread_pool_t pool(num_threads);
+
+    // Warm up the workers and their thread-local scratch.
+    autodiff_eval_parallel(pool, program, count, inputs, values.data(),
+      grads);
+
+    double best = 1e30;
+    for(int rep = 0; rep < reps; ++rep) {
+      auto t0 = clock_type::now();
+      autodiff_eval_parallel(pool, program, count, inputs, values.data(),
+        grads);
+      best = std::min(best, 
+        std::chrono::duration<double>(clock_type::now() - t0).count());
+    }
+
+    double rate = count / best;
+    if(1 == num_threads) base_rate = rate;
+    printf("%8d %12.4g %8.2f %9.0f%%\n", num_threads, rate, rate / base_rate,
+      100 * rate / base_rate / num_threads);
+  }
+
+  return 0;
+}
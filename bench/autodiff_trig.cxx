@@ -0,0 +1,113 @@
+// Time trigonometric and hyperbolic formulas through the scalar interpreter
+// and the batch evaluator. The formulas from the examples are followed by
+// kinematics formulas, where the same angle feeds both a sin and a cos, and
+// the gradient needs the other function of every angle as well. Each pair
+// of sin and cos (or sinh and cosh) of one argument should cost a single
+// call, which is counted in the calls column.
+
+#include <apex/autodiff_program.hxx>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace apex;
+
+typedef std::chrono::steady_clock clock_type;
+
+static double elapsed(clock_type::time_point t0) {
+  return std::chrono::duration<double>(clock_type::now() - t0).count();
+}
+
+// Count the instructions that call an elementary function, rather than doing
+// arithmetic.
+static int count_calls(const autodiff_program_t& program) {
+  return std::count_if(program.instrs.begin(), program.instrs.end(),
+    [](const autodiff_program_t::instr_t& instr) {
+      return instr.op >= autodiff_program_t::op_sqrt &&
+        autodiff_program_t::op_abs != instr.op;
+    });
+}
+
+static double time_scalar(const autodiff_program_t& program, int count) {
+  std::vector<double> scratch(program.num_slots);
+  double sum = 0;
+  auto t0 = clock_type::now();
+  for(int i = 0; i < count; ++i) {
+    double inputs[3] { .3 + 1e-6 * (i & 1023), .5, .7 };
+    double grad[3];
+    sum += autodiff_eval(program, inputs, grad, scratch.data());
+    sum += grad[0];
+  }
+  double seconds = elapsed(t0);
+  if(sum == 12345) printf("\n");
+  return 1e9 * seconds / count;
+}
+
+static double time_batch(const autodiff_program_t& program, int count) {
+  std::vector<double> x(3 * count), values(count), grad_data(3 * count);
+  for(int i = 0; i < count; ++i) {
+    x[i] = .3 + 1e-6 * (i & 1023);
+    x[count + i] = .5;
+    x[2 * count + i] = .7;
+  }
+  const double* inputs[3] { x.data(), x.data() + count,
+    x.data() + 2 * count };
+  double* grads[3] { grad_data.data(), grad_data.data() + count,
+    grad_data.data() + 2 * count };
+  std::vector<double> scratch(autodiff_batch_scratch_size(program));
+
+  auto t0 = clock_type::now();
+  autodiff_eval_batch(program, count, inputs, values.data(), grads,
+    scratch.data());
+  return 1e9 * elapsed(t0) / count;
+}
+
+int main(int argc, char** argv) {
+  int count = argc > 1 ? atoi(argv[1]) : 1<< 18;
+  int reps = argc > 2 ? atoi(argv[2]) : 5;
+
+  std::vector<autodiff_var_t> vars { { "x", 0 }, { "y", 0 }, { "z", 0 } };
+  const char* formulas[] {
+    // examples/grad1.cxx, formula.json and formula2.json.
+    "sq(x / y) * sin(x * y)",
+    "sin(x / y + z) / sq(x + y + z)",
+    "tanh(sin(x) * exp(y / z))",
+    "exp(x * x) + y / z",
+    "sqrt(sq(x) + sq(y) + sq(z))",
+
+    // Reach error of two and three link planar arms, with joint angles x,
+    // y and z.
+    "sq(cos(x) + .8 * cos(x + y) - 1.2) + sq(sin(x) + .8 * sin(x + y) - .9)",
+    "sq(cos(x) + cos(x + y) + cos(x + y + z) - 1.5) + "
+      "sq(sin(x) + sin(x + y) + sin(x + y + z) - 1)",
+
+    // One entry of a ZYZ Euler rotation matrix.
+    "cos(x) * cos(y) * cos(z) - sin(x) * sin(z)",
+
+    // Hyperbolic and tangent functions.
+    "y * cosh(x / y) - z * sinh(z)",
+    "tan(x) * tanh(y) + sin(tan(z))",
+  };
+
+  printf("%-48s %6s %6s %10s %10s\n", "formula", "ops", "calls",
+    "scalar ns", "batch ns");
+
+  for(const char* formula : formulas) {
+    autodiff_program_t program =
+      make_autodiff_program(make_autodiff(formula, vars));
+
+    double scalar_ns = 1e30, batch_ns = 1e30;
+    for(int rep = 0; rep < reps; ++rep) {
+      scalar_ns = std::min(scalar_ns, time_scalar(program, count));
+      batch_ns = std::min(batch_ns, time_batch(program, count));
+    }
+
+    std::string name = formula;
+    if(name.size() > 48) name = name.substr(0, 45) + "...";
+    printf("%-48s %6zu %6d %10.2f %10.2f\n", name.c_str(),
+      program.instrs.size(), count_calls(program), scalar_ns, batch_ns);
+  }
+
+  return 0;
+}
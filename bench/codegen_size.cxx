@@ -0,0 +1,187 @@
+// Compare the size of the code generated by the two reverse-mode lowerings
+// of an autodiff tape:
+//
+// 1. The path-enumerating lowering, which recursed from the root down every
+//    edge and re-expanded a shared tape item once for each path reaching it.
+// 2. The topological sweep in autodiff_codegen.hxx, which visits each tape
+//    item once in reverse order and accumulates an adjoint per tape slot.
+//
+// The generated code can't be measured without the Circle compiler, so we
+// model each lowering by counting the statements and ad_t expression nodes
+// its macros would emit. Counts for the recursive lowering are computed with
+// memoization, so deep DAGs with exponentially many paths are cheap to score.
+
+#include <apex/autodiff.hxx>
+#include <cstdio>
+#include <functional>
+
+using namespace apex;
+
+struct codegen_size_t {
+  double stmts;
+  double nodes;
+};
+
+static double count_nodes(const ad_t* ad) {
+  double count = 1;
+  if(auto* unary = ad->as<ad_unary_t>()) {
+    count += count_nodes(unary->a);
+
+  } else if(auto* binary = ad->as<ad_binary_t>()) {
+    count += count_nodes(binary->a) + count_nodes(binary->b);
+
+  } else if(auto* func = ad->as<ad_func_t>()) {
+    for(const auto& arg : func->args)
+      count += count_nodes(arg);
+  }
+  return count;
+}
+
+// Each edge emits 'adjoints[child] += adjoints[parent] * coef'.
+static codegen_size_t sweep_size(const autodiff_t& autodiff) {
+  codegen_size_t size { };
+  int num_vars = autodiff.vars.size();
+  for(int i = autodiff.tape.size() - 1; i >= num_vars; --i) {
+    for(const auto& g : autodiff.tape[i].grads) {
+      size.stmts += 1;
+      size.nodes += count_nodes(g.coef) + 2;
+    }
+  }
+  return size;
+}
+
+// Each edge emits 'coef[index] = coef[parent] * coef' and then expands the
+// whole subtree under the child. Terminals emit 'grad += coef[parent]'.
+static codegen_size_t recursive_size(const autodiff_t& autodiff) {
+  int num_vars = autodiff.vars.size();
+  std::vector<codegen_size_t> memo(autodiff.tape.size());
+  std::vector<bool> visited(autodiff.tape.size());
+
+  std::function<codegen_size_t(int)> expand = [&](int index) {
+    if(index < num_vars)
+      return codegen_size_t { 1, 1 };
+
+    if(!visited[index]) {
+      codegen_size_t size { };
+      for(const auto& g : autodiff.tape[index].grads) {
+        codegen_size_t child = expand(g.index);
+        size.stmts += 1 + child.stmts;
+        size.nodes += count_nodes(g.coef) + 2 + child.nodes;
+      }
+      memo[index] = size;
+      visited[index] = true;
+    }
+    return memo[index];
+  };
+
+  return expand(autodiff.tape.size() - 1);
+}
+
+static int count_edges(const autodiff_t& autodiff) {
+  int edges = 0;
+  for(const auto& item : autodiff.tape)
+    edges += item.grads.size();
+  return edges;
+}
+
+static void report(const char* name, const autodiff_t& autodiff) {
+  codegen_size_t rec = recursive_size(autodiff);
+  codegen_size_t sweep = sweep_size(autodiff);
+  printf("%-32s %7zu %7d %12.4g %10.4g %12.4g %10.4g %10.4g\n", name,
+    autodiff.tape.size(), count_edges(autodiff), rec.stmts, sweep.stmts,
+    rec.nodes, sweep.nodes, rec.nodes / sweep.nodes);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Hand-built tapes with heavy sharing. These don't depend on the builder's
+// subexpression elimination to produce a DAG.
+
+static ad_ptr_t tape_ref(autodiff_t& autodiff, int index) {
+  return autodiff.arena.make<ad_tape_t>(index);
+}
+
+static autodiff_t make_vars(int count) {
+  autodiff_t autodiff;
+  for(int i = 0; i < count; ++i)
+    autodiff.vars.push_back({ format("x%d", i), 0 });
+  autodiff.tape.resize(count);
+  return autodiff;
+}
+
+// Item k = item (k - 1) * item (k - 2). The number of root-to-leaf paths
+// grows like the Fibonacci sequence.
+static autodiff_t fibonacci_dag(int depth) {
+  autodiff_t autodiff = make_vars(2);
+  for(int k = 2; k < depth + 2; ++k) {
+    autodiff_t::item_t item { };
+    item.val = autodiff.arena.make<ad_binary_t>("*", 
+      tape_ref(autodiff, k - 1), tape_ref(autodiff, k - 2));
+    item.grads.push_back({ k - 1, tape_ref(autodiff, k - 2) });
+    item.grads.push_back({ k - 2, tape_ref(autodiff, k - 1) });
+    autodiff.tape.push_back(std::move(item));
+  }
+  return autodiff;
+}
+
+// Layers of width items, each depending on every item in the layer below,
+// like norm(a, b, c) feeding several terms. Paths grow like width^depth.
+static autodiff_t layered_dag(int width, int depth) {
+  autodiff_t autodiff = make_vars(width);
+  int prev = 0;
+  for(int layer = 0; layer < depth; ++layer) {
+    int begin = autodiff.tape.size();
+    int count = (layer + 1 == depth) ? 1 : width;
+    for(int i = 0; i < count; ++i) {
+      autodiff_t::item_t item { };
+      item.val = tape_ref(autodiff, prev);
+      for(int j = 0; j < width; ++j)
+        item.grads.push_back({ prev + j, autodiff.arena.make<ad_binary_t>("/",
+          tape_ref(autodiff, prev + j), tape_ref(autodiff, begin + i)) });
+      autodiff.tape.push_back(std::move(item));
+    }
+    prev = begin;
+  }
+  return autodiff;
+}
+
+// Formula text that repeats its subexpressions. Once the builder eliminates
+// common subexpressions, these become deep shared DAGs.
+static std::string shared_formula(int depth) {
+  std::string f = "norm(x, y, z)";
+  for(int i = 0; i < depth; ++i)
+    f = "sin(" + f + ") * cos(" + f + ") + " + f;
+  return f;
+}
+
+int main() {
+  printf("%-32s %7s %7s %12s %10s %12s %10s %10s\n", "tape", "items",
+    "edges", "rec stmts", "sweep stmts", "rec nodes", "sweep nodes", "ratio");
+
+  for(int depth : { 10, 20, 40, 80 }) {
+    std::string name = format("fibonacci %d", depth);
+    report(name.c_str(), fibonacci_dag(depth));
+  }
+
+  for(int width : { 2, 3, 4 }) {
+    for(int depth : { 4, 8, 16 }) {
+      std::string name = format("layered %dx%d", width, depth);
+      report(name.c_str(), layered_dag(width, depth));
+    }
+  }
+
+  std::vector<autodiff_var_t> vars { { "x", 0 }, { "y", 0 }, { "z", 0 } };
+  const char* formulas[] {
+    "sq(x / y) * sin(x * y)",
+    "sin(x / y + z) / sq(x + y + z)",
+    "tanh(sin(x) * exp(y / z))",
+  };
+  for(const char* formula : formulas)
+    report(formula, make_autodiff(formula, vars));
+
+  for(int depth : { 2, 4, 6 }) {
+    std::string name = format("shared formula %d", depth);
+    report(name.c_str(), make_autodiff(shared_formula(depth), vars));
+  }
+
+  return 0;
+}
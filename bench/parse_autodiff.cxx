@@ -0,0 +1,147 @@
+// Measure heap traffic and wall time for parsing formulas and building their
+// autodiff tapes. Global operator new and delete are replaced to count
+// allocations made anywhere in the process, including inside libapex.
+
+#include <apex/autodiff.hxx>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+using namespace apex;
+
+static size_t num_allocs = 0;
+static size_t num_frees = 0;
+
+void* operator new(size_t size) {
+  ++num_allocs;
+  if(void* p = malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+  if(p) ++num_frees;
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  operator delete(p);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static const char* var_names[] { "x", "y", "z" };
+static const char* unary_funcs[] {
+  "sq", "sqrt", "exp", "log", "sin", "cos", "tan", "sinh", "cosh", "tanh"
+};
+static const char binary_ops[] { '+', '-', '*', '/' };
+
+static std::string random_formula(std::mt19937& rng, int depth) {
+  std::uniform_int_distribution<int> pick(0, 99);
+  if(!depth || pick(rng) < 15) {
+    // Scale some variables by a literal. Keep literals out of binary 
+    // expressions with other literals so the parser doesn't fold them.
+    const char* var = var_names[pick(rng) % 3];
+    if(pick(rng) < 75)
+      return var;
+    else
+      return format("%d.%d * %s", pick(rng) % 10, pick(rng), var);
+  }
+
+  int choice = pick(rng);
+  if(choice < 50) {
+    char op = binary_ops[pick(rng) % 4];
+    return "(" + random_formula(rng, depth - 1) + " " + op + " " +
+      random_formula(rng, depth - 1) + ")";
+
+  } else if(choice < 85) {
+    return std::string(unary_funcs[pick(rng) % 10]) + "(" +
+      random_formula(rng, depth - 1) + ")";
+
+  } else if(choice < 92) {
+    return "pow(" + random_formula(rng, depth - 1) + ", " +
+      random_formula(rng, depth - 1) + ")";
+
+  } else {
+    return "norm(" + random_formula(rng, depth - 1) + ", " +
+      random_formula(rng, depth - 1) + ", " +
+      random_formula(rng, depth - 1) + ")";
+  }
+}
+
+struct phase_t {
+  size_t allocs = 0;
+  size_t frees = 0;
+  double seconds = 0;
+};
+
+typedef std::chrono::steady_clock clock_type;
+
+static double elapsed(clock_type::time_point t0) {
+  return std::chrono::duration<double>(clock_type::now() - t0).count();
+}
+
+int main(int argc, char** argv) {
+  int num_formulas = argc > 1 ? atoi(argv[1]) : 10000;
+  int depth = argc > 2 ? atoi(argv[2]) : 6;
+
+  std::mt19937 rng(2020);
+  std::vector<std::string> formulas(num_formulas);
+  size_t num_chars = 0;
+  for(std::string& formula : formulas) {
+    formula = random_formula(rng, depth);
+    num_chars += formula.size();
+  }
+
+  std::vector<autodiff_var_t> vars { { "x", 0 }, { "y", 0 }, { "z", 0 } };
+  std::vector<parse::parse_t> parses;
+  std::vector<autodiff_t> tapes;
+  parses.reserve(num_formulas);
+  tapes.reserve(num_formulas);
+
+  phase_t parse, build, teardown;
+
+  size_t allocs = num_allocs, frees = num_frees;
+  auto t0 = clock_type::now();
+  for(const std::string& formula : formulas)
+    parses.push_back(parse::parse_expression(formula.c_str()));
+  parse.seconds = elapsed(t0);
+  parse.allocs = num_allocs - allocs;
+  parse.frees = num_frees - frees;
+
+  allocs = num_allocs, frees = num_frees;
+  t0 = clock_type::now();
+  for(const parse::parse_t& p : parses)
+    tapes.push_back(make_autodiff(p, vars));
+  build.seconds = elapsed(t0);
+  build.allocs = num_allocs - allocs;
+  build.frees = num_frees - frees;
+
+  size_t tape_items = 0;
+  for(const autodiff_t& autodiff : tapes)
+    tape_items += autodiff.tape.size();
+
+  allocs = num_allocs, frees = num_frees;
+  t0 = clock_type::now();
+  tapes.clear();
+  parses.clear();
+  teardown.seconds = elapsed(t0);
+  teardown.allocs = num_allocs - allocs;
+  teardown.frees = num_frees - frees;
+
+  printf("%d formulas, %zu chars, %zu tape items\n", num_formulas, num_chars,
+    tape_items);
+  printf("%-10s %12s %12s %12s %14s\n", "phase", "allocs", "frees",
+    "ms", "allocs/formula");
+  auto print = [&](const char* name, const phase_t& phase) {
+    printf("%-10s %12zu %12zu %12.2f %14.1f\n", name, phase.allocs,
+      phase.frees, 1000 * phase.seconds,
+      (double)phase.allocs / num_formulas);
+  };
+  print("parse", parse);
+  print("build", build);
+  print("teardown", teardown);
+
+  return 0;
+}
@@ -0,0 +1,125 @@
+// Measure the cost of syntax errors. Parse a set of random formulas, then the
+// same formulas with two errors each, a dropped operand and an unclosed
+// paren. Malformed formulas are reported once through parse_expression,
+// which records diagnostics and recovers, and once through make_autodiff,
+// which throws them, as a caller validating formulas one at a time would
+// see them. Formulas that parse but use expressions the tape can't hold must
+// throw too, and the program fails if one doesn't.
+
+#include <apex/autodiff.hxx>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+using namespace apex;
+
+static const char* var_names[] { "x", "y", "z" };
+static const char* unary_funcs[] { "sq", "sqrt", "exp", "log", "sin", "cos" };
+static const char binary_ops[] { '+', '-', '*', '/' };
+
+static std::string random_formula(std::mt19937& rng, int depth) {
+  std::uniform_int_distribution<int> pick(0, 99);
+  if(!depth || pick(rng) < 15) {
+    const char* var = var_names[pick(rng) % 3];
+    if(pick(rng) < 75)
+      return var;
+    else
+      return format("%d.%d * %s", pick(rng) % 10, pick(rng), var);
+  }
+
+  if(pick(rng) < 55) {
+    char op = binary_ops[pick(rng) % 4];
+    return "(" + random_formula(rng, depth - 1) + " " + op + " " +
+      random_formula(rng, depth - 1) + ")";
+  } else
+    return std::string(unary_funcs[pick(rng) % 6]) + "(" +
+      random_formula(rng, depth - 1) + ")";
+}
+
+// Drop the operand after the first binary operator and the last ')'.
+static std::string break_formula(std::string formula) {
+  size_t op = formula.find_first_of("+-*/");
+  size_t end = (std::string::npos != op) ?
+    formula.find_first_of(")", op) : std::string::npos;
+  if(std::string::npos != end)
+    formula.erase(op + 1, end - op - 1);
+  else
+    formula += " +";
+
+  size_t close = formula.rfind(')');
+  if(std::string::npos != close)
+    formula.erase(close, 1);
+  else
+    formula.insert(0, "(");
+  return formula;
+}
+
+typedef std::chrono::steady_clock clock_type;
+
+static double elapsed(clock_type::time_point t0) {
+  return std::chrono::duration<double>(clock_type::now() - t0).count();
+}
+
+int main(int argc, char** argv) {
+  int num_formulas = argc > 1 ? atoi(argv[1]) : 20000;
+
+  std::mt19937 rng(2022);
+  std::vector<std::string> valid(num_formulas), invalid(num_formulas);
+  for(int i = 0; i < num_formulas; ++i) {
+    valid[i] = random_formula(rng, 6);
+    invalid[i] = break_formula(valid[i]);
+  }
+
+  std::vector<autodiff_var_t> vars { { "x", 0 }, { "y", 0 }, { "z", 0 } };
+
+  printf("%d formulas\n", num_formulas);
+  printf("%-26s %10s %12s %8s\n", "", "ms", "formulas/s", "errors");
+
+  auto report = [&](const char* label, double seconds, size_t errors) {
+    printf("%-26s %10.2f %12.0f %8zu\n", label, 1000 * seconds,
+      num_formulas / seconds, errors);
+  };
+
+  for(int pass = 0; pass < 2; ++pass) {
+    const std::vector<std::string>& formulas = pass ? invalid : valid;
+    const char* kind = pass ? "invalid" : "valid";
+
+    // Diagnostics. Every error in the formula is counted.
+    auto t0 = clock_type::now();
+    size_t diagnostics = 0;
+    for(const std::string& f : formulas)
+      diagnostics += parse::parse_expression(f.c_str()).diagnostics.size();
+    report(format("parse_expression %s", kind).c_str(), elapsed(t0),
+      diagnostics);
+
+    // Exceptions. Formulas that parse also build their tapes.
+    t0 = clock_type::now();
+    size_t exceptions = 0;
+    for(const std::string& f : formulas) {
+      try {
+        make_autodiff(f, vars);
+      } catch(const ad_exeption_t&) {
+        ++exceptions;
+      }
+    }
+    report(format("make_autodiff %s", kind).c_str(), elapsed(t0), exceptions);
+  }
+
+  // Show the report for one malformed formula.
+  parse::parse_t parse = parse::parse_expression(invalid[0].c_str());
+  printf("\n%s\n", format_diagnostics(parse).c_str());
+
+  // Valid syntax with no tape lowering.
+  const char* unsupported[] {
+    "x ? y : x", "x = y", "x ? 1 : 2", "sin(x ? y : x)", "x + (y = z)"
+  };
+  for(const char* f : unsupported) {
+    try {
+      make_autodiff(f, vars);
+      printf("\n%s: expected an unsupported expression error\n", f);
+      return 1;
+    } catch(const ad_exeption_t&) { }
+  }
+  return 0;
+}
@@ -0,0 +1,129 @@
+// Measure the parser on generated expressions of three shapes: one very wide
+// expression that mixes operators of every binary precedence, many deeply
+// nested parenthesized expressions, and nested calls whose arguments are
+// binary expressions. Sources are tokenized up front, so only parse_tokens is
+// timed. Global operator new is replaced to count the parser's allocations,
+// which include the arena's blocks and argument lists.
+
+#include <apex/parse.hxx>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+using namespace apex;
+
+static size_t num_allocs = 0;
+
+void* operator new(size_t size) {
+  ++num_allocs;
+  if(void* p = malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  operator delete(p);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static const char* binary_ops[] {
+  " * ", " / ", " + ", " - ", " << ", " < ", " == ", " & ", " ^ ", " | ",
+  " && ", " || "
+};
+
+static std::string var(std::mt19937& rng) {
+  return format("x%d", rng() % 100);
+}
+
+// a * b + c << d < e ... over n terms.
+static std::string wide(std::mt19937& rng, int n) {
+  std::string text = var(rng);
+  for(int i = 1; i < n; ++i) {
+    text += binary_ops[rng() % 12];
+    text += var(rng);
+  }
+  return text;
+}
+
+// Parenthesized subexpressions nested depth deep, alternating sides.
+static std::string deep(std::mt19937& rng, int depth) {
+  std::string text = var(rng);
+  for(int i = 0; i < depth; ++i) {
+    const char* op = binary_ops[rng() % 4];
+    text = (i % 2) ?
+      "(" + var(rng) + op + text + ")" :
+      "(" + text + op + var(rng) + ")";
+  }
+  return text;
+}
+
+// f(a + b, g(c * d, ...)) nested depth deep.
+static std::string calls(std::mt19937& rng, int depth) {
+  if(!depth)
+    return var(rng) + binary_ops[rng() % 4] + var(rng);
+  return format("f%d(", depth) + calls(rng, depth - 1) + ", " +
+    var(rng) + binary_ops[rng() % 4] + var(rng) + ")";
+}
+
+// Join count copies of a shape into one source.
+template<typename gen_t>
+static std::string repeat(int count, gen_t gen) {
+  std::string text;
+  for(int i = 0; i < count; ++i) {
+    if(i) text += " +\n  ";
+    text += gen();
+  }
+  return text;
+}
+
+typedef std::chrono::steady_clock clock_type;
+
+int main(int argc, char** argv) {
+  int reps = argc > 1 ? atoi(argv[1]) : 5;
+
+  std::mt19937 rng(2023);
+  struct {
+    const char* name;
+    std::string text;
+  } shapes[] {
+    { "wide 1M terms", wide(rng, 1000000) },
+    { "deep 4000 x 100", repeat(4000, [&] { return deep(rng, 100); }) },
+    { "calls 4000 x 30", repeat(4000, [&] { return calls(rng, 30); }) },
+  };
+
+  printf("%-18s %10s %10s %10s %12s\n", "", "tokens", "ms", "Mtok/s",
+    "allocs/ktok");
+  for(auto& shape : shapes) {
+    double best = 1e30;
+    size_t num_tokens = 0, allocs = 0;
+    for(int rep = 0; rep < reps; ++rep) {
+      parse::parse_t parse;
+      parse.tokenizer.tokenize(shape.text.data(),
+        shape.text.data() + shape.text.size());
+      num_tokens = parse.tokenizer.tokens.size();
+
+      size_t allocs0 = num_allocs;
+      auto t0 = clock_type::now();
+      parse::parse_tokens(parse);
+      double seconds = std::chrono::duration<double>(
+        clock_type::now() - t0).count();
+      allocs = num_allocs - allocs0;
+      best = std::min(best, seconds);
+
+      if(!parse.ok()) {
+        printf("%s: %s\n", shape.name, parse.diagnostics[0].msg.c_str());
+        return 1;
+      }
+    }
+
+    printf("%-18s %10zu %10.2f %10.2f %12.1f\n", shape.name, num_tokens,
+      1000 * best, num_tokens / best / 1e6, 1000.0 * allocs / num_tokens);
+  }
+  return 0;
+}
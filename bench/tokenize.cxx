@@ -0,0 +1,81 @@
+// Measure tokenizer throughput on large generated formula sources. Each
+// source is one long sum of terms over a pool of distinct identifiers, with
+// function calls and numbers, broken into indented lines of eight terms like
+// machine-generated formula files. Throughput is reported in MB/s for
+// several sizes and identifier counts, with the bytes per token held in the
+// token stream and the literal pool.
+
+#include <apex/tokenizer.hxx>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+using namespace apex;
+
+static std::string make_source(size_t size, int num_idents, unsigned seed) {
+  static const char* funcs[] { "sin", "cos", "exp", "sq", "sqrt", "log" };
+  static const char* ops[] { " + ", " - ", " * ", " / " };
+
+  std::mt19937 rng(seed);
+  std::string text;
+  text.reserve(size + 64);
+  int term = 0;
+  while(text.size() < size) {
+    if(term) {
+      text += ops[rng() % 4];
+      if(0 == term % 8) text += "\n  ";
+    }
+    ++term;
+    switch(rng() % 3) {
+      case 0:
+        text += format("%s(var_%d)", funcs[rng() % 6], rng() % num_idents);
+        break;
+      case 1:
+        text += format("%d.%03d * var_%d", rng() % 100, rng() % 1000,
+          rng() % num_idents);
+        break;
+      default:
+        text += format("var_%d", rng() % num_idents);
+        break;
+    }
+  }
+  return text;
+}
+
+typedef std::chrono::steady_clock clock_type;
+
+int main(int argc, char** argv) {
+  int reps = argc > 1 ? atoi(argv[1]) : 3;
+
+  printf("%8s %8s %10s %8s %10s %12s\n", "MB", "idents", "tokens",
+    "strings", "MB/s", "bytes/token");
+
+  for(size_t mb : { 1, 4, 16 }) {
+    for(int num_idents : { 100, 10000, 100000 }) {
+      std::string text = make_source(mb<< 20, num_idents, mb + num_idents);
+
+      double best = 1e30;
+      size_t num_tokens = 0, num_strings = 0, token_bytes = 0;
+      for(int rep = 0; rep < reps; ++rep) {
+        tok::tokenizer_t tokenizer;
+        tokenizer.text = text;
+
+        auto t0 = clock_type::now();
+        tokenizer.tokenize();
+        double seconds = std::chrono::duration<double>(
+          clock_type::now() - t0).count();
+        best = std::min(best, seconds);
+        num_tokens = tokenizer.tokens.size();
+        num_strings = tokenizer.strings.size();
+        token_bytes = num_tokens * sizeof(token_t) +
+          tokenizer.literals.size() * sizeof(tok::literal_t);
+      }
+
+      printf("%8zu %8d %10zu %8zu %10.1f %12.1f\n", mb, num_idents,
+        num_tokens, num_strings, text.size() / best / (1<< 20),
+        (double)token_bytes / num_tokens);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,158 @@
+// Measure tokenizing a generated formula source from a file three ways: read
+// into a string and tokenize a copy of it, map the file and tokenize it in
+// place, and append 64KB reads as they complete. Time is from opening the
+// file until the tokens are ready; "after EOF" is the part of it spent after
+// the last byte was read, which is what streaming hides behind the reads.
+
+#include <apex/tokenizer.hxx>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace apex;
+
+static std::string make_source(size_t size, int num_idents, unsigned seed) {
+  static const char* funcs[] { "sin", "cos", "exp", "sq", "sqrt", "log" };
+  static const char* ops[] { " + ", " - ", " * ", " / " };
+
+  std::mt19937 rng(seed);
+  std::string text;
+  text.reserve(size + 64);
+  int term = 0;
+  while(text.size() < size) {
+    if(term) {
+      text += ops[rng() % 4];
+      if(0 == term % 8) text += "\n  ";
+    }
+    ++term;
+    switch(rng() % 3) {
+      case 0:
+        text += format("%s(var_%d)", funcs[rng() % 6], rng() % num_idents);
+        break;
+      case 1:
+        text += format("%d.%03d * var_%d", rng() % 100, rng() % 1000,
+          rng() % num_idents);
+        break;
+      default:
+        text += format("var_%d", rng() % num_idents);
+        break;
+    }
+  }
+  return text;
+}
+
+typedef std::chrono::steady_clock clock_type;
+
+static double elapsed(clock_type::time_point t0) {
+  return std::chrono::duration<double>(clock_type::now() - t0).count();
+}
+
+enum { chunk_size = 1<< 16 };
+
+struct timing_t {
+  double seconds, after_eof;
+  size_t tokens;
+};
+
+static timing_t read_copy(const char* path) {
+  auto t0 = clock_type::now();
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  fstat(fd, &st);
+  std::string data(st.st_size, '\0');
+  for(size_t pos = 0; pos < data.size(); ) {
+    ssize_t n = read(fd, &data[pos], data.size() - pos);
+    if(n <= 0) break;
+    pos += n;
+  }
+  close(fd);
+  auto eof = clock_type::now();
+
+  tok::tokenizer_t tokenizer;
+  tokenizer.text = data;
+  tokenizer.tokenize();
+  return { elapsed(t0), elapsed(eof), tokenizer.tokens.size() };
+}
+
+static timing_t map_view(const char* path) {
+  auto t0 = clock_type::now();
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  fstat(fd, &st);
+  void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  auto eof = clock_type::now();
+
+  // Pages are read on first touch, so the tokenizer does the I/O here.
+  const char* data = (const char*)p;
+  tok::tokenizer_t tokenizer;
+  tokenizer.tokenize(data, data + st.st_size);
+  timing_t result { elapsed(t0), elapsed(eof), tokenizer.tokens.size() };
+  munmap(p, st.st_size);
+  return result;
+}
+
+static timing_t stream(const char* path) {
+  auto t0 = clock_type::now();
+  int fd = open(path, O_RDONLY);
+  tok::tokenizer_t tokenizer;
+  std::vector<char> chunk(chunk_size);
+  while(true) {
+    ssize_t n = read(fd, chunk.data(), chunk.size());
+    if(n <= 0) break;
+    tokenizer.append(chunk.data(), n);
+  }
+  close(fd);
+  auto eof = clock_type::now();
+
+  tokenizer.finish();
+  return { elapsed(t0), elapsed(eof), tokenizer.tokens.size() };
+}
+
+int main(int argc, char** argv) {
+  size_t size = (argc > 1 ? atoi(argv[1]) : 32)<< 20;
+
+  char path[] = "/tmp/apex_tokenize_XXXXXX";
+  int fd = mkstemp(path);
+  std::string text = make_source(size, 10000, 2021);
+  if(write(fd, text.data(), text.size()) != (ssize_t)text.size()) {
+    fprintf(stderr, "could not write %s\n", path);
+    return 1;
+  }
+  close(fd);
+  text.clear();
+  text.shrink_to_fit();
+
+  typedef timing_t(*run_t)(const char*);
+  struct {
+    const char* name;
+    run_t f;
+  } modes[] {
+    { "read + copy", read_copy },
+    { "mmap in place", map_view },
+    { "stream 64KB", stream },
+  };
+
+  printf("%zu MB source\n", size>> 20);
+  printf("%-16s %10s %10s %14s %10s\n", "", "ms", "MB/s", "after EOF ms",
+    "tokens");
+  for(auto& mode : modes) {
+    // Best of three.
+    timing_t best { 1e9, 0, 0 };
+    for(int i = 0; i < 3; ++i) {
+      timing_t timing = mode.f(path);
+      if(timing.seconds < best.seconds) best = timing;
+    }
+    printf("%-16s %10.2f %10.1f %14.2f %10zu\n", mode.name,
+      1000 * best.seconds, size / best.seconds / (1<< 20),
+      1000 * best.after_eof, best.tokens);
+  }
+
+  unlink(path);
+  return 0;
+}
@@ -1,3 +1,4 @@
+#pragma once
 #include <apex/util.hxx>
 #include <apex/parse.hxx>
 
@@ -10,6 +11,7 @@ struct ad_exeption_t : std::runtime_error {
 struct ad_t {
   enum kind_t {
     kind_tape,
+    kind_tangent,
     kind_component,
     kind_literal,
     kind_unary,
@@ -17,6 +19,9 @@ struct ad_t {
     kind_func
   };
   kind_t kind;
+
+  // The node's position in autodiff_t::nodes, or -1 for nodes built by hand.
+  int id = -1;
   
   ad_t(kind_t kind) : kind(kind) { }
 
@@ -34,7 +39,11 @@ struct ad_t {
       nullptr;
   }
 };
-typedef std::unique_ptr<ad_t> ad_ptr_t;
+// ad_t nodes are immutable and interned by the tape builder: structurally
+// identical subexpressions anywhere in the tape share a single node, so the
+// expressions form a DAG rather than a tree. Nodes are allocated from the 
+// arena in autodiff_t, which owns them.
+typedef const ad_t* ad_ptr_t;
 
 struct ad_tape_t : ad_t {
   ad_tape_t(int index) : ad_t(kind_tape), index(index) { }
@@ -43,11 +52,23 @@ struct ad_tape_t : ad_t {
   int index;
 };
 
+// The tangent (directional derivative) of a tape item. Only appears in 
+// forward-mode tangent expressions.
+struct ad_tangent_t : ad_t {
+  ad_tangent_t(int index) : ad_t(kind_tangent), index(index) { }
+  static bool classof(const ad_t* ad) { return kind_tangent == ad->kind; }
+
+  int index;
+};
+
+// A single component of a vector tape item.
 struct ad_component_t : ad_t {
-  ad_component_t(int index) : ad_t(kind_component), index(index) { }
+  ad_component_t(int index, int component) : 
+    ad_t(kind_component), index(index), component(component) { }
   static bool classof(const ad_t* ad) { return kind_component == ad->kind; }
 
   int index;
+  int component;
 };
 
 struct ad_literal_t : ad_t {
@@ -59,7 +80,7 @@ struct ad_literal_t : ad_t {
 
 struct ad_unary_t : ad_t {
   ad_unary_t(const char* op, ad_ptr_t a) :
-    ad_t(kind_unary), op(op), a(std::move(a)) { }
+    ad_t(kind_unary), op(op), a(a) { }
   static bool classof(const ad_t* ad) { return kind_unary == ad->kind; }
 
   const char* op;
@@ -68,7 +89,7 @@ struct ad_unary_t : ad_t {
 
 struct ad_binary_t : ad_t {
   ad_binary_t(const char* op, ad_ptr_t a, ad_ptr_t b) : 
-    ad_t(kind_binary), op(op), a(std::move(a)), b(std::move(b)) { }
+    ad_t(kind_binary), op(op), a(a), b(b) { }
   static bool classof(const ad_t* ad) { return kind_binary == ad->kind; }
 
   const char* op;
@@ -91,6 +112,34 @@ struct autodiff_var_t {
   int dim;
 };
 
+// Reverse mode propagates adjoints from the output back to every input in
+// one sweep, so its cost scales with the number of outputs. Forward mode
+// propagates tangents from one input to every output alongside the values, 
+// so its cost scales with the number of inputs.
+enum autodiff_mode_t {
+  autodiff_mode_reverse,
+  autodiff_mode_forward,
+};
+
+// Pick the mode that needs fewer derivative passes. On a tie, forward mode
+// wins, because it doesn't need to keep the tape for a second sweep.
+autodiff_mode_t select_autodiff_mode(int num_inputs, int num_outputs);
+
+// Counters collected while building the tape.
+struct autodiff_stats_t {
+  // Tape items found in the common subexpression elimination table, and
+  // tape items inserted after a failed lookup.
+  int cse_hits = 0;
+  int cse_misses = 0;
+
+  // Distinct ad_t nodes created, requests satisfied by an existing node,
+  // and expressions replaced by a reference to a tape value that already
+  // computes them.
+  int ad_nodes = 0;
+  int ad_hits = 0;
+  int ad_tape_reuses = 0;
+};
+
 struct autodiff_t {
   struct item_t {
     // The dimension of the tape item. 
@@ -110,20 +159,76 @@ struct autodiff_t {
     // When we hit an independent var, the grads array is empty (although it
     // may be empty otherwise) and we simply perform += coef into the slot
     // corresponding to the independent variable in the gradient array.
+    // Vector items are element-wise: val and each coef are evaluated once per
+    // component, and references to vector items inside them load the same
+    // component. Scalar items broadcast. The shapes of the item and its 
+    // operand determine how adjoints flow along an edge, except that a 
+    // component edge only feeds one component of a vector operand.
     struct grad_t {
       int index;
       ad_ptr_t coef;
+      int component = -1;
     };
     std::vector<grad_t> grads;
+
+    // If nonzero, this is a scalar reduction: val is evaluated for each of
+    // the reduce components of its operand, and the results are summed.
+    int reduce = 0;
+
+    // In forward mode, the tangent of this item: the sum of each operand's
+    // tangent times the partial derivative with respect to that operand.
+    ad_ptr_t tangent = nullptr;
   };
 
   // The first var_names.size() items encode independent variables.
   std::vector<autodiff_var_t> vars;
   std::vector<item_t> tape;
+
+  autodiff_mode_t mode = autodiff_mode_reverse;
+
+  // The tape item holding the formula's value. 
+  int root = -1;
+
+  // Second-order tapes also hold the gradient, built by sweeping the tape in
+  // reverse with the same derivative rules and pushing each adjoint as a 
+  // tape item. grad_items[i] holds the partial derivative with respect to 
+  // input i. Every item has a tangent, so the tangents of the gradient items
+  // are Hessian-vector products (forward-over-reverse).
+  int order = 1;
+  std::vector<int> grad_items;
+
+  // Holds every ad_t node referenced by the tape.
+  arena_t arena;
+
+  // Every interned node, in the order it was made. Operands precede the
+  // nodes that use them, so this is a topological order of the DAG, and
+  // make_autodiff_ir flattens it in one scan. Nodes that were made while 
+  // simplifying but aren't referenced by the tape are included.
+  std::vector<ad_ptr_t> nodes;
+
+  autodiff_stats_t stats;
 };
 
+// order is 1 for the gradient or 2 for a tape that also supports 
+// Hessian-vector products and Hessians. Second-order tapes are scalar-only.
 autodiff_t make_autodiff(const std::string& formula, 
-  const std::vector<autodiff_var_t>& vars);
+  const std::vector<autodiff_var_t>& vars, 
+  autodiff_mode_t mode = autodiff_mode_reverse, int order = 1);
+
+// Throws ad_exeption_t listing parse.diagnostics if the parse has errors.
+autodiff_t make_autodiff(const parse::parse_t& parse,
+  const std::vector<autodiff_var_t>& vars,
+  autodiff_mode_t mode = autodiff_mode_reverse, int order = 1);
+
+// The message make_autodiff throws for a parse with errors: the formula and
+// the location and text of each diagnostic.
+std::string format_diagnostics(const parse::parse_t& parse);
+
+// A compact binary encoding of a tape, for storing tapes between runs. 
+// load_autodiff throws ad_exeption_t if data isn't a tape written by this
+// version of the format.
+std::string save_autodiff(const autodiff_t& autodiff);
+autodiff_t load_autodiff(const char* data, size_t size);
 
 std::string print_ad(const ad_t* ad, int indent = 0);
 std::string print_autodiff(const autodiff_t& autodiff);
@@ -0,0 +1,36 @@
+#pragma once
+#include <apex/autodiff_cache.hxx>
+
+BEGIN_APEX_NAMESPACE
+
+class thread_pool_t;
+
+// One formula of a batch. The name is carried through for the caller's
+// error reports; it doesn't affect the tape.
+struct autodiff_formula_t {
+  std::string name;
+  std::string formula;
+  std::vector<autodiff_var_t> vars;
+};
+
+// The outcome for one formula. On success autodiff holds the tape and error
+// is empty. On failure autodiff is null and error holds the message that
+// make_autodiff would have thrown. Syntax errors are also returned in
+// diagnostics, all of them, and are collected without throwing.
+struct autodiff_build_t {
+  autodiff_ptr_t autodiff;
+  std::string error;
+  std::vector<diagnostic_t> diagnostics;
+
+  explicit operator bool() const { return (bool)autodiff; }
+};
+
+// Parse and build the tape of every formula on the pool's threads. Results
+// are returned in the order of formulas. An error in one formula doesn't
+// stop the others. Formulas with the same text and the same inputs are
+// built once and share a tape.
+std::vector<autodiff_build_t> build_autodiffs(thread_pool_t& pool,
+  const std::vector<autodiff_formula_t>& formulas,
+  autodiff_mode_t mode = autodiff_mode_reverse, int order = 1);
+
+END_APEX_NAMESPACE
@@ -0,0 +1,50 @@
+#pragma once
+#include <apex/autodiff.hxx>
+
+BEGIN_APEX_NAMESPACE
+
+// Tapes are immutable once built, so one tape can be shared by every caller
+// that asks for the same formula.
+typedef std::shared_ptr<const autodiff_t> autodiff_ptr_t;
+
+// Counters for the process-wide tape cache.
+struct autodiff_cache_stats_t {
+  // Lookups satisfied from memory, lookups satisfied by loading a tape from
+  // the cache directory, and lookups that had to build the tape.
+  int64_t hits = 0;
+  int64_t disk_hits = 0;
+  int64_t misses = 0;
+
+  // Tapes written to the cache directory.
+  int64_t disk_writes = 0;
+
+  // Tapes held in memory.
+  size_t entries = 0;
+};
+
+// Return the tape for formula, building it on the first request. Tapes are
+// keyed by the formula text, the name and dimension of each input, the mode
+// and the order, and are kept for the life of the process. This is safe to
+// call from multiple threads. Errors in the formula are thrown, and nothing
+// is cached for them.
+autodiff_ptr_t make_cached_autodiff(const std::string& formula,
+  const std::vector<autodiff_var_t>& vars,
+  autodiff_mode_t mode = autodiff_mode_reverse, int order = 1);
+
+// When a cache directory is set, tapes missing from memory are looked for
+// there before being built, and newly built tapes are written there, so
+// separate processes, like the compiles of separate translation units,
+// share the work. The directory defaults to the APEX_AUTODIFF_CACHE_DIR
+// environment variable. An empty string turns the disk cache off. Files
+// that can't be read or were written by another version of libapex are
+// ignored and rebuilt.
+void set_autodiff_cache_dir(const std::string& dir);
+std::string autodiff_cache_dir();
+
+autodiff_cache_stats_t autodiff_cache_stats();
+
+// Drop the tapes held in memory and reset the counters. Tapes still
+// referenced by callers stay alive. The cache directory is untouched.
+void clear_autodiff_cache();
+
+END_APEX_NAMESPACE
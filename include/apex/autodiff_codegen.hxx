@@ -1,4 +1,4 @@
-#include <apex/autodiff.hxx>
+#include <apex/autodiff_cache.hxx>
 #include <array>
 #include <cmath>
 
@@ -11,9 +11,45 @@ inline double sq(double x) {
   return x * x;
 }
 
+// Primary inputs are double scalars, or double vectors held in arrays.
+template<typename type_t>
+struct autodiff_member_t {
+  enum { valid = false, dim = 0 };
+};
+
+template<>
+struct autodiff_member_t<double> {
+  enum { valid = true, dim = 0 };
+};
+
+template<size_t N>
+struct autodiff_member_t<double[N]> {
+  enum { valid = true, dim = N };
+};
+
+template<size_t N>
+struct autodiff_member_t<std::array<double, N> > {
+  enum { valid = true, dim = N };
+};
+
+// The components of a vector tape item are a contiguous slice of
+// tape_values, starting at offsets[index]. Element-wise expressions are
+// emitted once, inside a runtime loop over the slice: they load component k,
+// the loop index in the caller's scope. Scalars are broadcast across
+// components and don't read k, so scalar-only expressions need no loop.
 @macro auto autodiff_expr(const ad_t* ad) {
   @meta+ if(const auto* tape = ad->as<ad_tape_t>()) {
-    @emit return tape_values[tape->index];
+    if(autodiff.tape[tape->index].dim)
+      @emit return tape_values[offsets[tape->index] + k];
+    else
+      @emit return tape_values[offsets[tape->index]];
+
+  } else if(const auto* component = ad->as<ad_component_t>()) {
+    @emit return tape_values[offsets[component->index] + 
+      component->component];
+
+  } else if(const auto* tangent = ad->as<ad_tangent_t>()) {
+    @emit return tangent_values[tangent->index];
 
   } else if(const auto* literal = ad->as<ad_literal_t>()) {
     @emit return literal->x;
@@ -21,14 +57,14 @@ inline double sq(double x) {
   } else if(const auto* unary = ad->as<ad_unary_t>()) {
     @emit return @op(
       unary->op, 
-      autodiff_expr(unary->a.get())
+      autodiff_expr(unary->a)
     );
 
   } else if(const auto* binary = ad->as<ad_binary_t>()) {
     @emit return @op(
       binary->op, 
-      autodiff_expr(binary->a.get()), 
-      autodiff_expr(binary->b.get())
+      autodiff_expr(binary->a), 
+      autodiff_expr(binary->b)
     );
 
   } else if(const auto* func = ad->as<ad_func_t>()) {
@@ -50,35 +86,75 @@ inline double sq(double x) {
     // That feature will eliminate the need to switch over the
     // argument counts.
     // @emit return @expression(func->f)(
-    //   autodiff_expr(func->args[__integer_pack(func->args.size())].get())...
+    //   autodiff_expr(func->args[__integer_pack(func->args.size())])...
     // );
 
     if(1 == func->args.size()) {
-      @emit return @expression(func->f)(autodiff_expr(func->args[0].get()));
+      @emit return @expression(func->f)(autodiff_expr(func->args[0]));
 
     } else if(2 == func->args.size()) {
-      @emit return @expression(func->f)(autodiff_expr(func->args[0].get()),
-        autodiff_expr(func->args[1].get()));
+      @emit return @expression(func->f)(autodiff_expr(func->args[0]),
+        autodiff_expr(func->args[1]));
     }
   }
 }
 
-@macro void autodiff_tape(int index, int parent) {
-  @meta if(index < num_vars) {
-    // We've hit a terminal, which corresponds to an independent variable.
-    // Increment the gradient array by the coefficient at parent.
-    @member_ref(grad, index) += coef[parent];
+// Reverse-mode lowering. Visit each tape item once, from the root down to
+// the independent variables, and push its adjoint through each partial 
+// derivative into the adjoints of its children. Because tape items are 
+// topologically sorted (children always precede parents), every adjoint is 
+// complete by the time its item is visited. Each DAG edge is emitted exactly
+// once, so the generated code is linear in the size of the tape, even when 
+// subexpressions are shared by many parents. Edges into or out of vector
+// items are emitted as one statement in a runtime loop over the components,
+// so the code doesn't grow with the dimension.
+@macro void autodiff_sweep() {
+  @meta for(int i = (int)count - 1; i >= (int)num_vars; --i) {
+    @meta int dim_p = autodiff.tape[i].dim;
+    @meta for(const auto& g : autodiff.tape[i].grads) {
+      @meta int dim_c = autodiff.tape[g.index].dim;
+      @meta if(-1 != g.component) {
+        // A component access only feeds that component. Its coefficient is
+        // the literal 1, which doesn't read k.
+        adjoints[offsets[g.index] + g.component] += 
+          adjoints[offsets[i]] * autodiff_expr(g.coef);
 
-  } else {
-    // We're in a subexpression. Evaluate each of the child nodes.
-    @meta for(const auto& g : autodiff.tape[index].grads) {
-      // Evaluate the coefficient into the stack.
-      coef[index] = coef[parent] * autodiff_expr(g.coef.get());
-      @macro autodiff_tape(g.index, index);
+      } else if(autodiff.tape[i].reduce) {
+        // Each component of a reduction's operand gets the scalar adjoint.
+        for(int k = 0; k < dim_c; ++k)
+          adjoints[offsets[g.index] + k] += 
+            adjoints[offsets[i]] * autodiff_expr(g.coef);
+
+      } else if(dim_p || dim_c) {
+        // Scalar operands of element-wise operations are broadcast, so they
+        // accumulate the adjoints of every component.
+        @meta int dim = std::max(dim_p, dim_c);
+        for(int k = 0; k < dim; ++k)
+          adjoints[offsets[g.index] + (dim_c ? k : 0)] += 
+            adjoints[offsets[i] + (dim_p ? k : 0)] * 
+            autodiff_expr(g.coef);
+
+      } else {
+        adjoints[offsets[g.index]] += 
+          adjoints[offsets[i]] * autodiff_expr(g.coef);
+      }
     }
   }
 }
 
+// Forward-mode lowering. Seed the tangent of one independent variable with 1
+// and the others with 0, then evaluate the tangent of each tape item in 
+// order, alongside its value. The root's tangent is the partial derivative
+// with respect to the seeded variable. This takes one pass per independent 
+// variable, but doesn't need adjoint storage or a second sweep.
+@macro void autodiff_tangents(int seed) {
+  @meta for(int i = 0; i < (int)num_vars; ++i)
+    tangent_values[i] = i == seed ? 1 : 0;
+
+  @meta for(int i = (int)num_vars; i < (int)count; ++i)
+    tangent_values[i] = autodiff_expr(autodiff.tape[i].tangent);
+}
+
 template<typename type_t>
 @meta type_t autodiff_grad(@meta const char* formula, type_t input) {
 
@@ -86,56 +162,109 @@ template<typename type_t>
   static_assert(std::is_class<type_t>::value, 
     "argument to autodiff_eval must be a class object");
 
-  // Collect the name of each primary input.
+  // Collect the name and dimension of each primary input.
   @meta std::vector<autodiff_var_t> vars;
   @meta size_t num_vars = @member_count(type_t);
+  @meta int num_inputs = 0;
 
-  // Copy the values of the independent variables into the tape.
-  double tape_values[num_vars];
   @meta for(int i = 0; i < num_vars; ++i) {
-    // Confirm that we have a scalar double-precision term.
-    static_assert(std::is_same<@member_type(type_t, i), double>::value,
-      std::string("member ") + @member_name(type_t, i) + " must be type double");
+    // Confirm that we have a double-precision scalar or vector term.
+    @meta typedef autodiff_member_t<@member_type(type_t, i)> member_t;
+    static_assert(member_t::valid, std::string("member ") + 
+      @member_name(type_t, i) + " must be type double or an array of double");
 
     // Push the primary input name.
     @meta vars.push_back({
       @member_name(type_t, i),
-      0
+      member_t::dim
     });
-
-    // Set the primary input's value.
-    tape_values[i] = @member_ref(input, i);
+    @meta num_inputs += std::max(1, (int)member_t::dim);
   }
 
+  // Choose forward or reverse mode. The formula has a single output, so 
+  // forward mode is only chosen for functions of one scalar variable.
+  @meta apex::autodiff_mode_t mode = (1 == num_vars && !vars[0].dim) ?
+    apex::select_autodiff_mode(num_inputs, 1) : apex::autodiff_mode_reverse;
+
   // Construct the tape. This makes a foreign function call into libapex.so.
-  @meta apex::autodiff_t autodiff = apex::make_autodiff(formula, vars);
+  // Tapes are cached by formula and inputs, so instantiations that repeat a
+  // formula share its tape, and with a cache directory, so do other 
+  // translation units and later builds.
+  @meta apex::autodiff_ptr_t autodiff_ptr = 
+    apex::make_cached_autodiff(formula, vars, mode);
+  @meta const apex::autodiff_t& autodiff = *autodiff_ptr;
   @meta size_t count = autodiff.tape.size();
 
+  // Lay out the components of each tape item.
+  @meta std::vector<int> offsets(count);
+  @meta int num_components = 0;
+  @meta for(size_t i = 0; i < count; ++i) {
+    @meta offsets[i] = num_components;
+    @meta num_components += std::max(1, autodiff.tape[i].dim);
+  }
+
+  // Copy the values of the independent variables into the tape.
+  double tape_values[num_components];
+  @meta for(int i = 0; i < num_vars; ++i) {
+    @meta if(int dim = vars[i].dim) {
+      for(int k = 0; k < dim; ++k)
+        tape_values[offsets[i] + k] = @member_ref(input, i)[k];
+
+    } else {
+      tape_values[offsets[i]] = @member_ref(input, i);
+    }
+  }
+
   // Compute the values for the whole tape. This is the forward-mode pass. 
   // It propagates values from the terminals (independent variables) through
   // the subexpressions and up to the root of the function.
 
-  // Evaluate the subexpressions.
-  @meta for(size_t i = num_vars; i < count; ++i)
-    tape_values[i] = autodiff_expr(autodiff.tape[i].val.get());
-
-  // Evaluate the gradients. This is a top-down reverse-mode traversal of 
-  // the autodiff DAG. The partial derivatives are parsed along edges, starting
-  // from the root and towards each terminal. When a terminal is visited, the
-  // corresponding component of the gradient is incremented by the product of
-  // all the partial derivatives from the root of the DAG down to that 
-  // terminal.
-  double coef[num_vars];
+  // Evaluate the subexpressions. Vector items loop over their components,
+  // and reductions sum their value over the components of their operand.
+  @meta for(size_t i = num_vars; i < count; ++i) {
+    @meta if(int reduce = autodiff.tape[i].reduce) {
+      tape_values[offsets[i]] = 0;
+      for(int k = 0; k < reduce; ++k)
+        tape_values[offsets[i]] += autodiff_expr(autodiff.tape[i].val);
+
+    } else if(int dim = autodiff.tape[i].dim) {
+      for(int k = 0; k < dim; ++k)
+        tape_values[offsets[i] + k] = autodiff_expr(autodiff.tape[i].val);
+
+    } else {
+      tape_values[offsets[i]] = autodiff_expr(autodiff.tape[i].val);
+    }
+  }
+
   type_t grad { };
+  @meta if(apex::autodiff_mode_forward == mode) {
+    // Evaluate one tangent pass for each independent variable.
+    double tangent_values[count];
+    @meta for(int seed = 0; seed < num_vars; ++seed) {
+      @macro autodiff_tangents(seed);
+      @member_ref(grad, seed) = tangent_values[count - 1];
+    }
+
+  } else {
+    // Evaluate the gradients. This is a top-down reverse-mode traversal of 
+    // the autodiff DAG. The root is seeded with an adjoint of 1, and each 
+    // tape item, visited in reverse order, increments the adjoints of its
+    // children by its own adjoint times the partial derivative along that
+    // edge. When the sweep completes, the adjoints of the independent 
+    // variables hold the gradient.
+    double adjoints[num_components] { };
+    adjoints[offsets[count - 1]] = 1;
+    @macro autodiff_sweep();
 
-  // Visit each child of the root node.
-  @meta int root = count - 1;
-  @meta for(const auto& g : autodiff.tape[root].grads) {
-    // Evaluate the coefficient into the stack.
-    coef[root] = autodiff_expr(g.coef.get());
+    @meta for(int i = 0; i < num_vars; ++i) {
+      @meta if(int dim = vars[i].dim) {
+        for(int k = 0; k < dim; ++k)
+          @member_ref(grad, i)[k] = adjoints[offsets[i] + k];
 
-    // Recurse on the child.
-    @macro autodiff_tape(g.index, root);
+      } else {
+        @member_ref(grad, i) = adjoints[offsets[i]];
+      }
+    }
   }
 
   return std::move(grad);
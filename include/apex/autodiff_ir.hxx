@@ -0,0 +1,88 @@
+#pragma once
+#include <apex/autodiff.hxx>
+
+BEGIN_APEX_NAMESPACE
+
+// A flat encoding of a tape. The ad_t DAG becomes a structure of arrays with
+// one entry per distinct node reached from the tape: an opcode and two
+// 32-bit operands. Every node follows its operands, so a single forward scan
+// visits operands before the nodes that use them, and a per-node property
+// is an array indexed by node id rather than a hash table keyed by pointer.
+// Tape items refer to nodes by id. The IR holds no pointers, so it can be
+// copied, cached and written out as it is.
+//
+// autodiff_t keeps the ad_t nodes, which Circle codegen introspects.
+// make_autodiff_ir flattens them, and make_autodiff rebuilds them from an IR.
+struct autodiff_ir_t {
+  enum op_t : uint8_t {
+    op_tape,          // tape item a
+    op_tangent,       // tangent of tape item a
+    op_component,     // component b of vector tape item a
+    op_literal,       // literals[a]
+    op_neg,           // -a
+    op_add,           // a + b
+    op_sub,           // a - b
+    op_mul,           // a * b
+    op_div,           // a / b
+    op_sq,            // f(a)
+    op_sqrt,
+    op_exp,
+    op_log,
+    op_sin,
+    op_cos,
+    op_tan,
+    op_sinh,
+    op_cosh,
+    op_tanh,
+    op_abs,
+    op_pow,           // pow(a, b)
+  };
+
+  // Node i is ops[i] applied to a[i] and b[i]. Operands that aren't used
+  // are -1.
+  std::vector<op_t> ops;
+  std::vector<int32_t> a;
+  std::vector<int32_t> b;
+  std::vector<double> literals;
+
+  int size() const { return ops.size(); }
+
+  // Items mirror autodiff_t::item_t. The grads of item i are
+  // grads[grad_offsets[i], grad_offsets[i + 1]). Absent nodes are -1.
+  struct item_t {
+    int dim;
+    int val;
+    int reduce;
+    int tangent;
+  };
+  struct grad_t {
+    int index;
+    int coef;
+    int component;
+  };
+  std::vector<item_t> items;
+  std::vector<int> grad_offsets;
+  std::vector<grad_t> grads;
+
+  std::vector<autodiff_var_t> vars;
+  autodiff_mode_t mode = autodiff_mode_reverse;
+  int root = -1;
+  int order = 1;
+  std::vector<int> grad_items;
+
+  autodiff_stats_t stats;
+};
+
+// The function name that ad_func_t uses for a function opcode, or null.
+const char* autodiff_ir_func_name(autodiff_ir_t::op_t op);
+
+autodiff_ir_t make_autodiff_ir(const autodiff_t& autodiff);
+
+// Rebuild the ad_t nodes of an IR. The IR is trusted: operands must precede
+// their users, and tape indices must be in range.
+autodiff_t make_autodiff(const autodiff_ir_t& ir);
+
+// One line per node, in order.
+std::string print_autodiff_ir(const autodiff_ir_t& ir);
+
+END_APEX_NAMESPACE
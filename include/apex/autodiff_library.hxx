@@ -0,0 +1,60 @@
+#pragma once
+#include <apex/autodiff_program.hxx>
+#include <string_view>
+
+BEGIN_APEX_NAMESPACE
+
+// A library is a file of named programs, compiled ahead of time. Each
+// program is stored as the flat arrays of autodiff_program_t: instructions,
+// literals and slot indices, aligned so they can be used in place. Opening
+// a library maps the file and checks it once, and every program is then
+// evaluated straight from the mapping, without parsing or copying.
+//
+// The format is versioned. Libraries are only readable on machines with the
+// byte order of the machine that wrote them.
+
+// Encode programs[i] under names[i]. Names must be unique.
+std::string save_autodiff_library(const std::vector<std::string>& names,
+  const std::vector<autodiff_program_t>& programs);
+
+class autodiff_library_t {
+public:
+  autodiff_library_t() { }
+
+  // View a library already in memory. data must be 8-byte aligned and must
+  // outlive the library.
+  autodiff_library_t(const void* data, size_t size);
+
+  // Map a library file. Throws ad_exeption_t if the file can't be read or
+  // isn't a valid library.
+  static autodiff_library_t open(const std::string& path);
+
+  autodiff_library_t(const autodiff_library_t&) = delete;
+  autodiff_library_t& operator=(const autodiff_library_t&) = delete;
+  autodiff_library_t(autodiff_library_t&& rhs);
+  autodiff_library_t& operator=(autodiff_library_t&& rhs);
+  ~autodiff_library_t();
+
+  size_t size() const { return count; }
+  std::string_view name(size_t index) const;
+  autodiff_program_view_t program(size_t index) const;
+  std::vector<autodiff_var_t> vars(size_t index) const;
+
+  // The index of the program called name, or -1. Names are sorted, so this
+  // is a binary search.
+  int find(std::string_view name) const;
+
+private:
+  void validate();
+  void unmap();
+
+  const char* data = nullptr;
+  size_t bytes = 0;
+  size_t count = 0;
+
+  // Set when the library owns a mapping of its file.
+  void* mapping = nullptr;
+  size_t mapping_size = 0;
+};
+
+END_APEX_NAMESPACE
@@ -0,0 +1,180 @@
+#pragma once
+#include <apex/autodiff.hxx>
+
+BEGIN_APEX_NAMESPACE
+
+// Counters collected while building a program.
+struct autodiff_program_stats_t {
+  // Items on the tape the program was built from.
+  int tape_length = 0;
+
+  // Instructions whose results were never read, and were removed.
+  int dead_instrs = 0;
+
+  // Slots before register allocation, when every value and adjoint has its 
+  // own slot, and after, when slots are reused once their value is dead.
+  int virtual_slots = 0;
+  int peak_slots = 0;
+};
+
+// A flat bytecode encoding of an autodiff tape. This evaluates formulas that
+// are only known at runtime, without Circle. Each instruction reads and writes
+// slots in a register file of num_slots doubles. The first num_inputs slots
+// hold the inputs, with vector inputs flattened into one slot per component.
+// Each value is computed once, so the shared subexpressions of the ad_t DAG 
+// are evaluated only once. Slots are recycled once the value they hold is
+// dead, so the register file is usually much shorter than the tape.
+struct autodiff_program_t {
+  enum op_t : uint8_t {
+    op_literal,       // r[dest] = literals[a]
+    op_neg,           // r[dest] = -r[a]
+    op_add,           // r[dest] = r[a] + r[b]
+    op_sub,           // r[dest] = r[a] - r[b]
+    op_mul,           // r[dest] = r[a] * r[b]
+    op_div,           // r[dest] = r[a] / r[b]
+    op_accum,         // r[dest] += r[a] * r[b]
+    op_sq,
+    op_sqrt,
+    op_exp,
+    op_log,
+    op_sin,
+    op_cos,
+    op_tan,
+    op_sinh,
+    op_cosh,
+    op_tanh,
+    op_abs,
+    op_pow,
+
+    // Sine and cosine, or hyperbolic sine and cosine, of the same argument
+    // share their argument reduction. These write two slots:
+    // r[dest] = sin(r[a]) and r[b] = cos(r[a]).
+    op_sincos,
+    op_sinhcosh,
+  };
+
+  struct instr_t {
+    op_t op;
+    int dest, a, b;
+  };
+
+  std::vector<autodiff_var_t> vars;
+  autodiff_mode_t mode = autodiff_mode_reverse;
+  std::vector<instr_t> instrs;
+  std::vector<double> literals;
+  int num_slots = 0;
+  int num_inputs = 0;
+
+  // Instructions [0, num_forward) compute the value. The rest compute the
+  // gradient, with the reverse sweep or with one tangent pass per input.
+  int num_forward = 0;
+
+  // The slot holding the formula's value, and the slot holding the partial
+  // derivative of each input.
+  int value_slot = -1;
+  std::vector<int> grad_slots;
+
+  // Hessian-vector product programs read a direction of num_inputs values 
+  // starting at direction_slot, and write H * direction to hvp_slots.
+  int direction_slot = -1;
+  std::vector<int> hvp_slots;
+
+  // Hessian programs compute the structurally nonzero entries of the lower
+  // triangle of the Hessian. Entry i is H[hessian_rows[i]][hessian_cols[i]]
+  // and is held in hessian_slots[i]. The upper triangle follows by symmetry.
+  std::vector<int> hessian_rows;
+  std::vector<int> hessian_cols;
+  std::vector<int> hessian_slots;
+
+  // The number of tangent passes the Hessian program makes. Inputs that 
+  // never appear together in a row of the Hessian share a pass.
+  int num_colors = 0;
+
+  autodiff_program_stats_t stats;
+};
+
+// The arrays of a program, without owning them. Every evaluator takes a
+// view, and programs convert to one implicitly. Programs loaded from a
+// library file (see autodiff_library.hxx) are views straight into the
+// mapped file.
+struct autodiff_program_view_t {
+  autodiff_program_view_t() { }
+  autodiff_program_view_t(const autodiff_program_t& program);
+
+  autodiff_mode_t mode = autodiff_mode_reverse;
+  const autodiff_program_t::instr_t* instrs = nullptr;
+  int num_instrs = 0;
+  const double* literals = nullptr;
+  int num_literals = 0;
+  int num_slots = 0;
+  int num_inputs = 0;
+  int num_forward = 0;
+  int value_slot = -1;
+  const int* grad_slots = nullptr;
+
+  // Null unless this is a Hessian-vector product program.
+  int direction_slot = -1;
+  const int* hvp_slots = nullptr;
+
+  int num_hessian = 0;
+  const int* hessian_rows = nullptr;
+  const int* hessian_cols = nullptr;
+  const int* hessian_slots = nullptr;
+  int num_colors = 0;
+};
+
+autodiff_program_t make_autodiff_program(const autodiff_t& autodiff);
+
+// Second-order programs. These need a tape built with order 2.
+autodiff_program_t make_hvp_program(const autodiff_t& autodiff);
+autodiff_program_t make_hessian_program(const autodiff_t& autodiff);
+
+// Programs are lowered from the flat IR of autodiff_ir.hxx. These skip
+// flattening for callers that already hold the IR.
+struct autodiff_ir_t;
+autodiff_program_t make_autodiff_program(const autodiff_ir_t& ir);
+autodiff_program_t make_hvp_program(const autodiff_ir_t& ir);
+autodiff_program_t make_hessian_program(const autodiff_ir_t& ir);
+
+// Evaluate the value and fill grad with num_inputs partial derivatives. The
+// caller provides a scratch register file of num_slots doubles, so
+// evaluation never allocates. grad may be null to skip the derivatives.
+double autodiff_eval(const autodiff_program_view_t& program, 
+  const double* inputs, double* grad, double* scratch);
+
+// Evaluate the value, the gradient and the product of the Hessian with 
+// direction, which has num_inputs values.
+double autodiff_eval_hvp(const autodiff_program_view_t& program, 
+  const double* inputs, const double* direction, double* grad, double* hvp,
+  double* scratch);
+
+// Evaluate the value, the gradient and the num_hessian entries of the sparse
+// lower triangle of the Hessian.
+double autodiff_eval_hessian(const autodiff_program_view_t& program,
+  const double* inputs, double* grad, double* hessian, double* scratch);
+
+// Evaluate count points at once. Inputs and outputs are structures of arrays:
+// inputs[i] and grads[i] point to count values for input i. grads may be null
+// to skip the derivatives. Each instruction runs across a block of lanes
+// with the widest vector ISA the CPU supports. The caller provides scratch of
+// autodiff_batch_scratch_size(program) doubles, so evaluation never
+// allocates.
+void autodiff_eval_batch(const autodiff_program_view_t& program, 
+  size_t count, const double* const* inputs, double* values, 
+  double* const* grads, double* scratch);
+
+size_t autodiff_batch_scratch_size(const autodiff_program_view_t& program);
+
+class thread_pool_t;
+
+// Batch evaluation split across the threads of pool. Each thread takes one
+// contiguous chunk of points, aligned to the batch block size, and works
+// from its own thread-local scratch, so no shared state is written during
+// evaluation. Results go straight into the caller's output arrays.
+void autodiff_eval_parallel(thread_pool_t& pool,
+  const autodiff_program_view_t& program, size_t count,
+  const double* const* inputs, double* values, double* const* grads);
+
+std::string print_autodiff_program(const autodiff_program_t& program);
+
+END_APEX_NAMESPACE
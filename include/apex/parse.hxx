@@ -65,13 +65,13 @@ struct node_t {
     kind_subscript,
     kind_member,
     kind_braced,
+    kind_error,
   };
 
   kind_t kind;
   source_loc_t loc;
 
   node_t(kind_t kind, source_loc_t loc) : kind(kind), loc(loc) { }
-  virtual ~node_t() { }
 
   template<typename derived_t>
   derived_t* as() {
@@ -87,16 +87,36 @@ struct node_t {
       nullptr;
   }
 };
-typedef std::unique_ptr<node_t> node_ptr_t;
+// Parse nodes are allocated from the arena in parse_t, which owns them.
+typedef node_t* node_ptr_t;
 typedef std::vector<node_ptr_t> node_list_t;
 
 struct parse_t {
   tok::tokenizer_t tokenizer;
-  node_ptr_t root;
+
+  // Holds every node in the parse tree. The tree is released all at once
+  // when the parse_t is destroyed.
+  arena_t arena;
+  node_ptr_t root = nullptr;
+
+  // Every lexer and parser error, in source order. The tree is still built,
+  // with node_error_t standing in for what couldn't be parsed.
+  std::vector<diagnostic_t> diagnostics;
+
+  bool ok() const { return diagnostics.empty(); }
 };
 
+// Doesn't throw on malformed input. Check diagnostics.
 parse_t parse_expression(const char* str);
 
+// Parse the caller's buffer in place, without copying it. The buffer must
+// outlive the parse_t.
+parse_t parse_expression(const char* begin, const char* end);
+
+// Parse the tokens already in parse.tokenizer, such as those streamed into
+// it with append and finish.
+void parse_tokens(parse_t& parse);
+
 ////////////////////////////////////////////////////////////////////////////////
 
 struct node_ident_t : node_t {
@@ -201,6 +221,12 @@ struct node_braced_t : node_t {
   std::vector<node_ptr_t> args;
 };
 
+// Covers the tokens skipped while recovering from a syntax error.
+struct node_error_t : node_t {
+  node_error_t(source_loc_t loc) : node_t(kind_error, loc) { }
+  static bool classof(const node_t* p) { return kind_error == p->kind; }
+};
+
 } // namespace parse
 
 
@@ -0,0 +1,49 @@
+#pragma once
+#include <apex/util.hxx>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+BEGIN_APEX_NAMESPACE
+
+// A fixed set of worker threads for data-parallel loops. The thread that
+// calls parallel_for participates, so a pool of size n starts n - 1 workers.
+class thread_pool_t {
+public:
+  // 0 threads selects std::thread::hardware_concurrency().
+  explicit thread_pool_t(int num_threads = 0);
+  ~thread_pool_t();
+
+  thread_pool_t(const thread_pool_t&) = delete;
+  thread_pool_t& operator=(const thread_pool_t&) = delete;
+
+  int size() const { return num_threads; }
+
+  // Call func(index) for each index in [0, count) and wait for all calls to
+  // finish. Indices are claimed dynamically by the pool's threads. If any
+  // call throws, the first exception is rethrown here.
+  void parallel_for(int count, const std::function<void(int)>& func);
+
+private:
+  void worker_loop();
+  void run_job();
+
+  int num_threads;
+  std::vector<std::thread> workers;
+
+  std::mutex mutex;
+  std::condition_variable start_cv, done_cv;
+  bool stop = false;
+
+  // The current job. generation advances when a new job is posted.
+  const std::function<void(int)>* job = nullptr;
+  int job_count = 0;
+  uint64_t generation = 0;
+  int num_running = 0;
+  std::atomic<int> next_index { 0 };
+  std::exception_ptr error;
+};
+
+END_APEX_NAMESPACE
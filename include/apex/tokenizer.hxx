@@ -1,5 +1,6 @@
 #pragma once
 #include <apex/tokens.hxx>
+#include <string_view>
 
 BEGIN_APEX_NAMESPACE
 
@@ -75,6 +76,53 @@ result_t<attr_t> make_result(const char* begin, const char* end,
 // operators.cxx. Match the longest operator.
 result_t<tk_kind_t> match_operator(range_t range);
 
+// Character classes for the scanning fast paths. Bytes 0x80 and up are
+// cc_ucs, as they begin or continue a multibyte character.
+enum char_class_t : uint8_t {
+  cc_space = 1,       // space, \t, \n, \v, \f, \r
+  cc_alpha = 2,       // a-zA-Z and _
+  cc_digit = 4,       // 0-9
+  cc_ucs = 8,
+};
+
+struct char_class_table_t {
+  constexpr char_class_table_t() : classes() {
+    for(int c = 0; c < 256; ++c) {
+      uint8_t x = 0;
+      if(' ' == c || ('\t' <= c && c <= '\r')) x |= cc_space;
+      if(('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || '_' == c)
+        x |= cc_alpha;
+      if('0' <= c && c <= '9') x |= cc_digit;
+      if(c >= 0x80) x |= cc_ucs;
+      classes[c] = x;
+    }
+  }
+  uint8_t classes[256];
+};
+inline constexpr char_class_table_t char_classes { };
+
+inline bool is_char_class(char c, int classes) {
+  return 0 != (classes & char_classes.classes[(uint8_t)c]);
+}
+
+// lexer.cxx. Return the end of the run of whitespace, of identifier
+// characters (a-zA-Z_0-9) or of digits that starts at p. These scan 16 bytes
+// at a time where SSE2 is available.
+const char* scan_space(const char* p, const char* end);
+const char* scan_ident(const char* p, const char* end);
+const char* scan_digits(const char* p, const char* end);
+
+// A numeric or character literal. size is the length of its spelling,
+// which the token doesn't hold.
+struct literal_t {
+  union {
+    uint64_t i;
+    double f;
+    char32_t c;
+  };
+  int size;
+};
+
 struct tokenizer_t;
 
 struct lexer_t {
@@ -108,44 +156,143 @@ struct lexer_t {
   result_t<token_t> operator_(range_t range);
   result_t<token_t> token(range_t range);
 
+  // In partial mode the input continues past range.end, so a block comment
+  // that doesn't close by then is left unskipped rather than reported.
   const char* skip_comment(range_t range);
   bool advance_skip(range_t& range);
 
+  // Record a diagnostic at pos. The caller recovers and lexing continues.
+  void error(const char* pos, diag_code_t code, const char* msg);
 
-  void throw_error(const char* pos, const char* msg);
+  // Make a token at begin. make_literal adds the literal to the pool first.
+  token_t make_token(tk_kind_t kind, int store, const char* begin);
+  token_t make_literal(tk_kind_t kind, literal_t literal, const char* begin,
+    const char* end);
 
   tokenizer_t& tokenizer;
+
+  // The start of the tokenizer's source. Token offsets count from here.
+  const char* base = nullptr;
+  bool partial = false;
 };
 
 struct tokenizer_t {
-  std::vector<std::string> strings;
-  std::vector<uint64_t> ints;
-  std::vector<double> floats;
+  // Identifiers are interned as byte ranges of text, so each distinct
+  // spelling is stored once and tokenizing doesn't allocate a string per
+  // identifier. string_index hashes the spellings.
+  struct string_ref_t {
+    int offset, size;
+  };
+  std::vector<string_ref_t> strings;
+  hash_index_t string_index;
+
+  // Numeric and character literals, in the order lexed.
+  std::vector<literal_t> literals;
+
+  // Byte offset for each line start. Only diagnostics need line numbers,
+  // so lines are indexed on demand, and only through the furthest offset
+  // queried so far: text before lines_end has been searched for newlines.
+  mutable std::vector<int> line_offsets;
+  mutable int lines_end = 0;
+
+  // Columns counted so far, sorted by offset. A column query counts from the
+  // closest checkpoint on its line rather than from the line start, and
+  // leaves checkpoints at its own offset and every col_checkpoint_interval
+  // bytes it passes. The caches make the const queries unsafe to call
+  // concurrently on one tokenizer.
+  struct col_checkpoint_t {
+    int offset, col;
+  };
+  enum { col_checkpoint_interval = 4096 };
+  mutable std::vector<col_checkpoint_t> col_checkpoints;
+
+  // Original text we tokenized, when the tokenizer holds a copy of it.
+  std::string text;
 
-  // Byte offset for each line start.
-  std::vector<int> line_offsets;
+  // The caller's buffer passed to tokenize(begin, end), which must outlive
+  // the tokenizer. Null when tokenizing text.
+  std::string_view buffer;
 
-  // Original text we tokenized.
-  std::string text;
+  // The bytes being tokenized. Tokens and interned strings hold offsets into
+  // it, so they stay valid when the tokenizer is moved or text grows.
+  // Offsets are ints, which limits sources to 2GB.
+  std::string_view source() const {
+    return buffer.data() ? buffer : std::string_view(text);
+  }
+
+  // Offset in text where the next append resumes lexing.
+  int stream_end = 0;
 
   // The text divided into tokens.
   std::vector<token_t> tokens;
 
+  // Lexical errors, in the order found. Characters that start no token are
+  // reported and skipped.
+  std::vector<diagnostic_t> diagnostics;
+
   parse::range_t token_range() const;
 
   int reg_string(range_t range);
   int find_string(range_t range) const;
+  std::string_view string(int id) const {
+    return std::string_view(source().data() + strings[id].offset,
+      strings[id].size);
+  }
+
+  // Token accessors.
+  int token_size(token_t token) const;
+  std::string_view spelling(token_t token) const {
+    return std::string_view(source().data() + token.offset,
+      token_size(token));
+  }
+  std::string_view ident(token_t token) const { return string(token.store); }
+  uint64_t int_value(token_t token) const {
+    return literals[token.store].i;
+  }
+  double float_value(token_t token) const {
+    return literals[token.store].f;
+  }
+  char32_t char_value(token_t token) const {
+    return literals[token.store].c;
+  }
 
   // Return 0-indexed line and column offsets for the token at
-  // the specified byte offset. This performs UCS decoding to support
-  // multibyte characters.
+  // the specified byte offset. Columns count UTF-8 characters, not bytes.
   int token_offset(source_loc_t loc) const;
   int token_line(int offset) const;
   int token_col(int offset, int line) const;
   std::pair<int, int> token_linecol(int offset) const;
   std::pair<int, int> token_linecol(source_loc_t loc) const;
  
+  // Extend line_offsets through the line holding offset.
+  void index_lines(int offset) const;
+
+  // Tokenize text. Both tokenize calls start a new source: they reset the
+  // tokenizer first, so it can be reused.
   void tokenize();
+
+  // Tokenize a caller-owned buffer, such as a mapped file, without copying
+  // it.
+  void tokenize(const char* begin, const char* end);
+
+  // Tokenize input as it arrives. append adds a chunk to text and lexes
+  // through its last newline; only block comments span newlines, and one
+  // still open is held back until it closes. finish lexes the rest. tokens
+  // is complete after finish, but the tokens before stream_end may be read
+  // in between. A stream continues the text source, including one lexed by
+  // tokenize(), and can't follow tokenize(begin, end). To stream a new
+  // source, clear text and call reset() first.
+  void append(const char* data, size_t size);
+  void finish();
+
+  // Lex [begin, end) of source and return where lexing stopped. That's end
+  // unless partial is set and a block comment is still open.
+  const char* lex(const char* begin, const char* end, bool partial);
+
+  // Clear everything derived from the source: tokens, interned strings,
+  // literals, diagnostics, the caller's buffer, the stream position and the
+  // line and column caches. text is kept.
+  void reset();
 };
 
 } // namespace tok
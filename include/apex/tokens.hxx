@@ -69,13 +69,21 @@ enum tk_kind_t : uint8_t {
   tk_sym_tilde,
 };
 
+// Tokens are 8 bytes, so a token stream costs a third of what a pair of
+// pointers would. offset locates the token in the tokenizer's source. For
+// tk_ident and the literal kinds, store indexes the tokenizer's strings or
+// literal pool, which also keep the spelling's length; for everything else
+// it is the length. tokenizer_t's accessors recover spellings and values.
+enum { max_token_store = 1<< 24 };
+
 struct token_t {
   tk_kind_t kind : 8;
-  int store : 24;
-  const char* begin, *end;
+  unsigned store : 24;
+  int offset;
 
   operator tk_kind_t() const { return kind; }
 };
+static_assert(8 == sizeof(token_t), "token_t must be 8 bytes");
 typedef const token_t* token_it;
 
 // Index of the token within the token stream.
@@ -83,4 +91,36 @@ struct source_loc_t {
   int index;
 };
 
+enum diag_code_t : uint8_t {
+  diag_none = 0,
+
+  // Lexer.
+  diag_bad_char,              // a character that starts no token
+  diag_unterminated_comment,
+  diag_bad_char_literal,
+  diag_bad_number,            // unexpected character in a numeric literal
+  diag_int_overflow,
+  diag_bad_exponent,
+  diag_limit,                 // a source too big for the token encoding
+
+  // Parser.
+  diag_unclosed,              // an opening bracket with no closer
+  diag_expected_expression,
+  diag_expected_subscript,
+  diag_expected_colon,
+  diag_unexpected_token,
+  diag_bad_constant,          // an illegal constant folding operation
+};
+
+// Errors in the source are recorded as diagnostics rather than thrown, and
+// the lexer and parser recover and carry on, so one pass reports every
+// error. line and col are 0-indexed, with columns counting UTF-8
+// characters.
+struct diagnostic_t {
+  diag_code_t code;
+  int offset;
+  int line, col;
+  std::string msg;
+};
+
 END_APEX_NAMESPACE
@@ -4,6 +4,13 @@
 #include <vector>
 #include <cassert>
 #include <string>
+#include <stdexcept>
+#include <optional>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <new>
+#include <type_traits>
 
 #define BEGIN_APEX_NAMESPACE namespace apex {
 #define END_APEX_NAMESPACE }
@@ -72,5 +79,147 @@ public:
 
 struct unused_t { };
 
+////////////////////////////////////////////////////////////////////////////////
+// Bump allocator for node trees. Objects are carved out of large blocks and
+// released all at once when the arena is destroyed. Objects with non-trivial
+// destructors are recorded at construction and destroyed in reverse order by
+// a flat loop, so tearing down a deeply nested tree never recurses.
+
+class arena_t {
+public:
+  arena_t() { }
+  arena_t(const arena_t&) = delete;
+  arena_t& operator=(const arena_t&) = delete;
+  arena_t(arena_t&& rhs);
+  arena_t& operator=(arena_t&& rhs);
+  ~arena_t() { release(); }
+
+  template<typename type_t, typename... args_t>
+  type_t* make(args_t&&... args) {
+    void* p = allocate(sizeof(type_t), alignof(type_t));
+    type_t* object = new(p) type_t(std::forward<args_t>(args)...);
+    if(!std::is_trivially_destructible<type_t>::value) {
+      dtors.push_back({ 
+        object, 
+        [](void* p) { static_cast<type_t*>(p)->~type_t(); }
+      });
+    }
+    ++num_objects;
+    return object;
+  }
+
+  void* allocate(size_t size, size_t align);
+
+  // Destroy all objects and free all blocks.
+  void release();
+
+  // The number of objects constructed and blocks allocated from the heap.
+  size_t object_count() const { return num_objects; }
+  size_t block_count() const { return blocks.size(); }
+
+private:
+  struct dtor_t {
+    void* object;
+    void(*destroy)(void*);
+  };
+
+  std::vector<std::unique_ptr<char[]>> blocks;
+  std::vector<dtor_t> dtors;
+  char* cur = nullptr;
+  char* end = nullptr;
+  size_t next_block_size = 4096;
+  size_t num_objects = 0;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Flat open-addressing hash table that maps keys to int indices. The keys
+// themselves live in the caller's storage--the table only holds the hash and
+// index of each entry, and the caller provides an equality predicate that 
+// compares its probe key against a stored index.
+
+inline uint64_t hash_mix(uint64_t x) {
+  // splitmix64 finalizer.
+  x ^= x>> 30;
+  x *= 0xbf58476d1ce4e5b9ull;
+  x ^= x>> 27;
+  x *= 0x94d049bb133111ebull;
+  x ^= x>> 31;
+  return x;
+}
+
+inline uint64_t hash_combine(uint64_t seed, uint64_t x) {
+  return hash_mix(seed + 0x9e3779b97f4a7c15ull + x);
+}
+
+// Hash a byte string a word at a time.
+inline uint64_t hash_bytes(const char* p, size_t size) {
+  uint64_t hash = hash_mix(size);
+  for(; size >= 8; p += 8, size -= 8) {
+    uint64_t x;
+    memcpy(&x, p, 8);
+    hash = hash_combine(hash, x);
+  }
+  if(size) {
+    uint64_t x = 0;
+    memcpy(&x, p, size);
+    hash = hash_combine(hash, x);
+  }
+  return hash;
+}
+
+class hash_index_t {
+public:
+  // Return the index of the entry matching hash and eq, or -1.
+  template<typename eq_t>
+  int find(uint64_t hash, eq_t eq) const {
+    if(!slots.size()) return -1;
+    size_t mask = slots.size() - 1;
+    for(size_t i = hash & mask; ; i = (i + 1) & mask) {
+      const slot_t& slot = slots[i];
+      if(-1 == slot.index)
+        return -1;
+      if(hash == slot.hash && eq(slot.index))
+        return slot.index;
+    }
+  }
+
+  // Insert an entry. The caller is responsible for not inserting duplicates.
+  void insert(uint64_t hash, int index) {
+    // Keep the load factor under 1/2 so probe sequences stay short.
+    if(2 * (count + 1) > slots.size())
+      grow();
+    place(hash, index);
+    ++count;
+  }
+
+  size_t size() const { return count; }
+
+private:
+  struct slot_t {
+    uint64_t hash;
+    int index;
+  };
+
+  void place(uint64_t hash, int index) {
+    size_t mask = slots.size() - 1;
+    size_t i = hash & mask;
+    while(-1 != slots[i].index)
+      i = (i + 1) & mask;
+    slots[i] = slot_t { hash, index };
+  }
+
+  void grow() {
+    std::vector<slot_t> old(std::max<size_t>(16, 2 * slots.size()), 
+      slot_t { 0, -1 });
+    old.swap(slots);
+    for(const slot_t& slot : old)
+      if(-1 != slot.index)
+        place(slot.hash, slot.index);
+  }
+
+  std::vector<slot_t> slots;
+  size_t count = 0;
+};
+
 
 END_APEX_NAMESPACE
@@ -1,8 +1,9 @@
 #include <apex/autodiff.hxx>
 #include <sstream>
 #include <cstdarg>
-#include <map>
+#include <cstring>
 #include <algorithm>
+#include <cmath>
 
 BEGIN_APEX_NAMESPACE
 
@@ -14,6 +15,7 @@ struct ad_builder_t : autodiff_t {
   typedef autodiff_t::item_t::grad_t grad_t;
   
   int literal_node(double x);
+  int identity(int a);
 
   // Operators
   int add(int a, int b);
@@ -36,17 +38,39 @@ struct ad_builder_t : autodiff_t {
   int abs(int a);
   int pow(int a, int b);
   int norm(const int* p, int count);
+
+  // Reductions and component access on vectors.
+  int sum(int a);
+  int dot(int a, int b);
+  int component(int a, int i);
   
+  // Build the tangent expression of each tape item for forward mode.
+  void make_tangents();
+
+  // Push the gradient onto the tape for second-order derivatives.
+  void make_gradient();
+  int lift(ad_ptr_t ad);
+  int scale(int adjoint, ad_ptr_t coef);
+
   ad_ptr_t val(int index);
+  ad_ptr_t tangent(int index);
+  ad_ptr_t bind(ad_ptr_t value);
   ad_ptr_t literal(double x);
+  ad_ptr_t neg(ad_ptr_t a);
   ad_ptr_t add(ad_ptr_t a, ad_ptr_t b);
   ad_ptr_t sub(ad_ptr_t a, ad_ptr_t b);
   ad_ptr_t mul(ad_ptr_t a, ad_ptr_t b);
   ad_ptr_t div(ad_ptr_t a, ad_ptr_t b);
   ad_ptr_t rcp(ad_ptr_t a);
   ad_ptr_t sq(ad_ptr_t a);
+  ad_ptr_t pown(ad_ptr_t a, double n);
   ad_ptr_t func(const char* name, ad_ptr_t a, ad_ptr_t b = nullptr);
 
+  // Simplification helpers. as_literal returns the literal a tape item 
+  // holds, and operand returns the first operand of a tape item made by op.
+  const ad_literal_t* as_literal(int a) const;
+  int operand(int a, int op) const;
+
   std::string str(const parse::node_t* node);
 
   int recurse(const parse::node_ident_t* node);
@@ -59,25 +83,17 @@ struct ad_builder_t : autodiff_t {
 
   void throw_error(const parse::node_t* node, const char* fmt, ...);
 
-  int push_item(item_t item) {
-    int count = tape.size();
-    tape.push_back(std::move(item));
-    return count;
-  }
-
   int find_var(const parse::node_t* node, std::string name);
+  void check_dims(const parse::node_t* node, int a, int b);
 
   // If the tokenizer is provided we can print error messages that are
   // line/col specific.
   const tok::tokenizer_t* tokenizer = nullptr;
 
-  // Store each literal value once. This doesn't effect the computation 
-  // directly, but is helpful for subexpression elimination.
-  std::map<double, int> literal_map;
-
   enum op_name_t {
     op_name_tape,
     op_name_literal,
+    op_name_identity,
     op_name_add,
     op_name_sub,
     op_name_mul,
@@ -95,45 +111,105 @@ struct ad_builder_t : autodiff_t {
     op_name_tanh,
     op_name_abs,
     op_name_pow,
+    op_name_norm,
+    op_name_sum,
+    op_name_component,
   };
 
-  union op_key_t {
-    struct {
-      op_name_t name : 8;
-      uint a         : 28;
-      uint b         : 28; 
-    };
-    uint64_t bits;
+  // The operation and operands that produced a tape item. Operands are tape
+  // indices, or the bits of the value for literals, and are stored in 
+  // cse_operands[begin, begin + count).
+  struct cse_key_t {
+    op_name_t op;
+    int begin = 0, count = 0;
+    uint64_t hash = 0;
   };
 
-  std::optional<int> find_cse(op_name_t op_name, int a, int b = -1);
-  std::optional<int> find_literal(double x);
-
-  // Map each operation to the location in the tape where its value is stored.
-  // We only build this structure during the upsweep when computing the tape
-  // values. We won't necessarily match common subexpressions in partial 
-  // derivatives, because we don't want to memoize all those fragments as it
-  // will consume more storage than we're prepared to give.
-  std::map<uint64_t, int> cse_map;
+  cse_key_t make_key(op_name_t op, int a, int b = -1);
+  cse_key_t make_key(op_name_t op, const uint64_t* args, int count);
+  std::optional<int> find_cse(const cse_key_t& key);
+  int push_item(item_t item, const cse_key_t& key);
+
+  // Hash-cons every tape item on its operation and operands, so that each
+  // distinct subexpression is evaluated once. cse_keys holds the key for 
+  // each tape item (independent variables have op_name_tape keys), and 
+  // cse_index maps keys to tape indices.
+  std::vector<cse_key_t> cse_keys;
+  std::vector<uint64_t> cse_operands;
+  hash_index_t cse_index;
+
+  // Intern every ad_t node on its kind, payload and operand nodes. Operands
+  // are interned before their parents, so comparing them by address compares
+  // entire subtrees.
+  struct ad_key_t {
+    ad_t::kind_t kind;
+    const char* op = nullptr;   // Operator or function name.
+    double x = 0;               // Literal value.
+    int index = 0;              // Tape index.
+    ad_ptr_t a = nullptr;       // Operands.
+    ad_ptr_t b = nullptr;
+    int component = 0;          // Vector component.
+  };
+  ad_ptr_t intern(const ad_key_t& key);
+  std::optional<int> find_value(const ad_t* node) const;
+
+  // Indexes autodiff_t::nodes.
+  hash_index_t ad_index;
+
+  // value_nodes holds the value node of each tape item, and value_index maps
+  // those nodes back to tape indices. Expressions that recompute a tape 
+  // value are replaced by a reference to the tape.
+  std::vector<const ad_t*> value_nodes;
+  hash_index_t value_index;
+
+  // ad_t nodes that have been lifted onto the tape as items of their own.
+  std::vector<const ad_t*> lift_nodes;
+  std::vector<int> lift_items;
+  hash_index_t lift_index;
 };
 
 
 ////////////////////////////////////////////////////////////////////////////////
-// TODO: Register each tape insertion with the common subexpression elimination
-// (CSE) map, so that find_cse will work.
 
 int ad_builder_t::literal_node(double x) {
+  uint64_t bits;
+  memcpy(&bits, &x, sizeof(double));
+  cse_key_t key = make_key(op_name_literal, &bits, 1);
+  if(auto cse = find_cse(key))
+    return *cse;
+
   item_t item { };
-  item.val = literal(x);
-  return push_item(std::move(item));
+  item.val = bind(literal(x));
+  return push_item(std::move(item), key);
+}
+
+int ad_builder_t::identity(int a) {
+  cse_key_t key = make_key(op_name_identity, a);
+  if(auto cse = find_cse(key))
+    return *cse;
+
+  item_t item { };
+  item.val = bind(val(a));
+  item.grads.push_back({
+    a,
+    literal(1)
+  });
+  return push_item(std::move(item), key);
 }
 
 int ad_builder_t::add(int a, int b) {
-  if(auto cse = find_cse(op_name_add, a, b))
+  auto* la = as_literal(a);
+  auto* lb = as_literal(b);
+  if(la && lb) return literal_node(la->x + lb->x);
+  if(la && 0 == la->x) return b;
+  if(lb && 0 == lb->x) return a;
+
+  cse_key_t key = make_key(op_name_add, a, b);
+  if(auto cse = find_cse(key))
     return *cse;
 
   item_t item { };
-  item.val = add(val(a), val(b));
+  item.val = bind(add(val(a), val(b)));
   item.grads.push_back({
     a,
     literal(1)
@@ -142,19 +218,26 @@ int ad_builder_t::add(int a, int b) {
     b,
     literal(1)
   });
-  return push_item(std::move(item));
+  return push_item(std::move(item), key);
 }
 
 int ad_builder_t::sub(int a, int b) {
-  // Nip this in the bud.
-  if(a == b)
+  // Nip this in the bud. Vector differences keep their dimension.
+  if(a == b && !tape[a].dim)
     return literal_node(0);
+
+  auto* la = as_literal(a);
+  auto* lb = as_literal(b);
+  if(la && lb) return literal_node(la->x - lb->x);
+  if(lb && 0 == lb->x) return a;
+  if(la && 0 == la->x) return negate(b);
   
-  if(auto cse = find_cse(op_name_sub, a, b))
+  cse_key_t key = make_key(op_name_sub, a, b);
+  if(auto cse = find_cse(key))
     return *cse;
 
   item_t item { };
-  item.val = sub(val(a), val(b));
+  item.val = bind(sub(val(a), val(b)));
   item.grads.push_back({
     a,
     literal(1)
@@ -163,20 +246,32 @@ int ad_builder_t::sub(int a, int b) {
     b,
     literal(-1)
   });
-  return push_item(std::move(item));
+  return push_item(std::move(item), key);
 }
 
 int ad_builder_t::mul(int a, int b) {
-  if(auto cse = find_cse(op_name_mul, a, b))
-    return *cse;
-
   // The sq operator is memoized, so prefer that.
   if(a == b)
     return sq(a);
 
+  // Multiplying a vector by zero still gives a vector.
+  auto* la = as_literal(a);
+  auto* lb = as_literal(b);
+  if(la && lb) return literal_node(la->x * lb->x);
+  if(la && 1 == la->x) return b;
+  if(lb && 1 == lb->x) return a;
+  if(la && -1 == la->x) return negate(b);
+  if(lb && -1 == lb->x) return negate(a);
+  if(la && 0 == la->x && !tape[b].dim) return a;
+  if(lb && 0 == lb->x && !tape[a].dim) return b;
+
+  cse_key_t key = make_key(op_name_mul, a, b);
+  if(auto cse = find_cse(key))
+    return *cse;
+
   // grad (a * b) = a grad b + b grad a.
   item_t item { };
-  item.val = mul(val(a), val(b));
+  item.val = bind(mul(val(a), val(b)));
   item.grads.push_back({
     b,      // a * grad b
     val(a)
@@ -185,159 +280,280 @@ int ad_builder_t::mul(int a, int b) {
     a,      // b * grad a
     val(b)
   });
-  return push_item(std::move(item));
+  return push_item(std::move(item), key);
 }
 
 int ad_builder_t::div(int a, int b) {
-  if(auto cse = find_cse(op_name_div, a, b))
+  // Divide by a literal by multiplying with its reciprocal.
+  auto* la = as_literal(a);
+  auto* lb = as_literal(b);
+  if(la && lb) return literal_node(la->x / lb->x);
+  if(lb) return mul(a, literal_node(1 / lb->x));
+
+  cse_key_t key = make_key(op_name_div, a, b);
+  if(auto cse = find_cse(key))
     return *cse;
 
   // grad (a / b) = 1 / b * grad a - a / b^2 * grad b.
+  int index = tape.size();
   item_t item { };
-  item.val = div(val(a), val(b));
+  item.val = bind(div(val(a), val(b)));
   item.grads.push_back({
     // 1 / b * grad a.
     a,
     rcp(val(b)) 
   });
   item.grads.push_back({
-    // a / b^2 * grad b.
+    // -a / b^2 * grad b. a / b is already on the tape.
     b,
-    div(val(a), sq(val(b)))
+    neg(div(val(index), val(b)))
   });
-  return push_item(std::move(item));
+  return push_item(std::move(item), key);
 }
 
 int ad_builder_t::negate(int a) {
-  
+  if(auto* la = as_literal(a)) return literal_node(-la->x);
+  int x = operand(a, op_name_negate);
+  if(-1 != x) return x;
+
+  cse_key_t key = make_key(op_name_negate, a);
+  if(auto cse = find_cse(key))
+    return *cse;
+
   item_t item { };
-  item.val = mul(literal(-1), val(a));
+  item.val = bind(neg(val(a)));
   item.grads.push_back({
     a,
     literal(-1)
   });
-  return push_item(std::move(item));
+  return push_item(std::move(item), key);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 // Elementary functions
 
 int ad_builder_t::sq(int a) {
+  if(auto* la = as_literal(a)) return literal_node(la->x * la->x);
+  int x = operand(a, op_name_sqrt);
+  if(-1 != x) return x;
+
+  cse_key_t key = make_key(op_name_sq, a);
+  if(auto cse = find_cse(key))
+    return *cse;
+
   item_t item { };
-  item.val = sq(val(a));
+  item.val = bind(sq(val(a)));
   item.grads.push_back({
     // grad (a^2) = 2 * a grad a
     a,
     mul(literal(2), val(a))
   });
-  return push_item(std::move(item));
+  return push_item(std::move(item), key);
 }
 
 int ad_builder_t::sqrt(int a) {
+  if(auto* la = as_literal(a)) return literal_node(std::sqrt(la->x));
+  int x = operand(a, op_name_sq);
+  if(-1 != x) return abs(x);
+
+  cse_key_t key = make_key(op_name_sqrt, a);
+  if(auto cse = find_cse(key))
+    return *cse;
+
   item_t item { };
-  item.val = func("std::sqrt", val(a));
+  item.val = bind(func("std::sqrt", val(a)));
   item.grads.push_back({
     // .5 / sqrt(a) * grad a
     a,
     div(literal(.5), func("std::sqrt", val(a)))
   });
-  return push_item(std::move(item));
+  return push_item(std::move(item), key);
 }
 
 int ad_builder_t::exp(int a) {
+  if(auto* la = as_literal(a)) return literal_node(std::exp(la->x));
+  int x = operand(a, op_name_log);
+  if(-1 != x) return x;
+
+  cse_key_t key = make_key(op_name_exp, a);
+  if(auto cse = find_cse(key))
+    return *cse;
+
   item_t item { };
-  item.val = func("std::exp", val(a));
+  item.val = bind(func("std::exp", val(a)));
   item.grads.push_back({
     // exp(a) * grad a
     a,
     func("std::exp", val(a))
   });
-  return push_item(std::move(item));
+  return push_item(std::move(item), key);
 }
 
 int ad_builder_t::log(int a) {
+  if(auto* la = as_literal(a)) return literal_node(std::log(la->x));
+  int x = operand(a, op_name_exp);
+  if(-1 != x) return x;
+
+  cse_key_t key = make_key(op_name_log, a);
+  if(auto cse = find_cse(key))
+    return *cse;
+
   // grad (ln a) = grad a / a
   item_t item { };
-  item.val = func("std::log", val(a));
+  item.val = bind(func("std::log", val(a)));
   item.grads.push_back({
     a,
     rcp(val(a))
   });
-  return push_item(std::move(item));
+  return push_item(std::move(item), key);
 }
 
 int ad_builder_t::sin(int a) {
+  if(auto* la = as_literal(a)) return literal_node(std::sin(la->x));
+
+  cse_key_t key = make_key(op_name_sin, a);
+  if(auto cse = find_cse(key))
+    return *cse;
+
   item_t item { };
-  item.val = func("std::sin", val(a));
+  item.val = bind(func("std::sin", val(a)));
   item.grads.push_back({
     a,
     func("std::cos", val(a))
   });
-  return push_item(std::move(item));
+  return push_item(std::move(item), key);
 }
 
 int ad_builder_t::cos(int a) {
+  if(auto* la = as_literal(a)) return literal_node(std::cos(la->x));
+
+  cse_key_t key = make_key(op_name_cos, a);
+  if(auto cse = find_cse(key))
+    return *cse;
+
   item_t item { };
-  item.val = func("std::cos", val(a));
+  item.val = bind(func("std::cos", val(a)));
   item.grads.push_back({
     a,
-    mul(literal(-1), func("std::sin", val(a)))
+    neg(func("std::sin", val(a)))
   });
-  return push_item(std::move(item));
+  return push_item(std::move(item), key);
 }
 
 int ad_builder_t::tan(int a) {
+  if(auto* la = as_literal(a)) return literal_node(std::tan(la->x));
+
+  cse_key_t key = make_key(op_name_tan, a);
+  if(auto cse = find_cse(key))
+    return *cse;
+
   item_t item { };
-  item.val = func("std::tan", val(a));
+  // grad (tan a) = (1 + tan^2 a) grad a. This reuses the value, rather than
+  // calling cos.
+  item.val = bind(func("std::tan", val(a)));
   item.grads.push_back({
     a,
-    sq(rcp(func("std::cos", val(a))))
+    add(literal(1), sq(func("std::tan", val(a))))
   });
-  return push_item(std::move(item));
+  return push_item(std::move(item), key);
 }
 
 int ad_builder_t::sinh(int a) {
+  if(auto* la = as_literal(a)) return literal_node(std::sinh(la->x));
+
+  cse_key_t key = make_key(op_name_sinh, a);
+  if(auto cse = find_cse(key))
+    return *cse;
+
   item_t item { };
-  item.val = func("std::sinh", val(a));
+  item.val = bind(func("std::sinh", val(a)));
   item.grads.push_back({
     a,
     func("std::cosh", val(a))
   });
-  return push_item(std::move(item));
+  return push_item(std::move(item), key);
 }
 
 int ad_builder_t::cosh(int a) {
+  if(auto* la = as_literal(a)) return literal_node(std::cosh(la->x));
+
+  cse_key_t key = make_key(op_name_cosh, a);
+  if(auto cse = find_cse(key))
+    return *cse;
+
   item_t item { };
-  item.val = func("std::cosh", val(a));
+  item.val = bind(func("std::cosh", val(a)));
   item.grads.push_back({
     a,
     func("std::sinh", val(a))
   });
-  return push_item(std::move(item));
+  return push_item(std::move(item), key);
 }
 
 int ad_builder_t::tanh(int a) {
+  if(auto* la = as_literal(a)) return literal_node(std::tanh(la->x));
+
+  cse_key_t key = make_key(op_name_tanh, a);
+  if(auto cse = find_cse(key))
+    return *cse;
+
   item_t item { };
-  item.val = func("std::tanh", val(a));
+  item.val = bind(func("std::tanh", val(a)));
   item.grads.push_back({
     a,
     sub(literal(1), sq(func("std::tanh", val(a))))
   });
-  return push_item(std::move(item));
+  return push_item(std::move(item), key);
 }
 
 int ad_builder_t::abs(int a) {
+  if(auto* la = as_literal(a)) return literal_node(std::abs(la->x));
+
+  cse_key_t key = make_key(op_name_abs, a);
+  if(auto cse = find_cse(key))
+    return *cse;
+
   item_t item { };
-  item.val = func("std::abs", val(a));
+  item.val = bind(func("std::abs", val(a)));
   item.grads.push_back({
     a,    // d/dx abs(x) = x / abs(x)
     div(val(a), func("std::abs", val(a)))
   });
+  return push_item(std::move(item), key);
 }
 
 int ad_builder_t::pow(int a, int b) {
+  auto* la = as_literal(a);
+  auto* lb = as_literal(b);
+  if(la && lb) return literal_node(std::pow(la->x, lb->x));
+
+  // Specialize the common exponents.
+  if(lb) {
+    double n = lb->x;
+    if(0 == n) return literal_node(1);
+    if(1 == n) return a;
+    if(2 == n) return sq(a);
+    if(.5 == n) return sqrt(a);
+    if(-1 == n) return div(literal_node(1), a);
+  }
+
+  cse_key_t key = make_key(op_name_pow, a, b);
+  if(auto cse = find_cse(key))
+    return *cse;
+
   item_t item { };
-  item.val = func("std::pow", val(a), val(b));
+  item.val = bind(func("std::pow", val(a), val(b)));
+  if(lb) {
+    // A literal exponent has no gradient edge, so skip the log, which is
+    // NaN for negative bases. func lowers small integer and half-integer
+    // powers to multiplies and a sqrt.
+    item.grads.push_back({
+      a,
+      mul(val(b), func("std::pow", val(a), literal(lb->x - 1)))
+    });
+    return push_item(std::move(item), key);
+  }
+
   item.grads.push_back({
     // d/dx (a**b) = b a**(b - 1) da/dx
     a,
@@ -348,19 +564,37 @@ int ad_builder_t::pow(int a, int b) {
     b,
     mul(func("std::pow", val(a), val(b)), func("std::log", val(a)))
   });
-  return push_item(std::move(item));
+  return push_item(std::move(item), key);
 }
 
 int ad_builder_t::norm(const int* p, int count) {
+  // norm is symmetric in its arguments, so sort the operands in the key.
+  // The norm of vectors is the sqrt of the sum of the squares of all their
+  // components.
+  if(std::any_of(p, p + count, [&](int a) { return tape[a].dim; })) {
+    int x = -1;
+    for(int i = 0; i < count; ++i) {
+      int y = tape[p[i]].dim ? sum(sq(p[i])) : sq(p[i]);
+      x = (-1 == x) ? y : add(x, y);
+    }
+    return sqrt(x);
+  }
+
+  std::vector<uint64_t> args(p, p + count);
+  std::sort(args.begin(), args.end());
+  cse_key_t key = make_key(op_name_norm, args.data(), count);
+  if(auto cse = find_cse(key))
+    return *cse;
+
   item_t item { };
 
   // Square and accumulate each argument.
   ad_ptr_t x = sq(val(p[0]));
   for(int i = 1; i < count; ++i)
-    x = add(std::move(x), sq(val(p[i])));
+    x = add(x, sq(val(p[i])));
 
   // Take its sqrt.
-  item.val = func("std::sqrt", std::move(x));
+  item.val = bind(func("std::sqrt", x));
 
   // Differentiate with respect to each argument.
   // The derivative is f_i * grad f_i / norm(f).
@@ -374,7 +608,60 @@ int ad_builder_t::norm(const int* p, int count) {
       div(val(p[i]), val(index))
     });
   }
-  return push_item(std::move(item));
+  return push_item(std::move(item), key);
+}
+
+int ad_builder_t::sum(int a) {
+  // The sum of a scalar is itself.
+  if(!tape[a].dim)
+    return a;
+
+  cse_key_t key = make_key(op_name_sum, a);
+  if(auto cse = find_cse(key))
+    return *cse;
+
+  // Each component of a contributes to the sum with a partial derivative 
+  // of 1.
+  item_t item { };
+  item.val = val(a);
+  item.reduce = tape[a].dim;
+  item.grads.push_back({
+    a,
+    literal(1)
+  });
+  return push_item(std::move(item), key);
+}
+
+int ad_builder_t::dot(int a, int b) {
+  return sum(mul(a, b));
+}
+
+int ad_builder_t::component(int a, int i) {
+  cse_key_t key = make_key(op_name_component, a, i);
+  if(auto cse = find_cse(key))
+    return *cse;
+
+  item_t item { };
+  item.val = bind(intern({ ad_t::kind_component, nullptr, 0, a, nullptr, 
+    nullptr, i }));
+  item.grads.push_back({
+    a,
+    literal(1),
+    i
+  });
+  return push_item(std::move(item), key);
+}
+
+const ad_literal_t* ad_builder_t::as_literal(int a) const {
+  // Independent variables have no value expression, and a vector of zeros
+  // isn't the same as a scalar zero.
+  ad_ptr_t val = tape[a].val;
+  return (val && !tape[a].dim) ? val->as<ad_literal_t>() : nullptr;
+}
+
+int ad_builder_t::operand(int a, int op) const {
+  const cse_key_t& key = cse_keys[a];
+  return op == key.op ? (int)cse_operands[key.begin] : -1;
 }
 
 std::string ad_builder_t::str(const node_t* node) {
@@ -384,15 +671,15 @@ std::string ad_builder_t::str(const node_t* node) {
 
     case node_t::kind_member: {
       const auto* member = static_cast<const node_member_t*>(node);
-      return str(member->lhs.get()) + "." + member->member;
+      return str(member->lhs) + "." + member->member;
     }
 
     case node_t::kind_subscript: {
       const auto* subscript = static_cast<const node_subscript_t*>(node);
       if(1 != subscript->args.size())
         throw_error(node, "subscript must have 1 index");
-      return str(subscript->lhs.get()) + 
-        "[" + str(subscript->args[0].get()) + "]";
+      return str(subscript->lhs) + 
+        "[" + str(subscript->args[0]) + "]";
     }
 
     case node_t::kind_number: {
@@ -405,11 +692,39 @@ std::string ad_builder_t::str(const node_t* node) {
   }
 }
 
+int ad_builder_t::recurse(const node_subscript_t* node) {
+  // The subscript may spell out the name of an independent variable.
+  std::string name = str(node);
+  auto p = [&](const auto& var) { return var.name == name; };
+  auto it = std::find_if(vars.begin(), vars.end(), p);
+  if(vars.end() != it)
+    return it - vars.begin();
+
+  // Otherwise it accesses a component of a vector.
+  auto* number = node->args[0]->as<node_number_t>();
+  if(!number || !number->x.is_integral())
+    throw_error(node->args[0], "subscript must be an integer literal");
+
+  int a = recurse(node->lhs);
+  int dim = tape[a].dim;
+  if(!dim)
+    throw_error(node, "cannot subscript a scalar");
+  if(number->x.i < 0 || number->x.i >= dim)
+    throw_error(node->args[0], "subscript %d is out of range for dimension %d",
+      (int)number->x.i, dim);
+
+  return component(a, number->x.i);
+}
+
 int ad_builder_t::recurse(const node_unary_t* node) {
-  int a = recurse(node->a.get());
+  int a = recurse(node->a);
   int c = -1;
   switch(node->op) {
-    case expr_op_negate:
+    case expr_op_plus:
+      c = a;
+      break;
+
+    case expr_op_minus:
       c = negate(a);
       break;
 
@@ -420,8 +735,9 @@ int ad_builder_t::recurse(const node_unary_t* node) {
 }
 
 int ad_builder_t::recurse(const node_binary_t* node) {
-  int a = recurse(node->a.get());
-  int b = recurse(node->b.get());
+  int a = recurse(node->a);
+  int b = recurse(node->b);
+  check_dims(node, a, b);
   int c = -1;
 
   switch(node->op) {
@@ -448,10 +764,10 @@ int ad_builder_t::recurse(const node_binary_t* node) {
 }
 
 int ad_builder_t::recurse(const node_call_t* node) {
-  std::string func_name = str(node->f.get());
+  std::string func_name = str(node->f);
   std::vector<int> args(node->args.size());
   for(int i = 0; i < node->args.size(); ++i)
-    args[i] = recurse(node->args[i].get());
+    args[i] = recurse(node->args[i]);
 
   #define GEN_CALL_1(s) \
     if(#s == func_name) { \
@@ -477,8 +793,20 @@ int ad_builder_t::recurse(const node_call_t* node) {
   if("pow" == func_name) {
     if(2 != node->args.size())
       throw_error(node, "pow() requires 2 arguments");
+    check_dims(node, args[0], args[1]);
     return pow(args[0], args[1]);
 
+  } else if("sum" == func_name) {
+    if(1 != node->args.size())
+      throw_error(node, "sum() requires 1 argument");
+    return sum(args[0]);
+
+  } else if("dot" == func_name) {
+    if(2 != node->args.size())
+      throw_error(node, "dot() requires 2 arguments");
+    check_dims(node, args[0], args[1]);
+    return dot(args[0], args[1]);
+
   } else if("norm" == func_name) {
     // Allow 1 or more arguments.
     if(!node->args.size())
@@ -501,12 +829,15 @@ int ad_builder_t::recurse(const node_t* node) {
 
     case node_t::kind_ident:
     case node_t::kind_member:
-    case node_t::kind_subscript:
       // Don't add a new tape item for independent variables--these get 
       // provisioned in order at the start.
       result = find_var(node, str(node));
       break;
 
+    case node_t::kind_subscript:
+      result = recurse(static_cast<const node_subscript_t*>(node));
+      break;
+
     case node_t::kind_unary:
       result = recurse(static_cast<const node_unary_t*>(node));
       break;
@@ -520,40 +851,277 @@ int ad_builder_t::recurse(const node_t* node) {
       break;
 
     default:
+      // Conditionals, assignments and the like have no tape lowering.
+      throw_error(node, "unsupported expression");
       break;
   }
   return result;
 }
 
+void ad_builder_t::make_tangents() {
+  for(const autodiff_var_t& var : vars) {
+    if(var.dim)
+      throw ad_exeption_t(format("forward mode does not support vector "
+        "input '%s'", var.name.c_str()));
+  }
+
+
+  // The tangent of an independent variable is its seed, which is chosen 
+  // when the tape is evaluated. Every other item's tangent is the chain rule
+  // applied to the tangents of its operands, using the same partial 
+  // derivatives as the reverse sweep.
+  for(int i = vars.size(); i < (int)tape.size(); ++i) {
+    ad_ptr_t t = nullptr;
+    for(const auto& g : tape[i].grads) {
+      ad_ptr_t term = mul(g.coef, tangent(g.index));
+      t = t ? add(t, term) : term;
+    }
+    tape[i].tangent = t ? t : literal(0);
+  }
+}
+
+static const struct {
+  const char* name;
+  int (ad_builder_t::*f)(int);
+} lift_funcs[] {
+  { "apex::sq",  &ad_builder_t::sq },
+  { "std::sqrt", &ad_builder_t::sqrt },
+  { "std::exp",  &ad_builder_t::exp },
+  { "std::log",  &ad_builder_t::log },
+  { "std::sin",  &ad_builder_t::sin },
+  { "std::cos",  &ad_builder_t::cos },
+  { "std::tan",  &ad_builder_t::tan },
+  { "std::sinh", &ad_builder_t::sinh },
+  { "std::cosh", &ad_builder_t::cosh },
+  { "std::tanh", &ad_builder_t::tanh },
+  { "std::abs",  &ad_builder_t::abs },
+};
+
+int ad_builder_t::lift(ad_ptr_t ad) {
+  // Rebuild a partial derivative expression out of tape items, so that it
+  // gets partial derivatives of its own. Nodes are shared, so memoize them.
+  if(auto* tape = ad->as<ad_tape_t>())
+    return tape->index;
+
+  auto eq = [&](int i) { return lift_nodes[i] == ad; };
+  int index = lift_index.find(hash_mix((uint64_t)ad), eq);
+  if(-1 != index)
+    return lift_items[index];
+
+  int result = -1;
+  if(auto* literal = ad->as<ad_literal_t>()) {
+    result = literal_node(literal->x);
+
+  } else if(auto* unary = ad->as<ad_unary_t>()) {
+    result = negate(lift(unary->a));
+
+  } else if(auto* binary = ad->as<ad_binary_t>()) {
+    int a = lift(binary->a);
+    int b = lift(binary->b);
+    switch(binary->op[0]) {
+      case '+': result = add(a, b); break;
+      case '-': result = sub(a, b); break;
+      case '*': result = mul(a, b); break;
+      case '/': result = div(a, b); break;
+    }
+
+  } else if(auto* func = ad->as<ad_func_t>()) {
+    if("std::pow" == func->f) {
+      result = pow(lift(func->args[0]), lift(func->args[1]));
+
+    } else {
+      for(const auto& f : lift_funcs) {
+        if(func->f == f.name) {
+          result = (this->*f.f)(lift(func->args[0]));
+          break;
+        }
+      }
+    }
+  }
+
+  if(-1 == result)
+    throw ad_exeption_t("cannot differentiate partial derivative expression");
+
+  lift_index.insert(hash_mix((uint64_t)ad), lift_nodes.size());
+  lift_nodes.push_back(ad);
+  lift_items.push_back(result);
+  return result;
+}
+
+int ad_builder_t::scale(int adjoint, ad_ptr_t coef) {
+  // Most edges carry a coefficient of 1 or -1. Don't push a product for
+  // those.
+  if(auto* literal = coef->as<ad_literal_t>()) {
+    if(1 == literal->x) return adjoint;
+    if(-1 == literal->x) return negate(adjoint);
+  }
+  if(adjoint == literal_node(1))
+    return lift(coef);
+  return mul(adjoint, lift(coef));
+}
+
+void ad_builder_t::make_gradient() {
+  for(const autodiff_var_t& var : vars) {
+    if(var.dim)
+      throw ad_exeption_t(format("second-order derivatives do not support "
+        "vector input '%s'", var.name.c_str()));
+  }
+
+  // The reverse sweep, with each adjoint pushed onto the tape. Adjoints of
+  // items that share an operand are summed with add items.
+  int num_vars = vars.size();
+  std::vector<int> adjoints(root + 1, -1);
+  adjoints[root] = literal_node(1);
+  for(int i = root; i >= num_vars; --i) {
+    if(-1 == adjoints[i])
+      continue;
+
+    // Pushing items reallocates the tape, so copy the edges out.
+    std::vector<grad_t> grads = tape[i].grads;
+    for(const grad_t& g : grads) {
+      int term = scale(adjoints[i], g.coef);
+      int& adjoint = adjoints[g.index];
+      adjoint = (-1 == adjoint) ? term : add(adjoint, term);
+    }
+  }
+
+  // Inputs the value doesn't depend on have a zero partial derivative.
+  grad_items.resize(num_vars);
+  for(int i = 0; i < num_vars; ++i)
+    grad_items[i] = (-1 == adjoints[i]) ? literal_node(0) : adjoints[i];
+}
+
+autodiff_mode_t select_autodiff_mode(int num_inputs, int num_outputs) {
+  return num_inputs <= num_outputs ? 
+    autodiff_mode_forward : 
+    autodiff_mode_reverse;
+}
+
 autodiff_t make_autodiff(const parse_t& parse, 
-  const std::vector<autodiff_var_t>& vars) {
+  const std::vector<autodiff_var_t>& vars, autodiff_mode_t mode, int order) {
+
+  if(1 != order && 2 != order)
+    throw ad_exeption_t(format("unsupported derivative order %d", order));
+
+  if(!parse.ok())
+    throw ad_exeption_t(format_diagnostics(parse));
 
   ad_builder_t ad_builder;
   ad_builder.tokenizer = &parse.tokenizer;
   ad_builder.vars = vars;
+  ad_builder.mode = mode;
   ad_builder.tape.resize(ad_builder.vars.size());
-  ad_builder.recurse(parse.root.get());
+  for(size_t i = 0; i < vars.size(); ++i)
+    ad_builder.tape[i].dim = vars[i].dim;
+  ad_builder.cse_keys.resize(ad_builder.vars.size(), 
+    ad_builder_t::cse_key_t { ad_builder_t::op_name_tape });
+  int root = ad_builder.recurse(parse.root);
+  if(ad_builder.tape[root].dim)
+    ad_builder.throw_error(parse.root, "formula must be scalar; reduce "
+      "vectors with sum() or dot()");
+
+  // The reverse sweep is seeded at the last tape item. If the formula is
+  // just an independent variable, add an identity item so the root is last.
+  if(root != (int)ad_builder.tape.size() - 1)
+    root = ad_builder.identity(root);
+  ad_builder.root = root;
+
+  // Second-order tapes differentiate the gradient items in forward mode, 
+  // so they always have tangents.
+  ad_builder.order = order;
+  if(2 == order)
+    ad_builder.make_gradient();
+
+  if(autodiff_mode_forward == mode || 2 == order)
+    ad_builder.make_tangents();
 
   return std::move(ad_builder);
 }
 
+std::string format_diagnostics(const parse_t& parse) {
+  std::string_view source = parse.tokenizer.source();
+  std::string msg = format("autodiff formula \"%.*s\"", (int)source.size(),
+    source.data());
+  for(const diagnostic_t& diag : parse.diagnostics)
+    msg += format("\nline %d col %d\n%s", diag.line + 1, diag.col + 1,
+      diag.msg.c_str());
+  return msg;
+}
+
 autodiff_t make_autodiff(const std::string& formula,
-  const std::vector<autodiff_var_t>& vars) {
+  const std::vector<autodiff_var_t>& vars, autodiff_mode_t mode, int order) {
 
-  auto p = parse::parse_expression(formula.c_str()); 
-  return make_autodiff(p, std::move(vars));
+  // formula outlives the parse, so it's parsed in place.
+  auto p = parse::parse_expression(formula.data(),
+    formula.data() + formula.size());
+  return make_autodiff(p, vars, mode, order);
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
 
 ad_ptr_t ad_builder_t::val(int index) {
-  // Return a value from the tape.
-  return std::make_unique<ad_tape_t>(index);
+  // Return a value from the tape. Literals are folded into the expressions
+  // that use them, so the simplifier can see them.
+  if(index < (int)tape.size()) {
+    if(auto* literal = as_literal(index))
+      return literal;
+  }
+  return intern({ ad_t::kind_tape, nullptr, 0, index });
+}
+
+ad_ptr_t ad_builder_t::tangent(int index) {
+  return intern({ ad_t::kind_tangent, nullptr, 0, index });
+}
+
+ad_ptr_t ad_builder_t::bind(ad_ptr_t value) {
+  // Record that the tape item about to be pushed computes value. Later 
+  // expressions that match it, including this item's own partial 
+  // derivatives, are replaced by a load from the tape.
+  if(!value->as<ad_tape_t>() && !value->as<ad_literal_t>()) {
+    int index = tape.size();
+    value_nodes.resize(index + 1);
+    value_nodes[index] = value;
+    value_index.insert(hash_mix((uint64_t)value), index);
+  }
+  return value;
+}
+
+std::optional<int> ad_builder_t::find_value(const ad_t* node) const {
+  auto eq = [&](int index) { return value_nodes[index] == node; };
+  int index = value_index.find(hash_mix((uint64_t)node), eq);
+  std::optional<int> result;
+  if(-1 != index) result = index;
+  return result;
 }
 
 ad_ptr_t ad_builder_t::literal(double x) {
-  return std::make_unique<ad_literal_t>(x);
+  return intern({ ad_t::kind_literal, nullptr, x });
+}
+
+// The ad_t constructors simplify as they build. These expressions are 
+// evaluated element-wise, so x - x and x * 0 are zero even for vectors.
+
+static bool is_literal(ad_ptr_t a, double x) {
+  auto* literal = a->as<ad_literal_t>();
+  return literal && x == literal->x;
+}
+
+static ad_ptr_t func_operand(ad_ptr_t a, const char* f) {
+  auto* func = a->as<ad_func_t>();
+  return (func && func->f == f) ? func->args[0] : nullptr;
+}
+
+ad_ptr_t ad_builder_t::neg(ad_ptr_t a) {
+  if(auto* a2 = a->as<ad_literal_t>())
+    return literal(-a2->x);
+
+  // -(-a) = a.
+  auto* unary = a->as<ad_unary_t>();
+  if(unary && !strcmp(unary->op, "-"))
+    return unary->a;
+
+  return intern({ ad_t::kind_unary, "-", 0, 0, a });
 }
 
 ad_ptr_t ad_builder_t::add(ad_ptr_t a, ad_ptr_t b) {
@@ -561,8 +1129,15 @@ ad_ptr_t ad_builder_t::add(ad_ptr_t a, ad_ptr_t b) {
   auto* b2 = b->as<ad_literal_t>();
   if(a2 && b2)
     return literal(a2->x + b2->x);
-  else 
-    return std::make_unique<ad_binary_t>("+", std::move(a), std::move(b));
+  if(is_literal(a, 0)) return b;
+  if(is_literal(b, 0)) return a;
+
+  // a + -b = a - b.
+  auto* unary = b->as<ad_unary_t>();
+  if(unary && !strcmp(unary->op, "-"))
+    return sub(a, unary->a);
+
+  return intern({ ad_t::kind_binary, "+", 0, 0, a, b });
 }
 
 ad_ptr_t ad_builder_t::sub(ad_ptr_t a, ad_ptr_t b) {
@@ -570,7 +1145,16 @@ ad_ptr_t ad_builder_t::sub(ad_ptr_t a, ad_ptr_t b) {
   auto* b2 = b->as<ad_literal_t>();
   if(a2 && b2)
     return literal(a2->x - b2->x);
-  return std::make_unique<ad_binary_t>("-", std::move(a), std::move(b));
+  if(a == b) return literal(0);
+  if(is_literal(b, 0)) return a;
+  if(is_literal(a, 0)) return neg(b);
+
+  // a - -b = a + b.
+  auto* unary = b->as<ad_unary_t>();
+  if(unary && !strcmp(unary->op, "-"))
+    return add(a, unary->a);
+
+  return intern({ ad_t::kind_binary, "-", 0, 0, a, b });
 }
 
 ad_ptr_t ad_builder_t::mul(ad_ptr_t a, ad_ptr_t b) {
@@ -578,7 +1162,13 @@ ad_ptr_t ad_builder_t::mul(ad_ptr_t a, ad_ptr_t b) {
   auto* b2 = b->as<ad_literal_t>();
   if(a2 && b2)
     return literal(a2->x * b2->x);
-  return std::make_unique<ad_binary_t>("*", std::move(a), std::move(b));
+  if(is_literal(a, 0) || is_literal(b, 0)) return literal(0);
+  if(is_literal(a, 1)) return b;
+  if(is_literal(b, 1)) return a;
+  if(is_literal(a, -1)) return neg(b);
+  if(is_literal(b, -1)) return neg(a);
+  if(a == b) return sq(a);
+  return intern({ ad_t::kind_binary, "*", 0, 0, a, b });
 }
 
 ad_ptr_t ad_builder_t::div(ad_ptr_t a, ad_ptr_t b) {
@@ -586,30 +1176,222 @@ ad_ptr_t ad_builder_t::div(ad_ptr_t a, ad_ptr_t b) {
   auto* b2 = b->as<ad_literal_t>();
   if(a2 && b2)
     return literal(a2->x / b2->x);
-  return std::make_unique<ad_binary_t>("/", std::move(a), std::move(b));
+  if(is_literal(a, 0)) return literal(0);
+
+  // Divide by a literal by multiplying with its reciprocal.
+  if(b2) return mul(a, literal(1 / b2->x));
+  return intern({ ad_t::kind_binary, "/", 0, 0, a, b });
 }
 
 ad_ptr_t ad_builder_t::rcp(ad_ptr_t a) {
   if(auto* a2 = a->as<ad_literal_t>())
     return literal(1 / a2->x);
   else
-    return div(literal(1), std::move(a));
+    return div(literal(1), a);
 }
 
 ad_ptr_t ad_builder_t::sq(ad_ptr_t a) {
   if(auto* a2 = a->as<ad_literal_t>())
     return literal(a2->x * a2->x);
   else
-    return func("apex::sq", std::move(a));
+    return func("apex::sq", a);
+}
+
+static bool is_small_power(double n) {
+  // Integers and half-integers up to 32.
+  return std::abs(n) <= 32 && 2 * n == (int)(2 * n);
 }
 
+ad_ptr_t ad_builder_t::pown(ad_ptr_t a, double n) {
+  // Negative powers are reciprocals, so -.5 is rsqrt and -1 is rcp.
+  if(n < 0)
+    return rcp(pown(a, -n));
+
+  // Half-integers take one sqrt.
+  int i = (int)n;
+  ad_ptr_t x = (n != i) ? func("std::sqrt", a) : nullptr;
+  if(!i)
+    return x ? x : literal(1);
+
+  // Square-and-multiply. The sq calls are memoized, so each power of two is
+  // only computed once.
+  for(ad_ptr_t p = a; i; i >>= 1) {
+    if(1 & i)
+      x = x ? mul(x, p) : p;
+    if(i > 1)
+      p = sq(p);
+  }
+  return x;
+}
+
+static const struct {
+  const char* name;
+  double (*f)(double);
+} fold_funcs[] {
+  { "std::sqrt", std::sqrt },
+  { "std::exp",  std::exp },
+  { "std::log",  std::log },
+  { "std::sin",  std::sin },
+  { "std::cos",  std::cos },
+  { "std::tan",  std::tan },
+  { "std::sinh", std::sinh },
+  { "std::cosh", std::cosh },
+  { "std::tanh", std::tanh },
+  { "std::abs",  std::abs },
+};
+
 ad_ptr_t ad_builder_t::func(const char* f, ad_ptr_t a, ad_ptr_t b) {
-  // TODO: Perform constant folding?
+  auto* a2 = a->as<ad_literal_t>();
+  auto* b2 = b ? b->as<ad_literal_t>() : nullptr;
+  if(!strcmp(f, "std::pow")) {
+    if(a2 && b2) 
+      return literal(std::pow(a2->x, b2->x));
+
+    // Small integer and half-integer powers become multiplication chains.
+    if(b2 && is_small_power(b2->x))
+      return pown(a, b2->x);
+
+  } else if(!strcmp(f, "apex::sq")) {
+    // sq(sqrt(x)) = x.
+    if(ad_ptr_t x = func_operand(a, "std::sqrt"))
+      return x;
+
+  } else if(a2) {
+    // Fold functions of literals.
+    for(const auto& fold : fold_funcs) {
+      if(!strcmp(f, fold.name))
+        return literal(fold.f(a2->x));
+    }
+
+  } else if(!strcmp(f, "std::exp")) {
+    // exp(log(x)) = x.
+    if(ad_ptr_t x = func_operand(a, "std::log"))
+      return x;
+
+  } else if(!strcmp(f, "std::log")) {
+    // log(exp(x)) = x.
+    if(ad_ptr_t x = func_operand(a, "std::exp"))
+      return x;
+  }
+
+  return intern({ ad_t::kind_func, f, 0, 0, a, b });
+}
+
+ad_ptr_t ad_builder_t::intern(const ad_key_t& key) {
+  uint64_t hash = hash_mix(key.kind);
+  switch(key.kind) {
+    case ad_t::kind_tape:
+    case ad_t::kind_tangent:
+      hash = hash_combine(hash, key.index);
+      break;
+
+    case ad_t::kind_component:
+      hash = hash_combine(hash, key.index);
+      hash = hash_combine(hash, key.component);
+      break;
+
+    case ad_t::kind_literal: {
+      uint64_t bits;
+      memcpy(&bits, &key.x, sizeof(double));
+      hash = hash_combine(hash, bits);
+      break;
+    }
+
+    default:
+      for(const char* p = key.op; *p; ++p)
+        hash = hash_combine(hash, *p);
+      hash = hash_combine(hash, (uint64_t)key.a);
+      hash = hash_combine(hash, (uint64_t)key.b);
+      break;
+  }
+
+  auto eq = [&](int id) {
+    const ad_t* node = nodes[id];
+    if(node->kind != key.kind)
+      return false;
+
+    if(auto* tape = node->as<ad_tape_t>()) {
+      return tape->index == key.index;
+
+    } else if(auto* tangent = node->as<ad_tangent_t>()) {
+      return tangent->index == key.index;
+
+    } else if(auto* component = node->as<ad_component_t>()) {
+      return component->index == key.index && 
+        component->component == key.component;
+
+    } else if(auto* literal = node->as<ad_literal_t>()) {
+      return !memcmp(&literal->x, &key.x, sizeof(double));
+
+    } else if(auto* unary = node->as<ad_unary_t>()) {
+      return !strcmp(unary->op, key.op) && unary->a == key.a;
+
+    } else if(auto* binary = node->as<ad_binary_t>()) {
+      return !strcmp(binary->op, key.op) && binary->a == key.a &&
+        binary->b == key.b;
 
-  auto node = std::make_unique<ad_func_t>(f);
-  node->args.push_back(std::move(a));
-  if(b) node->args.push_back(std::move(b));
-  return node;
+    } else if(auto* func = node->as<ad_func_t>()) {
+      size_t count = key.b ? 2 : 1;
+      return func->f == key.op && func->args.size() == count &&
+        func->args[0] == key.a && (1 == count || func->args[1] == key.b);
+    }
+    return false;
+  };
+
+  int id = ad_index.find(hash, eq);
+  if(-1 == id) {
+    ad_t* node = nullptr;
+    switch(key.kind) {
+      case ad_t::kind_tape:
+        node = arena.make<ad_tape_t>(key.index);
+        break;
+
+      case ad_t::kind_tangent:
+        node = arena.make<ad_tangent_t>(key.index);
+        break;
+
+      case ad_t::kind_component:
+        node = arena.make<ad_component_t>(key.index, key.component);
+        break;
+
+      case ad_t::kind_literal:
+        node = arena.make<ad_literal_t>(key.x);
+        break;
+
+      case ad_t::kind_unary:
+        node = arena.make<ad_unary_t>(key.op, key.a);
+        break;
+
+      case ad_t::kind_binary:
+        node = arena.make<ad_binary_t>(key.op, key.a, key.b);
+        break;
+
+      case ad_t::kind_func: {
+        auto func = arena.make<ad_func_t>(key.op);
+        func->args.push_back(key.a);
+        if(key.b) func->args.push_back(key.b);
+        node = func;
+        break;
+      }
+
+      default:
+        break;
+    }
+
+    id = nodes.size();
+    node->id = id;
+    nodes.push_back(node);
+    ad_index.insert(hash, id);
+    ++stats.ad_nodes;
+
+  } else
+    ++stats.ad_hits;
+
+  if(auto index = find_value(nodes[id])) {
+    ++stats.ad_tape_reuses;
+    return val(*index);
+  }
+  return nodes[id];
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -625,10 +1407,11 @@ void ad_builder_t::throw_error(const node_t* node, const char* fmt, ...) {
   if(tokenizer) {
     std::pair<int, int> linecol = tokenizer->token_linecol(node->loc);
     msg = format(
-      "autodiff formula \"%s\"\n"
+      "autodiff formula \"%.*s\"\n"
       "line %d col %d\n"
       "%s", 
-      tokenizer->text.c_str(),
+      (int)tokenizer->source().size(),
+      tokenizer->source().data(),
       linecol.first + 1,
       linecol.second + 1,
       msg.c_str()
@@ -646,8 +1429,16 @@ int ad_builder_t::find_var(const node_t* node, std::string name) {
   return it - vars.begin();
 }
 
-std::optional<int> ad_builder_t::find_cse(op_name_t op_name, int a, int b) {
-  switch(op_name) {
+void ad_builder_t::check_dims(const node_t* node, int a, int b) {
+  int dim_a = tape[a].dim;
+  int dim_b = tape[b].dim;
+  if(dim_a && dim_b && dim_a != dim_b)
+    throw_error(node, "dimension mismatch between %d and %d components",
+      dim_a, dim_b);
+}
+
+ad_builder_t::cse_key_t ad_builder_t::make_key(op_name_t op, int a, int b) {
+  switch(op) {
     case op_name_add:
     case op_name_mul:
       // For these commutative operators, put the lower index on the left.
@@ -660,22 +1451,67 @@ std::optional<int> ad_builder_t::find_cse(op_name_t op_name, int a, int b) {
       break;
   }
 
-  op_key_t op_key { op_name, (uint)a, (uint)b };
-  auto it = cse_map.find(op_key.bits);
+  uint64_t args[2] { (uint64_t)a, (uint64_t)b };
+  return make_key(op, args, -1 == b ? 1 : 2);
+}
+
+ad_builder_t::cse_key_t ad_builder_t::make_key(op_name_t op, 
+  const uint64_t* args, int count) {
+
+  // Tentatively append the operands to the pool. find_cse releases them 
+  // when it finds a match.
+  cse_key_t key { op, (int)cse_operands.size(), count };
+  cse_operands.insert(cse_operands.end(), args, args + count);
+
+  key.hash = hash_mix(op);
+  for(int i = 0; i < count; ++i)
+    key.hash = hash_combine(key.hash, args[i]);
+  return key;
+}
+
+std::optional<int> ad_builder_t::find_cse(const cse_key_t& key) {
+  const uint64_t* args = cse_operands.data() + key.begin;
+  auto eq = [&](int index) {
+    const cse_key_t& key2 = cse_keys[index];
+    return key.op == key2.op && key.count == key2.count &&
+      std::equal(args, args + key.count, cse_operands.data() + key2.begin);
+  };
+
   std::optional<int> index;
-  if(cse_map.end() != it) {
-    index = it->second;
-  }
+  int match = cse_index.find(key.hash, eq);
+  if(-1 != match) {
+    // Keys are created and looked up in LIFO order, so this key's operands
+    // are at the end of the pool.
+    cse_operands.resize(key.begin);
+    index = match;
+    ++stats.cse_hits;
+
+  } else
+    ++stats.cse_misses;
+
   return index;
 }
 
-std::optional<int> ad_builder_t::find_literal(double x) {
-  auto it = literal_map.find(x);
-  std::optional<int> index;
-  if(literal_map.end() != it) {
-    index = it->second;
+int ad_builder_t::push_item(item_t item, const cse_key_t& key) {
+  // Element-wise items take the dimension of their vector operands. 
+  // Reductions and component accesses are scalar.
+  if(!item.reduce) {
+    for(const auto& g : item.grads) {
+      if(-1 == g.component)
+        item.dim = std::max(item.dim, tape[g.index].dim);
+    }
   }
-  return index;
+
+  // Literals don't depend on the inputs, so edges into them carry nothing.
+  auto& grads = item.grads;
+  grads.erase(std::remove_if(grads.begin(), grads.end(), 
+    [&](const grad_t& g) { return as_literal(g.index); }), grads.end());
+
+  int count = tape.size();
+  tape.push_back(std::move(item));
+  cse_keys.push_back(key);
+  cse_index.insert(key.hash, count);
+  return count;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -687,22 +1523,28 @@ void print_ad(const ad_t* ad, std::ostringstream& oss, int indent) {
   if(auto* tape = ad->as<ad_tape_t>()) {
     oss<< "tape "<< tape->index<< "\n";
 
+  } else if(auto* tangent = ad->as<ad_tangent_t>()) {
+    oss<< "tangent "<< tangent->index<< "\n";
+
+  } else if(auto* component = ad->as<ad_component_t>()) {
+    oss<< "tape "<< component->index<< "["<< component->component<< "]\n";
+
   } else if(auto* literal = ad->as<ad_literal_t>()) {
     oss<< "literal "<< literal->x<< "\n";
 
   } else if(auto* unary = ad->as<ad_unary_t>()) {
     oss<< "unary "<< unary->op<< "\n";
-    print_ad(unary->a.get(), oss, indent + 1);
+    print_ad(unary->a, oss, indent + 1);
 
   } else if(auto* binary = ad->as<ad_binary_t>()) {
     oss<< "binary "<< binary->op<< "\n";
-    print_ad(binary->a.get(), oss, indent + 1);
-    print_ad(binary->b.get(), oss, indent + 1);
+    print_ad(binary->a, oss, indent + 1);
+    print_ad(binary->b, oss, indent + 1);
 
   } else if(auto* func = ad->as<ad_func_t>()) {
     oss<< func->f<< "()\n";
     for(const auto& arg : func->args)
-      print_ad(arg.get(), oss, indent + 1);
+      print_ad(arg, oss, indent + 1);
   }
 }
 
@@ -723,12 +1565,17 @@ std::string print_autodiff(const autodiff_t& autodiff) {
 
     // Print the value.
     oss<< "  value =\n";
-    oss<< print_ad(item.val.get(), 2);
+    oss<< print_ad(item.val, 2);
 
     // Print each gradient.
     for(const auto& grad : item.grads) {
       oss<< "  grad "<< grad.index<< " = \n";
-      oss<< print_ad(grad.coef.get(), 2);
+      oss<< print_ad(grad.coef, 2);
+    }
+
+    if(item.tangent) {
+      oss<< "  tangent =\n";
+      oss<< print_ad(item.tangent, 2);
     }
   }
 
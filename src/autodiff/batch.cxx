@@ -0,0 +1,427 @@
+#include <apex/autodiff_program.hxx>
+#include <apex/thread_pool.hxx>
+#include <cstring>
+#include <cmath>
+#include <cfloat>
+
+// Build a copy of each batch kernel for AVX-512, AVX2 and baseline x86-64,
+// and pick one when the library is loaded.
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(__clang__)
+#define APEX_TARGET_CLONES \
+  __attribute__((target_clones("arch=x86-64-v4", "arch=x86-64-v3", "default")))
+#else
+#define APEX_TARGET_CLONES
+#endif
+
+#define APEX_INLINE inline __attribute__((always_inline))
+
+// The vector helpers are always inlined, so the ABI for passing 512-bit
+// vectors without AVX-512 enabled never comes into play.
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+BEGIN_APEX_NAMESPACE
+
+// Eight lanes fill one AVX-512 register, two AVX2 registers or four SSE2
+// registers. Each slot of the register file holds a block of batch_vecs
+// vectors, so every dispatched instruction does batch_lanes lanes of work.
+typedef double vec_t __attribute__((vector_size(64)));
+typedef int64_t ivec_t __attribute__((vector_size(64)));
+
+enum {
+  vec_lanes = 8,
+  batch_vecs = 4,
+  batch_lanes = vec_lanes * batch_vecs,
+};
+
+namespace {
+
+APEX_INLINE vec_t splat(double x) {
+  return vec_t { } + x;
+}
+
+APEX_INLINE vec_t vabs(vec_t x) {
+  return (vec_t)((ivec_t)x & INT64_MAX);
+}
+
+APEX_INLINE vec_t vcopysign(vec_t x, vec_t sign) {
+  return (vec_t)(((ivec_t)x & INT64_MAX) | ((ivec_t)sign & INT64_MIN));
+}
+
+// Round to the nearest integer. Valid for |x| < 2^51.
+APEX_INLINE vec_t vround(vec_t x) {
+  const double magic = 0x1.8p52;
+  return (x + magic) - magic;
+}
+
+// 2^n for integral n in [-1022, 1023].
+APEX_INLINE vec_t vexp2i(vec_t n) {
+  ivec_t i = __builtin_convertvector(n, ivec_t);
+  return (vec_t)((i + 1023)<< 52);
+}
+
+// exp(r) - 1 for |r| <= ln(2) / 2. The Taylor series through r^13 is
+// accurate to a few units in the last place.
+APEX_INLINE vec_t expm1_kernel(vec_t r) {
+  vec_t p = splat(1.0 / 6227020800);
+  p = p * r + 1.0 / 479001600;
+  p = p * r + 1.0 / 39916800;
+  p = p * r + 1.0 / 3628800;
+  p = p * r + 1.0 / 362880;
+  p = p * r + 1.0 / 40320;
+  p = p * r + 1.0 / 5040;
+  p = p * r + 1.0 / 720;
+  p = p * r + 1.0 / 120;
+  p = p * r + 1.0 / 24;
+  p = p * r + 1.0 / 6;
+  p = p * r + 0.5;
+  return r + r * r * p;
+}
+
+// Split x = n ln(2) + r with |r| <= ln(2) / 2. ln(2) is split into a high
+// part with trailing zero bits, so n * ln2_hi is exact.
+APEX_INLINE vec_t reduce_ln2(vec_t x, vec_t& n) {
+  const double log2e = 1.44269504088896338700e+00;
+  const double ln2_hi = 6.93147180369123816490e-01;
+  const double ln2_lo = 1.90821492927058770002e-10;
+  n = vround(x * log2e);
+  return (x - n * ln2_hi) - n * ln2_lo;
+}
+
+APEX_INLINE vec_t vexp(vec_t x) {
+  vec_t xc = x > 709.8 ? splat(709.8) : x;
+  xc = xc < -745.2 ? splat(-745.2) : xc;
+  vec_t n;
+  vec_t r = reduce_ln2(xc, n);
+  vec_t p = 1 + expm1_kernel(r);
+
+  // Scale by 2^n in two steps, so results near the ends of the range don't
+  // overflow the exponent of either factor.
+  vec_t n1 = vround(n * .5 - .25);
+  vec_t y = p * vexp2i(n1) * vexp2i(n - n1);
+  y = x > 709.78 ? splat(HUGE_VAL) : y;
+  y = x < -745.14 ? splat(0) : y;
+  return y;
+}
+
+APEX_INLINE vec_t vexpm1(vec_t x) {
+  // expm1 saturates to -1 below -40. Past 709, it overflows.
+  vec_t xc = x < -40 ? splat(-40) : x;
+  xc = xc > 709 ? splat(709) : xc;
+  vec_t n;
+  vec_t r = reduce_ln2(xc, n);
+  vec_t q = expm1_kernel(r);
+
+  // 2^n (1 + q) - 1 = 2^n q + (2^n - 1). When n == 0 this is exactly q, so
+  // small arguments keep full relative precision.
+  vec_t s = vexp2i(n);
+  vec_t y = s * q + (s - 1);
+  y = x > 709.78 ? splat(HUGE_VAL) : y;
+  return y;
+}
+
+APEX_INLINE vec_t vlog(vec_t x) {
+  // Normalize subnormals.
+  ivec_t tiny = x < DBL_MIN;
+  vec_t xs = tiny ? x * 0x1p54 : x;
+  vec_t e = tiny ? splat(-54) : splat(0);
+
+  // x = m 2^k with m in [sqrt(1/2), sqrt(2)).
+  ivec_t bits = (ivec_t)xs;
+  e += __builtin_convertvector((bits>> 52) - 1023, vec_t);
+  vec_t m = (vec_t)((bits & 0x000fffffffffffffll) | 0x3ff0000000000000ll);
+  ivec_t big = m > M_SQRT2;
+  m = big ? m * .5 : m;
+  e = big ? e + 1 : e;
+
+  // log(m) = 2 atanh(f) with f = (m - 1) / (m + 1), |f| < 0.1716.
+  vec_t f = (m - 1) / (m + 1);
+  vec_t s = f * f;
+  vec_t p = splat(1.0 / 21);
+  p = p * s + 1.0 / 19;
+  p = p * s + 1.0 / 17;
+  p = p * s + 1.0 / 15;
+  p = p * s + 1.0 / 13;
+  p = p * s + 1.0 / 11;
+  p = p * s + 1.0 / 9;
+  p = p * s + 1.0 / 7;
+  p = p * s + 1.0 / 5;
+  p = p * s + 1.0 / 3;
+  vec_t log_m = 2 * f + 2 * f * s * p;
+
+  const double ln2_hi = 6.93147180369123816490e-01;
+  const double ln2_lo = 1.90821492927058770002e-10;
+  vec_t y = e * ln2_hi + (log_m + e * ln2_lo);
+
+  y = x == HUGE_VAL ? x : y;
+  y = x == 0 ? splat(-HUGE_VAL) : y;
+  y = x < 0 ? splat(NAN) : y;
+  y = x != x ? x : y;
+  return y;
+}
+
+// sin and cos of x, sharing the argument reduction. The three-part
+// Cody-Waite reduction by pi/2 is accurate for |x| < 2^20 pi/2. Lanes past
+// that are finished with the scalar functions.
+APEX_INLINE void vsincos(vec_t x, vec_t& sin_x, vec_t& cos_x) {
+  const double two_over_pi = 6.36619772367581382433e-01;
+  const double pio2_1 = 1.57079632673412561417e+00;
+  const double pio2_2 = 6.07710050630396597660e-11;
+  const double pio2_3 = 2.02226624871116645580e-21;
+
+  vec_t n = vround(x * two_over_pi);
+  vec_t r = ((x - n * pio2_1) - n * pio2_2) - n * pio2_3;
+  vec_t r2 = r * r;
+
+  // Taylor series on |r| <= pi/4.
+  vec_t ps = splat(1.0 / 355687428096000);
+  ps = ps * r2 - 1.0 / 1307674368000;
+  ps = ps * r2 + 1.0 / 6227020800;
+  ps = ps * r2 - 1.0 / 39916800;
+  ps = ps * r2 + 1.0 / 362880;
+  ps = ps * r2 - 1.0 / 5040;
+  ps = ps * r2 + 1.0 / 120;
+  ps = ps * r2 - 1.0 / 6;
+  vec_t s = r + r * r2 * ps;
+
+  vec_t pc = splat(-1.0 / 6402373705728000);
+  pc = pc * r2 + 1.0 / 20922789888000;
+  pc = pc * r2 - 1.0 / 87178291200;
+  pc = pc * r2 + 1.0 / 479001600;
+  pc = pc * r2 - 1.0 / 3628800;
+  pc = pc * r2 + 1.0 / 40320;
+  pc = pc * r2 - 1.0 / 720;
+  pc = pc * r2 + 1.0 / 24;
+  vec_t c = 1 - .5 * r2 + r2 * r2 * pc;
+
+  // Rotate by the quadrant.
+  ivec_t q = __builtin_convertvector(n, ivec_t);
+  ivec_t swap = (q & 1) != 0;
+  vec_t s2 = swap ? c : s;
+  vec_t c2 = swap ? s : c;
+  sin_x = (q & 2) != 0 ? -s2 : s2;
+  cos_x = ((q + 1) & 2) != 0 ? -c2 : c2;
+
+  ivec_t large = !(vabs(x) < 1.6e6);
+  if(__builtin_expect(0 != (large[0] | large[1] | large[2] | large[3] |
+    large[4] | large[5] | large[6] | large[7]), 0)) {
+    for(int l = 0; l < vec_lanes; ++l) {
+      if(large[l]) {
+        sin_x[l] = std::sin(x[l]);
+        cos_x[l] = std::cos(x[l]);
+      }
+    }
+  }
+}
+
+APEX_INLINE vec_t vtanh(vec_t x) {
+  // tanh |x| = -expm1(-2|x|) / (2 + expm1(-2|x|)).
+  vec_t u = vexpm1(-2 * vabs(x));
+  return vcopysign(-u / (2 + u), x);
+}
+
+APEX_INLINE vec_t vsinh(vec_t x) {
+  // sinh |x| = (u + u / (u + 1)) / 2 with u = expm1(|x|). Past 700, split
+  // the exponential so it doesn't overflow before sinh does.
+  vec_t a = vabs(x);
+  vec_t u = vexpm1(a);
+  vec_t y = .5 * (u + u / (u + 1));
+  vec_t e = vexp(.5 * a);
+  y = a > 700 ? .5 * e * e : y;
+  return vcopysign(y, x);
+}
+
+APEX_INLINE vec_t vcosh(vec_t x) {
+  vec_t a = vabs(x);
+  vec_t e = vexp(a);
+  vec_t y = .5 * (e + 1 / e);
+  vec_t e2 = vexp(.5 * a);
+  y = a > 700 ? .5 * e2 * e2 : y;
+  return y;
+}
+
+APEX_INLINE void vsinhcosh(vec_t x, vec_t& sinh_x, vec_t& cosh_x) {
+  // Both from the one expm1, with cosh |x| = (e + 1 / e) / 2 for 
+  // e = u + 1.
+  vec_t a = vabs(x);
+  vec_t u = vexpm1(a);
+  vec_t e = u + 1;
+  vec_t s = .5 * (u + u / e);
+  vec_t c = .5 * (e + 1 / e);
+  vec_t e2 = vexp(.5 * a);
+  vec_t big = .5 * e2 * e2;
+  sinh_x = vcopysign(a > 700 ? big : s, x);
+  cosh_x = a > 700 ? big : c;
+}
+
+APEX_INLINE vec_t vsqrt(vec_t x) {
+  // batch.cxx is built with -fno-math-errno, so the compiler turns this loop
+  // into vector square roots.
+  vec_t y;
+  for(int l = 0; l < vec_lanes; ++l)
+    y[l] = __builtin_sqrt(x[l]);
+  return y;
+}
+
+APEX_INLINE vec_t vpow(vec_t x, vec_t y) {
+  // pow has too many special cases to be worth a vector kernel.
+  vec_t z;
+  for(int l = 0; l < vec_lanes; ++l)
+    z[l] = std::pow(x[l], y[l]);
+  return z;
+}
+
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Run the program over one block of batch_lanes points. r holds
+// program.num_slots blocks, with the inputs already loaded.
+APEX_TARGET_CLONES __attribute__((noinline))
+static void eval_block(const autodiff_program_view_t& program, int count,
+  vec_t* r) {
+
+  typedef autodiff_program_t prog_t;
+  const double* literals = program.literals;
+  const prog_t::instr_t* instrs = program.instrs;
+  for(int i = 0; i < count; ++i) {
+    prog_t::instr_t instr = instrs[i];
+    vec_t* dest = r + batch_vecs * instr.dest;
+    const vec_t* a = r + batch_vecs * instr.a;
+    const vec_t* b = r + batch_vecs * instr.b;
+
+    #define BATCH_OP(op, expr) \
+      case prog_t::op: \
+        for(int k = 0; k < batch_vecs; ++k) dest[k] = expr; \
+        break;
+
+    switch(instr.op) {
+      BATCH_OP(op_literal, splat(literals[instr.a]))
+      BATCH_OP(op_neg,     -a[k])
+      BATCH_OP(op_add,     a[k] + b[k])
+      BATCH_OP(op_sub,     a[k] - b[k])
+      BATCH_OP(op_mul,     a[k] * b[k])
+      BATCH_OP(op_div,     a[k] / b[k])
+      BATCH_OP(op_accum,   dest[k] + a[k] * b[k])
+      BATCH_OP(op_sq,      a[k] * a[k])
+      BATCH_OP(op_sqrt,    vsqrt(a[k]))
+      BATCH_OP(op_exp,     vexp(a[k]))
+      BATCH_OP(op_log,     vlog(a[k]))
+      BATCH_OP(op_sinh,    vsinh(a[k]))
+      BATCH_OP(op_cosh,    vcosh(a[k]))
+      BATCH_OP(op_tanh,    vtanh(a[k]))
+      BATCH_OP(op_abs,     vabs(a[k]))
+      BATCH_OP(op_pow,     vpow(a[k], b[k]))
+
+      case prog_t::op_sin:
+      case prog_t::op_cos:
+      case prog_t::op_tan:
+        for(int k = 0; k < batch_vecs; ++k) {
+          vec_t s, c;
+          vsincos(a[k], s, c);
+          if(prog_t::op_sin == instr.op) dest[k] = s;
+          else if(prog_t::op_cos == instr.op) dest[k] = c;
+          else dest[k] = s / c;
+        }
+        break;
+
+      case prog_t::op_sincos:
+        for(int k = 0; k < batch_vecs; ++k) {
+          vec_t s, c;
+          vsincos(a[k], s, c);
+          dest[k] = s;
+          r[batch_vecs * instr.b + k] = c;
+        }
+        break;
+
+      case prog_t::op_sinhcosh:
+        for(int k = 0; k < batch_vecs; ++k) {
+          vec_t s, c;
+          vsinhcosh(a[k], s, c);
+          dest[k] = s;
+          r[batch_vecs * instr.b + k] = c;
+        }
+        break;
+    }
+
+    #undef BATCH_OP
+  }
+}
+
+size_t autodiff_batch_scratch_size(const autodiff_program_view_t& program) {
+  // Leave room to align the register file to a cache line.
+  return (size_t)program.num_slots * batch_lanes + vec_lanes;
+}
+
+void autodiff_eval_batch(const autodiff_program_view_t& program, 
+  size_t count, const double* const* inputs, double* values, 
+  double* const* grads, double* scratch) {
+
+  vec_t* r = (vec_t*)(((uintptr_t)scratch + sizeof(vec_t) - 1) &
+    ~(uintptr_t)(sizeof(vec_t) - 1));
+  int num_inputs = program.num_inputs;
+  int num_instrs = grads ? program.num_instrs : program.num_forward;
+
+  for(size_t base = 0; base < count; base += batch_lanes) {
+    size_t lanes = std::min<size_t>(batch_lanes, count - base);
+    size_t bytes = sizeof(double) * lanes;
+
+    // Load the inputs. Pad a partial block by repeating its last point, so
+    // the unused lanes compute valid numbers.
+    for(int i = 0; i < num_inputs; ++i) {
+      double* slot = (double*)(r + batch_vecs * i);
+      memcpy(slot, inputs[i] + base, bytes);
+      for(size_t l = lanes; l < batch_lanes; ++l)
+        slot[l] = slot[lanes - 1];
+    }
+
+    eval_block(program, num_instrs, r);
+
+    memcpy(values + base, r + batch_vecs * program.value_slot, bytes);
+    if(grads) {
+      for(int i = 0; i < num_inputs; ++i)
+        memcpy(grads[i] + base, r + batch_vecs * program.grad_slots[i],
+          bytes);
+    }
+  }
+}
+
+void autodiff_eval_parallel(thread_pool_t& pool,
+  const autodiff_program_view_t& program, size_t count,
+  const double* const* inputs, double* values, double* const* grads) {
+
+  // Round chunks up to whole blocks, so only the final chunk has a partial
+  // block and no two threads write the same cache line of output.
+  int num_chunks = pool.size();
+  size_t num_blocks = (count + batch_lanes - 1) / batch_lanes;
+  size_t chunk_size = batch_lanes * 
+    ((num_blocks + num_chunks - 1) / num_chunks);
+  size_t scratch_size = autodiff_batch_scratch_size(program);
+  int num_inputs = program.num_inputs;
+
+  pool.parallel_for(num_chunks, [&](int chunk) {
+    size_t begin = std::min(count, chunk * chunk_size);
+    size_t end = std::min(count, begin + chunk_size);
+    if(begin == end)
+      return;
+
+    // Each thread keeps its buffers between calls, so it only allocates 
+    // when it sees a larger program.
+    thread_local std::vector<double> scratch;
+    thread_local std::vector<const double*> chunk_inputs;
+    thread_local std::vector<double*> chunk_grads;
+    if(scratch.size() < scratch_size)
+      scratch.resize(scratch_size);
+    chunk_inputs.resize(num_inputs);
+    chunk_grads.resize(num_inputs);
+
+    for(int i = 0; i < num_inputs; ++i) {
+      chunk_inputs[i] = inputs[i] + begin;
+      if(grads) chunk_grads[i] = grads[i] + begin;
+    }
+
+    autodiff_eval_batch(program, end - begin, chunk_inputs.data(), 
+      values + begin, grads ? chunk_grads.data() : nullptr, scratch.data());
+  });
+}
+
+END_APEX_NAMESPACE
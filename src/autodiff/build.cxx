@@ -0,0 +1,78 @@
+#include <apex/autodiff_build.hxx>
+#include <apex/thread_pool.hxx>
+
+BEGIN_APEX_NAMESPACE
+
+static uint64_t hash_formula(const autodiff_formula_t& f) {
+  uint64_t hash = hash_bytes(f.formula.data(), f.formula.size());
+  for(const autodiff_var_t& var : f.vars) {
+    hash = hash_combine(hash, hash_bytes(var.name.data(), var.name.size()));
+    hash = hash_combine(hash, var.dim);
+  }
+  return hash;
+}
+
+static bool same_formula(const autodiff_formula_t& a,
+  const autodiff_formula_t& b) {
+  if(a.formula != b.formula || a.vars.size() != b.vars.size())
+    return false;
+  for(size_t i = 0; i < a.vars.size(); ++i) {
+    if(a.vars[i].name != b.vars[i].name || a.vars[i].dim != b.vars[i].dim)
+      return false;
+  }
+  return true;
+}
+
+std::vector<autodiff_build_t> build_autodiffs(thread_pool_t& pool,
+  const std::vector<autodiff_formula_t>& formulas, autodiff_mode_t mode,
+  int order) {
+
+  // Map each formula to the first formula with the same text and inputs.
+  // Only those are built.
+  int count = formulas.size();
+  std::vector<int> first(count);
+  std::vector<int> unique;
+  hash_index_t index;
+  for(int i = 0; i < count; ++i) {
+    uint64_t hash = hash_formula(formulas[i]);
+    auto eq = [&](int j) { return same_formula(formulas[i], formulas[j]); };
+    first[i] = index.find(hash, eq);
+    if(-1 == first[i]) {
+      first[i] = i;
+      index.insert(hash, i);
+      unique.push_back(i);
+    }
+  }
+
+  // Each build parses into its own tokenizer and arena, so the threads
+  // share nothing. Syntax errors come back as diagnostics; the errors
+  // make_autodiff throws while building the tape are caught per formula.
+  std::vector<autodiff_build_t> builds(count);
+  pool.parallel_for(unique.size(), [&](int u) {
+    int i = unique[u];
+    const autodiff_formula_t& f = formulas[i];
+    parse::parse_t parse = parse::parse_expression(f.formula.data(),
+      f.formula.data() + f.formula.size());
+    if(!parse.ok()) {
+      builds[i].error = format_diagnostics(parse);
+      builds[i].diagnostics = std::move(parse.diagnostics);
+      return;
+    }
+
+    try {
+      builds[i].autodiff = std::make_shared<const autodiff_t>(
+        make_autodiff(parse, f.vars, mode, order));
+
+    } catch(const std::exception& e) {
+      builds[i].error = e.what();
+    }
+  });
+
+  for(int i = 0; i < count; ++i) {
+    if(first[i] != i)
+      builds[i] = builds[first[i]];
+  }
+  return builds;
+}
+
+END_APEX_NAMESPACE
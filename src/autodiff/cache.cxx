@@ -0,0 +1,201 @@
+#include <apex/autodiff_cache.hxx>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <unistd.h>
+
+BEGIN_APEX_NAMESPACE
+
+// Bump this whenever tape construction changes, so tapes built by older
+// versions of libapex are rebuilt rather than loaded from a cache directory.
+// Changes to the file layout are caught by save_autodiff's own version.
+static const int tape_cache_version = 1;
+
+// The cache key encodes everything the tape depends on.
+static std::string make_key(const std::string& formula,
+  const std::vector<autodiff_var_t>& vars, autodiff_mode_t mode, int order) {
+
+  std::string key = format("%d %d %d %zu\n", tape_cache_version, (int)mode,
+    order, vars.size());
+  for(const autodiff_var_t& var : vars)
+    key += format("%d %zu ", var.dim, var.name.size()) + var.name + "\n";
+  key += formula;
+  return key;
+}
+
+static uint64_t hash_key(const std::string& key) {
+  uint64_t hash = hash_mix(key.size());
+  for(char c : key)
+    hash = hash_combine(hash, (uint8_t)c);
+  return hash;
+}
+
+static std::string tape_file_path(const std::string& dir,
+  const std::string& key) {
+  return dir + format("/%016llx.tape", (unsigned long long)hash_key(key));
+}
+
+// A cache file holds the key, so hash collisions are detected, followed by
+// the tape in the format of save_autodiff.
+static bool load_tape_file(const std::string& path, const std::string& key,
+  autodiff_t& autodiff) {
+
+  FILE* f = fopen(path.c_str(), "rb");
+  if(!f)
+    return false;
+
+  std::string data;
+  char buf[16384];
+  size_t size;
+  while((size = fread(buf, 1, sizeof(buf), f)))
+    data.append(buf, size);
+  fclose(f);
+
+  size_t header = key.size() + 1;
+  if(data.size() < header || data.compare(0, header, key.c_str(), header))
+    return false;
+
+  // A damaged file is just a miss.
+  try {
+    autodiff = load_autodiff(data.data() + header, data.size() - header);
+    return true;
+
+  } catch(const ad_exeption_t&) {
+    return false;
+  }
+}
+
+static bool save_tape_file(const std::string& path, const std::string& key,
+  const autodiff_t& autodiff) {
+
+  std::string data(key.c_str(), key.size() + 1);
+  data += save_autodiff(autodiff);
+
+  // Write to a private file and rename it into place, so a concurrent
+  // reader never sees a partial tape.
+  std::string temp = path + format(".%d.tmp", (int)getpid());
+  FILE* f = fopen(temp.c_str(), "wb");
+  if(!f)
+    return false;
+  bool ok = data.size() == fwrite(data.data(), 1, data.size(), f);
+  ok &= 0 == fclose(f);
+  ok = ok && 0 == rename(temp.c_str(), path.c_str());
+  if(!ok)
+    remove(temp.c_str());
+  return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct tape_cache_t {
+  std::mutex mutex;
+  std::vector<std::string> keys;
+  std::vector<autodiff_ptr_t> tapes;
+  hash_index_t index;
+
+  bool dir_set = false;
+  std::string dir;
+  autodiff_cache_stats_t stats;
+
+  autodiff_ptr_t find(const std::string& key, uint64_t hash) const {
+    auto eq = [&](int i) { return keys[i] == key; };
+    int i = index.find(hash, eq);
+    return -1 != i ? tapes[i] : nullptr;
+  }
+
+  const std::string& get_dir() {
+    if(!dir_set) {
+      const char* env = getenv("APEX_AUTODIFF_CACHE_DIR");
+      dir = env ? env : "";
+      dir_set = true;
+    }
+    return dir;
+  }
+};
+
+tape_cache_t& tape_cache() {
+  static tape_cache_t cache;
+  return cache;
+}
+
+} // namespace
+
+autodiff_ptr_t make_cached_autodiff(const std::string& formula,
+  const std::vector<autodiff_var_t>& vars, autodiff_mode_t mode, int order) {
+
+  std::string key = make_key(formula, vars, mode, order);
+  uint64_t hash = hash_key(key);
+
+  tape_cache_t& cache = tape_cache();
+  std::string dir;
+  {
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    if(autodiff_ptr_t tape = cache.find(key, hash)) {
+      ++cache.stats.hits;
+      return tape;
+    }
+    dir = cache.get_dir();
+  }
+
+  // Load or build the tape outside the lock, so other formulas aren't held
+  // up. If two threads race on one formula, the first to finish wins.
+  auto autodiff = std::make_shared<autodiff_t>();
+  std::string path;
+  bool loaded = false, saved = false;
+  if(dir.size()) {
+    path = tape_file_path(dir, key);
+    loaded = load_tape_file(path, key, *autodiff);
+  }
+  if(!loaded) {
+    *autodiff = make_autodiff(formula, vars, mode, order);
+    if(path.size())
+      saved = save_tape_file(path, key, *autodiff);
+  }
+
+  std::lock_guard<std::mutex> lock(cache.mutex);
+  if(loaded) ++cache.stats.disk_hits;
+  else ++cache.stats.misses;
+  if(saved) ++cache.stats.disk_writes;
+
+  if(autodiff_ptr_t tape = cache.find(key, hash))
+    return tape;
+  cache.index.insert(hash, cache.keys.size());
+  cache.keys.push_back(std::move(key));
+  cache.tapes.push_back(autodiff);
+  return autodiff;
+}
+
+void set_autodiff_cache_dir(const std::string& dir) {
+  tape_cache_t& cache = tape_cache();
+  std::lock_guard<std::mutex> lock(cache.mutex);
+  cache.dir = dir;
+  cache.dir_set = true;
+}
+
+std::string autodiff_cache_dir() {
+  tape_cache_t& cache = tape_cache();
+  std::lock_guard<std::mutex> lock(cache.mutex);
+  return cache.get_dir();
+}
+
+autodiff_cache_stats_t autodiff_cache_stats() {
+  tape_cache_t& cache = tape_cache();
+  std::lock_guard<std::mutex> lock(cache.mutex);
+  autodiff_cache_stats_t stats = cache.stats;
+  stats.entries = cache.keys.size();
+  return stats;
+}
+
+void clear_autodiff_cache() {
+  tape_cache_t& cache = tape_cache();
+  std::lock_guard<std::mutex> lock(cache.mutex);
+  cache.keys.clear();
+  cache.tapes.clear();
+  cache.index = hash_index_t();
+  cache.stats = autodiff_cache_stats_t();
+}
+
+END_APEX_NAMESPACE
@@ -0,0 +1,359 @@
+#include <apex/autodiff_ir.hxx>
+#include <sstream>
+#include <cstring>
+
+BEGIN_APEX_NAMESPACE
+
+typedef autodiff_ir_t::op_t op_t;
+
+static const struct {
+  const char* name;
+  op_t op;
+  int num_args;
+} func_ops[] {
+  { "apex::sq",  autodiff_ir_t::op_sq,   1 },
+  { "std::sqrt", autodiff_ir_t::op_sqrt, 1 },
+  { "std::exp",  autodiff_ir_t::op_exp,  1 },
+  { "std::log",  autodiff_ir_t::op_log,  1 },
+  { "std::sin",  autodiff_ir_t::op_sin,  1 },
+  { "std::cos",  autodiff_ir_t::op_cos,  1 },
+  { "std::tan",  autodiff_ir_t::op_tan,  1 },
+  { "std::sinh", autodiff_ir_t::op_sinh, 1 },
+  { "std::cosh", autodiff_ir_t::op_cosh, 1 },
+  { "std::tanh", autodiff_ir_t::op_tanh, 1 },
+  { "std::abs",  autodiff_ir_t::op_abs,  1 },
+  { "std::pow",  autodiff_ir_t::op_pow,  2 },
+};
+
+// The builder's operators are string literals, and codegen splices them in
+// with @op, so the rebuilt nodes use the same spellings.
+static const char* binary_ops[] { "+", "-", "*", "/" };
+
+const char* autodiff_ir_func_name(op_t op) {
+  for(const auto& f : func_ops)
+    if(f.op == op) return f.name;
+  return nullptr;
+}
+
+namespace {
+
+struct ir_builder_t {
+  void flatten(const autodiff_t& autodiff);
+  int node(const ad_t* ad);
+  int find(const ad_t* ad) const;
+  void append(const ad_t* ad);
+  void push(const ad_t* ad, op_t op, int a, int b = -1);
+
+  autodiff_ir_t ir;
+
+  // Tapes from make_autodiff list their nodes in autodiff_t::nodes, and 
+  // remap holds the IR id of each. Nodes of hand-built tapes have no ids, so
+  // those are found by address instead.
+  bool by_id = false;
+  std::vector<int> remap;
+  std::vector<const ad_t*> nodes;
+  hash_index_t node_index;
+
+  // The DFS stack, kept between calls to save reallocating it.
+  std::vector<std::pair<const ad_t*, bool> > stack;
+};
+
+} // namespace
+
+int ir_builder_t::find(const ad_t* ad) const {
+  if(by_id)
+    return remap[ad->id];
+  auto eq = [&](int id) { return nodes[id] == ad; };
+  return node_index.find(hash_mix((uint64_t)ad), eq);
+}
+
+void ir_builder_t::push(const ad_t* ad, op_t op, int a, int b) {
+  int id = ir.ops.size();
+  if(by_id)
+    remap[ad->id] = id;
+  else {
+    node_index.insert(hash_mix((uint64_t)ad), id);
+    nodes.push_back(ad);
+  }
+  ir.ops.push_back(op);
+  ir.a.push_back(a);
+  ir.b.push_back(b);
+}
+
+void ir_builder_t::append(const ad_t* ad) {
+  // The operands have already been appended.
+  if(auto* tape = ad->as<ad_tape_t>()) {
+    push(ad, autodiff_ir_t::op_tape, tape->index);
+
+  } else if(auto* tangent = ad->as<ad_tangent_t>()) {
+    push(ad, autodiff_ir_t::op_tangent, tangent->index);
+
+  } else if(auto* component = ad->as<ad_component_t>()) {
+    push(ad, autodiff_ir_t::op_component, component->index,
+      component->component);
+
+  } else if(auto* literal = ad->as<ad_literal_t>()) {
+    push(ad, autodiff_ir_t::op_literal, ir.literals.size());
+    ir.literals.push_back(literal->x);
+
+  } else if(auto* unary = ad->as<ad_unary_t>()) {
+    if(strcmp(unary->op, "-"))
+      throw ad_exeption_t(format("unsupported unary operator '%s'",
+        unary->op));
+    push(ad, autodiff_ir_t::op_neg, find(unary->a));
+
+  } else if(auto* binary = ad->as<ad_binary_t>()) {
+    auto it = std::find_if(std::begin(binary_ops), std::end(binary_ops),
+      [&](const char* op) { return !strcmp(op, binary->op); });
+    if(std::end(binary_ops) == it)
+      throw ad_exeption_t(format("unsupported binary operator '%s'",
+        binary->op));
+    op_t op = (op_t)(autodiff_ir_t::op_add + (it - binary_ops));
+    push(ad, op, find(binary->a), find(binary->b));
+
+  } else if(auto* func = ad->as<ad_func_t>()) {
+    auto it = std::find_if(std::begin(func_ops), std::end(func_ops),
+      [&](const auto& f) { return func->f == f.name; });
+    if(std::end(func_ops) == it)
+      throw ad_exeption_t(format("unsupported function '%s'",
+        func->f.c_str()));
+    if(it->num_args != (int)func->args.size())
+      throw ad_exeption_t(format("%s() requires %d arguments", it->name,
+        it->num_args));
+    push(ad, it->op, find(func->args[0]),
+      2 == it->num_args ? find(func->args[1]) : -1);
+  }
+}
+
+void ir_builder_t::flatten(const autodiff_t& autodiff) {
+  // The node list is already in topological order. Mark the nodes the tape
+  // reaches in one backwards scan and append them in one forwards scan, so
+  // the IR only holds live nodes.
+  const std::vector<ad_ptr_t>& list = autodiff.nodes;
+  int count = list.size();
+  std::vector<char> live(count);
+  for(const autodiff_t::item_t& item : autodiff.tape) {
+    if(item.val) live[item.val->id] = 1;
+    if(item.tangent) live[item.tangent->id] = 1;
+    for(const auto& g : item.grads)
+      live[g.coef->id] = 1;
+  }
+  for(int i = count - 1; i >= 0; --i) {
+    if(!live[i])
+      continue;
+    const ad_t* ad = list[i];
+    if(auto* unary = ad->as<ad_unary_t>()) {
+      live[unary->a->id] = 1;
+
+    } else if(auto* binary = ad->as<ad_binary_t>()) {
+      live[binary->a->id] = 1;
+      live[binary->b->id] = 1;
+
+    } else if(auto* func = ad->as<ad_func_t>()) {
+      for(ad_ptr_t arg : func->args)
+        live[arg->id] = 1;
+    }
+  }
+
+  by_id = true;
+  remap.assign(count, -1);
+  for(int i = 0; i < count; ++i) {
+    if(live[i])
+      append(list[i]);
+  }
+}
+
+int ir_builder_t::node(const ad_t* ad) {
+  if(!ad)
+    return -1;
+  int id = find(ad);
+  if(-1 != id)
+    return id;
+
+  // Number the operands before the node, without recursing, so long chains
+  // of subexpressions don't overflow the stack.
+  stack.push_back({ ad, false });
+  while(stack.size()) {
+    auto [top, expanded] = stack.back();
+    stack.pop_back();
+    if(-1 != find(top))
+      continue;
+
+    if(expanded) {
+      append(top);
+      continue;
+    }
+
+    stack.push_back({ top, true });
+    if(auto* unary = top->as<ad_unary_t>()) {
+      stack.push_back({ unary->a, false });
+
+    } else if(auto* binary = top->as<ad_binary_t>()) {
+      stack.push_back({ binary->b, false });
+      stack.push_back({ binary->a, false });
+
+    } else if(auto* func = top->as<ad_func_t>()) {
+      for(size_t i = func->args.size(); i--; )
+        stack.push_back({ func->args[i], false });
+    }
+  }
+  return find(ad);
+}
+
+autodiff_ir_t make_autodiff_ir(const autodiff_t& autodiff) {
+  ir_builder_t builder;
+  autodiff_ir_t& ir = builder.ir;
+  ir.vars = autodiff.vars;
+  ir.mode = autodiff.mode;
+  ir.root = autodiff.root;
+  ir.order = autodiff.order;
+  ir.grad_items = autodiff.grad_items;
+  ir.stats = autodiff.stats;
+
+  if(autodiff.nodes.size())
+    builder.flatten(autodiff);
+
+  ir.items.reserve(autodiff.tape.size());
+  ir.grad_offsets.reserve(autodiff.tape.size() + 1);
+  for(const autodiff_t::item_t& item : autodiff.tape) {
+    ir.grad_offsets.push_back(ir.grads.size());
+    ir.items.push_back({ item.dim, builder.node(item.val), item.reduce,
+      builder.node(item.tangent) });
+    for(const auto& g : item.grads)
+      ir.grads.push_back({ g.index, builder.node(g.coef), g.component });
+  }
+  ir.grad_offsets.push_back(ir.grads.size());
+  return std::move(builder.ir);
+}
+
+autodiff_t make_autodiff(const autodiff_ir_t& ir) {
+  autodiff_t autodiff;
+  autodiff.vars = ir.vars;
+  autodiff.mode = ir.mode;
+  autodiff.root = ir.root;
+  autodiff.order = ir.order;
+  autodiff.grad_items = ir.grad_items;
+  autodiff.stats = ir.stats;
+
+  arena_t& arena = autodiff.arena;
+  std::vector<ad_ptr_t>& nodes = autodiff.nodes;
+  nodes.resize(ir.size());
+  for(int i = 0; i < ir.size(); ++i) {
+    op_t op = ir.ops[i];
+    int a = ir.a[i], b = ir.b[i];
+    ad_t* node = nullptr;
+    switch(op) {
+      case autodiff_ir_t::op_tape:
+        node = arena.make<ad_tape_t>(a);
+        break;
+
+      case autodiff_ir_t::op_tangent:
+        node = arena.make<ad_tangent_t>(a);
+        break;
+
+      case autodiff_ir_t::op_component:
+        node = arena.make<ad_component_t>(a, b);
+        break;
+
+      case autodiff_ir_t::op_literal:
+        node = arena.make<ad_literal_t>(ir.literals[a]);
+        break;
+
+      case autodiff_ir_t::op_neg:
+        node = arena.make<ad_unary_t>("-", nodes[a]);
+        break;
+
+      case autodiff_ir_t::op_add:
+      case autodiff_ir_t::op_sub:
+      case autodiff_ir_t::op_mul:
+      case autodiff_ir_t::op_div:
+        node = arena.make<ad_binary_t>(
+          binary_ops[op - autodiff_ir_t::op_add], nodes[a], nodes[b]);
+        break;
+
+      default: {
+        ad_func_t* func = arena.make<ad_func_t>(autodiff_ir_func_name(op));
+        func->args.push_back(nodes[a]);
+        if(-1 != b)
+          func->args.push_back(nodes[b]);
+        node = func;
+        break;
+      }
+    }
+    node->id = i;
+    nodes[i] = node;
+  }
+
+  auto ref = [&](int id) { return -1 != id ? nodes[id] : nullptr; };
+  int count = ir.items.size();
+  autodiff.tape.resize(count);
+  for(int i = 0; i < count; ++i) {
+    const autodiff_ir_t::item_t& src = ir.items[i];
+    autodiff_t::item_t& item = autodiff.tape[i];
+    item.dim = src.dim;
+    item.val = ref(src.val);
+    item.reduce = src.reduce;
+    item.tangent = ref(src.tangent);
+    for(int g = ir.grad_offsets[i]; g < ir.grad_offsets[i + 1]; ++g)
+      item.grads.push_back({ ir.grads[g].index, ref(ir.grads[g].coef),
+        ir.grads[g].component });
+  }
+  return autodiff;
+}
+
+std::string print_autodiff_ir(const autodiff_ir_t& ir) {
+  std::ostringstream oss;
+  for(int i = 0; i < ir.size(); ++i) {
+    int a = ir.a[i], b = ir.b[i];
+    oss<< "n"<< i<< " = ";
+    switch(ir.ops[i]) {
+      case autodiff_ir_t::op_tape:
+        oss<< "tape "<< a;
+        break;
+
+      case autodiff_ir_t::op_tangent:
+        oss<< "tangent "<< a;
+        break;
+
+      case autodiff_ir_t::op_component:
+        oss<< "tape "<< a<< "["<< b<< "]";
+        break;
+
+      case autodiff_ir_t::op_literal:
+        oss<< "literal "<< ir.literals[a];
+        break;
+
+      case autodiff_ir_t::op_neg:
+        oss<< "-n"<< a;
+        break;
+
+      case autodiff_ir_t::op_add:
+      case autodiff_ir_t::op_sub:
+      case autodiff_ir_t::op_mul:
+      case autodiff_ir_t::op_div:
+        oss<< "n"<< a<< " "<< binary_ops[ir.ops[i] - autodiff_ir_t::op_add]<<
+          " n"<< b;
+        break;
+
+      default:
+        oss<< autodiff_ir_func_name(ir.ops[i])<< "(n"<< a;
+        if(-1 != b) oss<< ", n"<< b;
+        oss<< ")";
+        break;
+    }
+    oss<< "\n";
+  }
+
+  for(size_t i = ir.vars.size(); i < ir.items.size(); ++i) {
+    const autodiff_ir_t::item_t& item = ir.items[i];
+    oss<< "tape "<< i<< ": value = n"<< item.val;
+    for(int g = ir.grad_offsets[i]; g < ir.grad_offsets[i + 1]; ++g)
+      oss<< ", grad "<< ir.grads[g].index<< " = n"<< ir.grads[g].coef;
+    if(-1 != item.tangent)
+      oss<< ", tangent = n"<< item.tangent;
+    oss<< "\n";
+  }
+  return oss.str();
+}
+
+END_APEX_NAMESPACE
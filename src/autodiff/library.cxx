@@ -0,0 +1,437 @@
+#include <apex/autodiff_library.hxx>
+#include <cstddef>
+#include <cstring>
+#include <numeric>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+BEGIN_APEX_NAMESPACE
+
+typedef autodiff_program_t::instr_t instr_t;
+
+// Instructions are used in place, so their layout is part of the format.
+static_assert(16 == sizeof(instr_t) && 0 == offsetof(instr_t, op) &&
+  4 == offsetof(instr_t, dest) && 8 == offsetof(instr_t, a) &&
+  12 == offsetof(instr_t, b), "instr_t layout is part of the library format");
+
+// The last opcode. Instructions past it are rejected.
+static const int max_op = autodiff_program_t::op_sinhcosh;
+
+// Instructions that read or write slot b.
+static bool has_b(int op) {
+  switch(op) {
+    case autodiff_program_t::op_add:
+    case autodiff_program_t::op_sub:
+    case autodiff_program_t::op_mul:
+    case autodiff_program_t::op_div:
+    case autodiff_program_t::op_accum:
+    case autodiff_program_t::op_pow:
+    case autodiff_program_t::op_sincos:
+    case autodiff_program_t::op_sinhcosh:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Bump the version whenever the layout or the meaning of an opcode changes.
+static const char library_magic[8] = { 'A', 'P', 'E', 'X', 'L', 'I', 'B', 0 };
+static const uint32_t library_version = 1;
+static const uint32_t library_byte_order = 0x01020304;
+
+// The file starts with a header and an entry for each program, sorted by
+// name. Offsets are from the start of the file.
+struct library_header_t {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint64_t count;
+  uint64_t size;
+};
+
+struct library_entry_t {
+  uint64_t name_offset;
+  uint64_t name_size;
+  uint64_t program_offset;
+  uint64_t program_size;
+};
+
+// Each program starts with a header. The array offsets are from the start
+// of the program, and are aligned to 8 bytes.
+struct program_header_t {
+  int32_t mode;
+  int32_t num_instrs;
+  int32_t num_literals;
+  int32_t num_slots;
+  int32_t num_inputs;
+  int32_t num_forward;
+  int32_t value_slot;
+  int32_t direction_slot;
+  int32_t num_hvp;
+  int32_t num_hessian;
+  int32_t num_colors;
+  int32_t num_vars;
+
+  uint32_t instrs;
+  uint32_t literals;
+  uint32_t grad_slots;
+  uint32_t hvp_slots;
+  uint32_t hessian_rows;
+  uint32_t hessian_cols;
+  uint32_t hessian_slots;
+  uint32_t vars;
+};
+
+// Var names follow the var table. name_offset is from the start of the
+// program.
+struct program_var_t {
+  int32_t dim;
+  uint32_t name_offset;
+  uint32_t name_size;
+};
+
+static void align(std::string& data) {
+  data.resize((data.size() + 7) & ~(size_t)7, '\0');
+}
+
+static void encode_program(std::string& data,
+  const autodiff_program_t& program) {
+
+  size_t base = data.size();
+  program_header_t header { };
+  data.append(sizeof(program_header_t), '\0');
+
+  auto array = [&](const void* p, size_t size) {
+    align(data);
+    uint32_t offset = data.size() - base;
+    data.append((const char*)p, size);
+    return offset;
+  };
+
+  // Copy the instructions field by field, so the padding is zeroed.
+  std::vector<instr_t> instrs(program.instrs.size());
+  memset(instrs.data(), 0, sizeof(instr_t) * instrs.size());
+  for(size_t i = 0; i < instrs.size(); ++i) {
+    instrs[i].op = program.instrs[i].op;
+    instrs[i].dest = program.instrs[i].dest;
+    instrs[i].a = program.instrs[i].a;
+    instrs[i].b = program.instrs[i].b;
+  }
+
+  header.mode = program.mode;
+  header.num_instrs = instrs.size();
+  header.num_literals = program.literals.size();
+  header.num_slots = program.num_slots;
+  header.num_inputs = program.num_inputs;
+  header.num_forward = program.num_forward;
+  header.value_slot = program.value_slot;
+  header.direction_slot = program.direction_slot;
+  header.num_hvp = program.hvp_slots.size();
+  header.num_hessian = program.hessian_slots.size();
+  header.num_colors = program.num_colors;
+  header.num_vars = program.vars.size();
+
+  header.instrs = array(instrs.data(), sizeof(instr_t) * instrs.size());
+  header.literals = array(program.literals.data(),
+    sizeof(double) * program.literals.size());
+  header.grad_slots = array(program.grad_slots.data(),
+    sizeof(int) * program.grad_slots.size());
+  header.hvp_slots = array(program.hvp_slots.data(),
+    sizeof(int) * program.hvp_slots.size());
+  header.hessian_rows = array(program.hessian_rows.data(),
+    sizeof(int) * program.hessian_rows.size());
+  header.hessian_cols = array(program.hessian_cols.data(),
+    sizeof(int) * program.hessian_cols.size());
+  header.hessian_slots = array(program.hessian_slots.data(),
+    sizeof(int) * program.hessian_slots.size());
+
+  std::vector<program_var_t> vars(program.vars.size());
+  header.vars = array(vars.data(), sizeof(program_var_t) * vars.size());
+  for(size_t i = 0; i < vars.size(); ++i) {
+    const autodiff_var_t& var = program.vars[i];
+    program_var_t v { var.dim, (uint32_t)(data.size() - base),
+      (uint32_t)var.name.size() };
+    data += var.name;
+    memcpy(&data[base + header.vars + i * sizeof(program_var_t)], &v,
+      sizeof(v));
+  }
+
+  memcpy(&data[base], &header, sizeof(header));
+}
+
+std::string save_autodiff_library(const std::vector<std::string>& names,
+  const std::vector<autodiff_program_t>& programs) {
+
+  if(names.size() != programs.size())
+    throw ad_exeption_t("save_autodiff_library needs one name per program");
+
+  size_t count = names.size();
+  std::vector<size_t> order(count);
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return names[a] < names[b];
+  });
+  for(size_t i = 1; i < count; ++i) {
+    if(names[order[i - 1]] == names[order[i]])
+      throw ad_exeption_t(format("duplicate program name '%s'",
+        names[order[i]].c_str()));
+  }
+
+  std::string data(sizeof(library_header_t) +
+    count * sizeof(library_entry_t), '\0');
+  std::vector<library_entry_t> entries(count);
+  for(size_t i = 0; i < count; ++i) {
+    library_entry_t& entry = entries[i];
+    align(data);
+    entry.program_offset = data.size();
+    encode_program(data, programs[order[i]]);
+    entry.program_size = data.size() - entry.program_offset;
+  }
+  for(size_t i = 0; i < count; ++i) {
+    entries[i].name_offset = data.size();
+    entries[i].name_size = names[order[i]].size();
+    data += names[order[i]];
+  }
+  align(data);
+
+  library_header_t header { };
+  memcpy(header.magic, library_magic, sizeof(library_magic));
+  header.version = library_version;
+  header.byte_order = library_byte_order;
+  header.count = count;
+  header.size = data.size();
+  memcpy(&data[0], &header, sizeof(header));
+  if(count)
+    memcpy(&data[sizeof(header)], entries.data(),
+      count * sizeof(library_entry_t));
+  return data;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+autodiff_library_t::autodiff_library_t(const void* data, size_t size) :
+  data((const char*)data), bytes(size) {
+
+  validate();
+}
+
+autodiff_library_t autodiff_library_t::open(const std::string& path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if(-1 == fd)
+    throw ad_exeption_t(format("cannot open %s", path.c_str()));
+
+  struct stat st;
+  void* mapping = MAP_FAILED;
+  size_t size = 0;
+  if(0 == fstat(fd, &st) && st.st_size > 0) {
+    size = st.st_size;
+    mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if(MAP_FAILED == mapping)
+    throw ad_exeption_t(format("cannot map %s", path.c_str()));
+
+  // The library owns the mapping from here, so it's unmapped if the file
+  // doesn't validate.
+  autodiff_library_t library;
+  library.mapping = mapping;
+  library.mapping_size = size;
+  library.data = (const char*)mapping;
+  library.bytes = size;
+  library.validate();
+  return library;
+}
+
+autodiff_library_t::autodiff_library_t(autodiff_library_t&& rhs) {
+  *this = std::move(rhs);
+}
+
+autodiff_library_t& autodiff_library_t::operator=(autodiff_library_t&& rhs) {
+  if(this != &rhs) {
+    unmap();
+    data = rhs.data;
+    bytes = rhs.bytes;
+    count = rhs.count;
+    mapping = rhs.mapping;
+    mapping_size = rhs.mapping_size;
+    rhs.data = nullptr;
+    rhs.bytes = rhs.count = 0;
+    rhs.mapping = nullptr;
+    rhs.mapping_size = 0;
+  }
+  return *this;
+}
+
+autodiff_library_t::~autodiff_library_t() {
+  unmap();
+}
+
+void autodiff_library_t::unmap() {
+  if(mapping)
+    munmap(mapping, mapping_size);
+  mapping = nullptr;
+  mapping_size = 0;
+}
+
+static const library_entry_t& get_entry(const char* data, size_t index) {
+  return ((const library_entry_t*)(data + sizeof(library_header_t)))[index];
+}
+
+static const program_header_t& get_program(const char* data,
+  size_t index) {
+  return *(const program_header_t*)(data +
+    get_entry(data, index).program_offset);
+}
+
+std::string_view autodiff_library_t::name(size_t index) const {
+  const library_entry_t& entry = get_entry(data, index);
+  return std::string_view(data + entry.name_offset, entry.name_size);
+}
+
+autodiff_program_view_t autodiff_library_t::program(size_t index) const {
+  const program_header_t& header = get_program(data, index);
+  const char* base = (const char*)&header;
+
+  autodiff_program_view_t view;
+  view.mode = (autodiff_mode_t)header.mode;
+  view.instrs = (const instr_t*)(base + header.instrs);
+  view.num_instrs = header.num_instrs;
+  view.literals = (const double*)(base + header.literals);
+  view.num_literals = header.num_literals;
+  view.num_slots = header.num_slots;
+  view.num_inputs = header.num_inputs;
+  view.num_forward = header.num_forward;
+  view.value_slot = header.value_slot;
+  view.grad_slots = (const int*)(base + header.grad_slots);
+  view.direction_slot = header.direction_slot;
+  if(header.num_hvp)
+    view.hvp_slots = (const int*)(base + header.hvp_slots);
+  view.num_hessian = header.num_hessian;
+  view.hessian_rows = (const int*)(base + header.hessian_rows);
+  view.hessian_cols = (const int*)(base + header.hessian_cols);
+  view.hessian_slots = (const int*)(base + header.hessian_slots);
+  view.num_colors = header.num_colors;
+  return view;
+}
+
+std::vector<autodiff_var_t> autodiff_library_t::vars(size_t index) const {
+  const program_header_t& header = get_program(data, index);
+  const char* base = (const char*)&header;
+  const program_var_t* vars = (const program_var_t*)(base + header.vars);
+
+  std::vector<autodiff_var_t> result(header.num_vars);
+  for(int i = 0; i < header.num_vars; ++i) {
+    result[i].name.assign(base + vars[i].name_offset, vars[i].name_size);
+    result[i].dim = vars[i].dim;
+  }
+  return result;
+}
+
+int autodiff_library_t::find(std::string_view name) const {
+  size_t first = 0, last = count;
+  while(first < last) {
+    size_t mid = (first + last) / 2;
+    int cmp = this->name(mid).compare(name);
+    if(!cmp) return mid;
+    if(cmp < 0) first = mid + 1;
+    else last = mid;
+  }
+  return -1;
+}
+
+void autodiff_library_t::validate() {
+  // Evaluation trusts every index in the file, so check them all up front.
+  auto check = [&](bool valid, const char* what) {
+    if(!valid)
+      throw ad_exeption_t(format("invalid autodiff library: %s", what));
+  };
+  auto in_range = [](uint64_t offset, uint64_t size, uint64_t limit) {
+    return offset <= limit && size <= limit - offset;
+  };
+
+  check(0 == ((uintptr_t)data & 7), "data is not 8-byte aligned");
+  check(bytes >= sizeof(library_header_t), "file is too short");
+
+  library_header_t header;
+  memcpy(&header, data, sizeof(header));
+  check(!memcmp(header.magic, library_magic, sizeof(library_magic)),
+    "bad magic number");
+  if(library_version != header.version)
+    throw ad_exeption_t(format("autodiff library has version %u; "
+      "expected %u", header.version, library_version));
+  check(library_byte_order == header.byte_order, "wrong byte order");
+  check(header.size == bytes, "file size doesn't match the header");
+  check(header.count <= (bytes - sizeof(header)) / sizeof(library_entry_t),
+    "too many entries");
+  count = header.count;
+
+  for(size_t i = 0; i < count; ++i) {
+    const library_entry_t& entry = get_entry(data, i);
+    check(in_range(entry.name_offset, entry.name_size, bytes),
+      "name out of range");
+    check(i == 0 || name(i - 1) < name(i), "names are not sorted");
+    check(0 == (entry.program_offset & 7) &&
+      in_range(entry.program_offset, entry.program_size, bytes) &&
+      entry.program_size >= sizeof(program_header_t),
+      "program out of range");
+
+    const program_header_t& p = get_program(data, i);
+    uint64_t size = entry.program_size;
+    auto array = [&](uint32_t offset, int num, size_t elem) {
+      check(num >= 0 && 0 == (offset & 7) &&
+        in_range(offset, (uint64_t)num * elem, size), "array out of range");
+    };
+    array(p.instrs, p.num_instrs, sizeof(instr_t));
+    array(p.literals, p.num_literals, sizeof(double));
+    array(p.grad_slots, p.num_inputs, sizeof(int));
+    array(p.hvp_slots, p.num_hvp, sizeof(int));
+    array(p.hessian_rows, p.num_hessian, sizeof(int));
+    array(p.hessian_cols, p.num_hessian, sizeof(int));
+    array(p.hessian_slots, p.num_hessian, sizeof(int));
+    array(p.vars, p.num_vars, sizeof(program_var_t));
+
+    check(autodiff_mode_reverse == p.mode || autodiff_mode_forward == p.mode,
+      "bad mode");
+    // Every slot holds an input, a direction or a result of an 
+    // instruction, so the register file is bounded by the file size.
+    check(p.num_inputs >= 1 && p.num_inputs <= p.num_slots &&
+      p.num_slots <= 2 * ((int64_t)p.num_inputs + p.num_instrs),
+      "bad slot count");
+    check(p.num_forward >= 0 && p.num_forward <= p.num_instrs,
+      "bad forward count");
+    check(0 == p.num_hvp || (p.num_hvp == p.num_inputs &&
+      p.direction_slot >= 0 && p.direction_slot <= p.num_slots -
+      p.num_inputs), "bad direction");
+
+    const char* base = (const char*)&p;
+    auto slot = [&](int s) { return s >= 0 && s < p.num_slots; };
+    auto slots = [&](uint32_t offset, int num) {
+      const int* s = (const int*)(base + offset);
+      return std::all_of(s, s + num, slot);
+    };
+    check(slot(p.value_slot) && slots(p.grad_slots, p.num_inputs) &&
+      slots(p.hvp_slots, p.num_hvp) &&
+      slots(p.hessian_slots, p.num_hessian), "output out of range");
+
+    const instr_t* instrs = (const instr_t*)(base + p.instrs);
+    for(int j = 0; j < p.num_instrs; ++j) {
+      const instr_t& instr = instrs[j];
+      bool literal = autodiff_program_t::op_literal == instr.op;
+      check(instr.op <= max_op && slot(instr.dest) &&
+        (literal ? instr.a >= 0 && instr.a < p.num_literals :
+          slot(instr.a)) &&
+        (has_b(instr.op) ? slot(instr.b) : -1 == instr.b),
+        "instruction out of range");
+    }
+
+    const program_var_t* vars = (const program_var_t*)(base + p.vars);
+    for(int j = 0; j < p.num_vars; ++j)
+      check(vars[j].dim >= 0 &&
+        in_range(vars[j].name_offset, vars[j].name_size, size),
+        "var out of range");
+  }
+}
+
+END_APEX_NAMESPACE
@@ -0,0 +1,981 @@
+#include <apex/autodiff_program.hxx>
+#include <apex/autodiff_ir.hxx>
+#include <sstream>
+#include <cstring>
+#include <cmath>
+
+BEGIN_APEX_NAMESPACE
+
+typedef autodiff_program_t::op_t op_t;
+
+// Fused instructions write a second result to slot b, rather than reading it.
+static bool is_fused(op_t op) {
+  return autodiff_program_t::op_sincos == op || 
+    autodiff_program_t::op_sinhcosh == op;
+}
+
+// Maps IR nodes to slots, for each vector component they're lowered for.
+// Nodes are numbered densely, so component 0, which every scalar node uses,
+// is a flat array. The other components of vector nodes are hashed.
+struct node_map_t {
+  void reset(int count) {
+    slots.assign(count, -1);
+    keys.clear();
+    components.clear();
+    component_slots.clear();
+    index = hash_index_t();
+  }
+
+  int find(int id, int k = 0) const {
+    if(!k)
+      return slots[id];
+    auto eq = [&](int i) { return keys[i] == id && components[i] == k; };
+    int i = index.find(hash(id, k), eq);
+    return -1 != i ? component_slots[i] : -1;
+  }
+
+  void insert(int id, int slot, int k = 0) {
+    if(!k) {
+      slots[id] = slot;
+      return;
+    }
+    index.insert(hash(id, k), keys.size());
+    keys.push_back(id);
+    components.push_back(k);
+    component_slots.push_back(slot);
+  }
+
+  static uint64_t hash(int id, int k) {
+    return hash_combine(hash_mix(id), k);
+  }
+
+  std::vector<int> slots;
+  std::vector<int> keys;
+  std::vector<int> components;
+  std::vector<int> component_slots;
+  hash_index_t index;
+};
+
+struct program_builder_t : autodiff_program_t {
+  void build(const autodiff_ir_t& ir);
+  void build_reverse();
+  void build_forward();
+  void build_hvp();
+  void build_hessian();
+  void lower_tangents(std::vector<char> needed);
+  void allocate();
+
+  int lower(int node, int k = 0);
+  int lower_literal(double x);
+  int lower_fused(op_t op, int a);
+  int find_literal(double x) const;
+  int fold(op_t op, int a, int b);
+  int emit(op_t op, int a, int b = -1);
+
+  // The tape being lowered.
+  const autodiff_ir_t* ir = nullptr;
+
+  struct grad_range_t {
+    const autodiff_ir_t::grad_t* first;
+    const autodiff_ir_t::grad_t* last;
+    const autodiff_ir_t::grad_t* begin() const { return first; }
+    const autodiff_ir_t::grad_t* end() const { return last; }
+  };
+  grad_range_t item_grads(int i) const {
+    const autodiff_ir_t::grad_t* grads = ir->grads.data();
+    return { grads + ir->grad_offsets[i], grads + ir->grad_offsets[i + 1] };
+  }
+
+  // Vector tape items are unrolled into one slot per component. The slots of
+  // item i start at tape_slots[offsets[i]]. The tape keeps them as single
+  // items, so only the program grows with the dimension. Instructions stay
+  // scalar because the batch evaluator already fills its vector lanes with
+  // points, and because the liveness pass and the literal folding work a
+  // component at a time.
+  int item_dim(int i) const { return std::max(1, dims[i]); }
+  int tape_slot(int i, int k) const { 
+    return tape_slots[offsets[i] + (dims[i] ? k : 0)]; 
+  }
+
+  // The slot holding each tape item's value, and in forward mode, the slot
+  // holding its tangent in the current seed direction.
+  std::vector<int> dims;
+  std::vector<int> offsets;
+  std::vector<int> tape_slots;
+  std::vector<int> tangent_slots;
+
+  // Nodes that have already been lowered. Nodes that refer to tangents
+  // evaluate differently in each seed direction, so they're kept apart 
+  // and cleared at the start of each direction.
+  node_map_t value_nodes;
+  node_map_t tangent_nodes;
+
+  // Nodes that refer to a tangent, and nodes that refer to a vector tape
+  // item and so evaluate once per component.
+  std::vector<char> tangent_deps;
+  std::vector<char> vector_deps;
+
+  // The first slot written by the fused sincos and sinhcosh instructions,
+  // indexed by the slot of their argument.
+  std::vector<int> sincos_slots;
+  std::vector<int> sinhcosh_slots;
+
+  // The slot loaded with each entry in the literal pool.
+  std::vector<int> literal_slots;
+  hash_index_t literal_index;
+};
+
+int program_builder_t::emit(op_t op, int a, int b) {
+  int dest = num_slots++;
+  instrs.push_back({ op, dest, a, b });
+  return dest;
+}
+
+int program_builder_t::find_literal(double x) const {
+  // Compare bits so -0 and 0 stay apart.
+  uint64_t bits;
+  memcpy(&bits, &x, sizeof(double));
+  auto eq = [&](int index) { 
+    return !memcmp(&literals[index], &x, sizeof(double)); 
+  };
+  int index = literal_index.find(hash_mix(bits), eq);
+  return -1 != index ? literal_slots[index] : -1;
+}
+
+int program_builder_t::lower_literal(double x) {
+  // Load each distinct constant once.
+  int slot = find_literal(x);
+  if(-1 == slot) {
+    uint64_t bits;
+    memcpy(&bits, &x, sizeof(double));
+    int index = literals.size();
+    literals.push_back(x);
+    slot = emit(op_literal, index);
+    literal_slots.push_back(slot);
+    literal_index.insert(hash_mix(bits), index);
+  }
+  return slot;
+}
+
+int program_builder_t::lower_fused(op_t op, int a) {
+  // sin and cos of the same slot are computed by one instruction, as are
+  // sinh and cosh. The first of the pair to be lowered emits it, with its
+  // results in consecutive slots, and the second reuses it. Slots are only
+  // written once before allocation, so the argument slot identifies the 
+  // value even across tangent directions. allocate() splits the fused 
+  // instruction back up if only one of its results is read.
+  bool trig = autodiff_program_t::op_sin == op || 
+    autodiff_program_t::op_cos == op;
+  std::vector<int>& slots = trig ? sincos_slots : sinhcosh_slots;
+  if(a >= (int)slots.size())
+    slots.resize(a + 1, -1);
+
+  if(-1 == slots[a]) {
+    int dest = num_slots;
+    num_slots += 2;
+    instrs.push_back({ trig ? autodiff_program_t::op_sincos : 
+      autodiff_program_t::op_sinhcosh, dest, a, dest + 1 });
+    slots[a] = dest;
+  }
+  bool first = autodiff_program_t::op_sin == op || 
+    autodiff_program_t::op_sinh == op;
+  return first ? slots[a] : slots[a] + 1;
+}
+
+int program_builder_t::fold(op_t op, int a, int b) {
+  // Tangents of inputs outside the seed direction are exactly zero, and
+  // the seed itself is one. Skip the arithmetic those make trivial, so each
+  // direction only evaluates the part of the tape that depends on its seed.
+  int zero = find_literal(0);
+  int one = find_literal(1);
+  switch(op) {
+    case autodiff_program_t::op_neg:
+      if(zero == a) return zero;
+      break;
+
+    case autodiff_program_t::op_add:
+      if(zero == a) return b;
+      if(zero == b) return a;
+      break;
+
+    case autodiff_program_t::op_sub:
+      if(zero == b) return a;
+      if(zero == a) return fold(autodiff_program_t::op_neg, b, -1);
+      break;
+
+    case autodiff_program_t::op_mul:
+      if(zero == a || zero == b) return zero;
+      if(one == a) return b;
+      if(one == b) return a;
+      break;
+
+    case autodiff_program_t::op_div:
+      if(zero == a) return zero;
+      if(one == b) return a;
+      break;
+
+    default:
+      break;
+  }
+  return -1;
+}
+
+// The interpreter opcode of each arithmetic IR opcode.
+static op_t program_op(autodiff_ir_t::op_t op) {
+  switch(op) {
+    case autodiff_ir_t::op_neg:  return autodiff_program_t::op_neg;
+    case autodiff_ir_t::op_add:  return autodiff_program_t::op_add;
+    case autodiff_ir_t::op_sub:  return autodiff_program_t::op_sub;
+    case autodiff_ir_t::op_mul:  return autodiff_program_t::op_mul;
+    case autodiff_ir_t::op_div:  return autodiff_program_t::op_div;
+    case autodiff_ir_t::op_sq:   return autodiff_program_t::op_sq;
+    case autodiff_ir_t::op_sqrt: return autodiff_program_t::op_sqrt;
+    case autodiff_ir_t::op_exp:  return autodiff_program_t::op_exp;
+    case autodiff_ir_t::op_log:  return autodiff_program_t::op_log;
+    case autodiff_ir_t::op_sin:  return autodiff_program_t::op_sin;
+    case autodiff_ir_t::op_cos:  return autodiff_program_t::op_cos;
+    case autodiff_ir_t::op_tan:  return autodiff_program_t::op_tan;
+    case autodiff_ir_t::op_sinh: return autodiff_program_t::op_sinh;
+    case autodiff_ir_t::op_cosh: return autodiff_program_t::op_cosh;
+    case autodiff_ir_t::op_tanh: return autodiff_program_t::op_tanh;
+    case autodiff_ir_t::op_abs:  return autodiff_program_t::op_abs;
+    case autodiff_ir_t::op_pow:  return autodiff_program_t::op_pow;
+    default:
+      throw ad_exeption_t("unsupported autodiff IR opcode");
+  }
+}
+
+int program_builder_t::lower(int node, int k) {
+  autodiff_ir_t::op_t ir_op = ir->ops[node];
+  int ir_a = ir->a[node];
+  int ir_b = ir->b[node];
+  switch(ir_op) {
+    case autodiff_ir_t::op_tape:
+      return tape_slot(ir_a, k);
+
+    case autodiff_ir_t::op_component:
+      return tape_slots[offsets[ir_a] + ir_b];
+
+    case autodiff_ir_t::op_tangent:
+      return tangent_slots[ir_a];
+
+    default:
+      break;
+  }
+
+  // Scalar nodes are the same in every component.
+  if(!vector_deps[node])
+    k = 0;
+
+  bool tangent = tangent_deps[node];
+  node_map_t& nodes = tangent ? tangent_nodes : value_nodes;
+  int slot = nodes.find(node, k);
+  if(-1 != slot)
+    return slot;
+
+  if(autodiff_ir_t::op_literal == ir_op) {
+    slot = lower_literal(ir->literals[ir_a]);
+
+  } else {
+    op_t op = program_op(ir_op);
+    int a = -1, b = -1;
+    if(tangent && (op_mul == op || op_div == op)) {
+      // If the tangent operand is zero, so is the product. Don't evaluate
+      // the other operand.
+      int zero = find_literal(0);
+      if(tangent_deps[ir_a] && zero == (a = lower(ir_a, k)))
+        slot = zero;
+      else if(op_mul == op && tangent_deps[ir_b] && 
+        zero == (b = lower(ir_b, k)))
+        slot = zero;
+    }
+    if(-1 == slot) {
+      if(-1 == a) a = lower(ir_a, k);
+      if(-1 == b && -1 != ir_b) b = lower(ir_b, k);
+      switch(op) {
+        case autodiff_program_t::op_sin:
+        case autodiff_program_t::op_cos:
+        case autodiff_program_t::op_sinh:
+        case autodiff_program_t::op_cosh:
+          slot = lower_fused(op, a);
+          break;
+
+        default:
+          if(tangent) slot = fold(op, a, b);
+          if(-1 == slot) slot = emit(op, a, b);
+          break;
+      }
+    }
+  }
+
+  nodes.insert(node, slot, k);
+  return slot;
+}
+
+void program_builder_t::build(const autodiff_ir_t& ir) {
+  this->ir = &ir;
+  vars = ir.vars;
+  mode = ir.mode;
+  stats.tape_length = ir.items.size();
+  int num_vars = vars.size();
+  int count = ir.items.size();
+
+  dims.resize(count);
+  offsets.resize(count);
+  int num_components = 0;
+  for(int i = 0; i < count; ++i) {
+    dims[i] = ir.items[i].dim;
+    offsets[i] = num_components;
+    num_components += item_dim(i);
+  }
+  tape_slots.resize(num_components);
+
+  // Operands precede their users, so one forward scan finds the nodes that
+  // depend on a tangent or on a vector tape item.
+  int num_nodes = ir.size();
+  tangent_deps.resize(num_nodes);
+  vector_deps.resize(num_nodes);
+  for(int i = 0; i < num_nodes; ++i) {
+    int a = ir.a[i], b = ir.b[i];
+    switch(ir.ops[i]) {
+      case autodiff_ir_t::op_tape:
+        vector_deps[i] = 0 != dims[a];
+        break;
+
+      case autodiff_ir_t::op_tangent:
+        tangent_deps[i] = 1;
+        break;
+
+      case autodiff_ir_t::op_component:
+      case autodiff_ir_t::op_literal:
+        break;
+
+      default:
+        tangent_deps[i] = tangent_deps[a] || (-1 != b && tangent_deps[b]);
+        vector_deps[i] = vector_deps[a] || (-1 != b && vector_deps[b]);
+        break;
+    }
+  }
+  value_nodes.reset(num_nodes);
+  tangent_nodes.reset(num_nodes);
+
+  // The components of the inputs occupy the first slots. A formula may have
+  // no inputs.
+  num_inputs = 0;
+  for(int i = 0; i < num_vars; ++i)
+    num_inputs += item_dim(i);
+  num_slots = num_inputs;
+  for(int i = 0; i < num_inputs; ++i)
+    tape_slots[i] = i;
+
+  // The forward pass. Lower each tape item's value into the slots that later
+  // references load from, one per component. Reductions sum their value over
+  // the components of their operand. Second-order tapes hold the gradient
+  // items after the root, so those are lowered after the value.
+  int root = ir.root;
+  for(int i = num_vars; i < count; ++i) {
+    const autodiff_ir_t::item_t& item = ir.items[i];
+    if(item.reduce) {
+      int slot = lower(item.val, 0);
+      for(int k = 1; k < item.reduce; ++k)
+        slot = emit(op_add, slot, lower(item.val, k));
+      tape_slots[offsets[i]] = slot;
+
+    } else {
+      for(int k = 0; k < item_dim(i); ++k)
+        tape_slots[offsets[i] + k] = lower(item.val, k);
+    }
+    if(i == root)
+      num_forward = instrs.size();
+  }
+  value_slot = tape_slots[offsets[root]];
+
+  grad_slots.resize(num_inputs);
+  if(2 == ir.order) {
+    for(int i = 0; i < num_inputs; ++i)
+      grad_slots[i] = tape_slots[offsets[ir.grad_items[i]]];
+
+  } else if(autodiff_mode_forward == mode)
+    build_forward();
+  else
+    build_reverse();
+}
+
+void program_builder_t::build_reverse() {
+  // The reverse sweep. Adjoint slots are allocated on their first write,
+  // which stores rather than accumulates, so the register file never needs
+  // to be cleared. Items whose adjoint is never written contribute nothing.
+  // Vector items have one adjoint per component.
+  int num_vars = vars.size();
+  int count = ir->items.size();
+  std::vector<int> adjoints(tape_slots.size(), -1);
+  adjoints[offsets[count - 1]] = lower_literal(1);
+
+  // Products with one, like the root's adjoint or the coefficients of
+  // sums, aren't multiplied out. An adjoint that starts out as a copy of 
+  // another slot doesn't own it, so its first accumulation moves it to a
+  // new slot.
+  int one = find_literal(1);
+  std::vector<char> owned(tape_slots.size());
+  auto accumulate = [&](int& adjoint, int parent, int coef) {
+    if(-1 == parent)
+      return;
+    int index = &adjoint - adjoints.data();
+    int unit = -1;
+    if(one == coef) unit = parent;
+    else if(one == parent) unit = coef;
+
+    if(-1 == adjoint) {
+      adjoint = (-1 != unit) ? unit : emit(op_mul, parent, coef);
+      owned[index] = -1 == unit;
+
+    } else if(!owned[index]) {
+      int term = (-1 != unit) ? unit : emit(op_mul, parent, coef);
+      adjoint = emit(op_add, adjoint, term);
+      owned[index] = 1;
+
+    } else if(-1 != unit)
+      instrs.push_back({ op_add, adjoint, adjoint, unit });
+    else
+      instrs.push_back({ op_accum, adjoint, parent, coef });
+  };
+
+  for(int i = count - 1; i >= num_vars; --i) {
+    int* adj_p = adjoints.data() + offsets[i];
+    if(std::all_of(adj_p, adj_p + item_dim(i), [](int a) { return -1 == a; }))
+      continue;
+
+    const autodiff_ir_t::item_t& item = ir->items[i];
+    for(const auto& g : item_grads(i)) {
+      int* adj_c = adjoints.data() + offsets[g.index];
+      int dim_c = dims[g.index];
+      if(-1 != g.component) {
+        // A component access only feeds that component.
+        accumulate(adj_c[g.component], adj_p[0], lower(g.coef));
+
+      } else if(item.reduce) {
+        // Each component of a reduction's operand gets the scalar adjoint.
+        for(int k = 0; k < dim_c; ++k)
+          accumulate(adj_c[k], adj_p[0], lower(g.coef, k));
+
+      } else {
+        // Element-wise operations pair up components. A scalar operand is
+        // broadcast, so it accumulates the adjoints of every component.
+        int dim = std::max(1, std::max(dims[i], dim_c));
+        for(int k = 0; k < dim; ++k) {
+          int pk = dims[i] ? k : 0;
+          int ck = dim_c ? k : 0;
+          accumulate(adj_c[ck], adj_p[pk], lower(g.coef, k));
+        }
+      }
+    }
+  }
+
+  // Inputs the value doesn't depend on have a zero partial derivative.
+  for(int i = 0; i < num_inputs; ++i) {
+    if(-1 == adjoints[i])
+      adjoints[i] = lower_literal(0);
+    grad_slots[i] = adjoints[i];
+  }
+}
+
+void program_builder_t::build_forward() {
+  // One tangent pass per input. Seed that input's tangent with one and the
+  // others with zero, then evaluate every item's tangent expression. The
+  // tangent of the root is the partial derivative for the seeded input.
+  int num_vars = vars.size();
+  int count = ir->items.size();
+  int zero = lower_literal(0);
+  int one = lower_literal(1);
+  tangent_slots.resize(count);
+  for(int k = 0; k < num_vars; ++k) {
+    tangent_nodes.reset(ir->size());
+    for(int i = 0; i < num_vars; ++i)
+      tangent_slots[i] = (i == k) ? one : zero;
+    for(int i = num_vars; i < count; ++i)
+      tangent_slots[i] = lower(ir->items[i].tangent);
+    grad_slots[k] = tangent_slots[count - 1];
+  }
+}
+
+void program_builder_t::lower_tangents(std::vector<char> needed) {
+
+  // Lower the tangents of the needed items and the items they depend on.
+  // The caller seeds the tangents of the inputs.
+  int num_vars = vars.size();
+  int count = ir->items.size();
+  for(int i = count - 1; i >= num_vars; --i) {
+    if(needed[i]) {
+      for(const auto& g : item_grads(i))
+        needed[g.index] = 1;
+    }
+  }
+
+  tangent_nodes.reset(ir->size());
+  tangent_slots.resize(count);
+  for(int i = num_vars; i < count; ++i) {
+    if(needed[i])
+      tangent_slots[i] = lower(ir->items[i].tangent);
+  }
+}
+
+void program_builder_t::build_hvp() {
+  // One tangent pass over the gradient items, seeded with the direction.
+  int num_vars = vars.size();
+  direction_slot = num_slots;
+  num_slots += num_vars;
+  tangent_slots.resize(ir->items.size());
+  for(int i = 0; i < num_vars; ++i)
+    tangent_slots[i] = direction_slot + i;
+
+  std::vector<char> needed(ir->items.size());
+  for(int item : ir->grad_items)
+    needed[item] = 1;
+  lower_tangents(std::move(needed));
+
+  hvp_slots.resize(num_vars);
+  for(int i = 0; i < num_vars; ++i)
+    hvp_slots[i] = tangent_slots[ir->grad_items[i]];
+}
+
+void program_builder_t::build_hessian() {
+  int num_vars = vars.size();
+  int count = ir->items.size();
+
+  // Find the inputs each item depends on. Row r of the Hessian can only be
+  // nonzero in the columns of the inputs that gradient item r depends on.
+  int words = (num_vars + 63) / 64;
+  std::vector<uint64_t> deps(count * words);
+  for(int i = 0; i < num_vars; ++i)
+    deps[i * words + i / 64] |= 1ull<< (i % 64);
+  for(int i = num_vars; i < count; ++i) {
+    for(const auto& g : item_grads(i)) {
+      for(int w = 0; w < words; ++w)
+        deps[i * words + w] |= deps[g.index * words + w];
+    }
+  }
+  auto nonzero = [&](int r, int k) {
+    int item = ir->grad_items[r];
+    return 0 != (deps[item * words + k / 64] & (1ull<< (k % 64)));
+  };
+
+  std::vector<std::vector<int> > cols(num_vars);
+  for(int r = 0; r < num_vars; ++r) {
+    for(int k = 0; k < num_vars; ++k) {
+      if(nonzero(r, k))
+        cols[k].push_back(r);
+    }
+  }
+
+  // Color the columns so that no row has two nonzeros of the same color. 
+  // Seeding all the inputs of one color at once gives a tangent for each 
+  // row that is the sum of its entries in those columns, and only one of
+  // those is nonzero. Each color costs one tangent pass.
+  std::vector<int> colors(num_vars);
+  std::vector<std::vector<int> > row_colors(num_vars);
+  std::vector<int> forbidden;
+  for(int k = 0; k < num_vars; ++k) {
+    forbidden.assign(num_vars + 1, 0);
+    for(int r : cols[k]) {
+      for(int c : row_colors[r])
+        forbidden[c] = 1;
+    }
+    int color = std::find(forbidden.begin(), forbidden.end(), 0) - 
+      forbidden.begin();
+    colors[k] = color;
+    num_colors = std::max(num_colors, color + 1);
+    for(int r : cols[k])
+      row_colors[r].push_back(color);
+  }
+
+  // One tangent pass per color. By symmetry, only rows on or below the
+  // diagonal of a seeded column are needed.
+  struct entry_t {
+    int row, col, slot;
+  };
+  std::vector<entry_t> entries;
+  int zero = lower_literal(0);
+  int one = lower_literal(1);
+  tangent_slots.resize(count);
+  for(int c = 0; c < num_colors; ++c) {
+    std::vector<char> needed(count);
+    bool any = false;
+    for(int k = 0; k < num_vars; ++k) {
+      tangent_slots[k] = (c == colors[k]) ? one : zero;
+      if(c == colors[k]) {
+        for(int r : cols[k]) {
+          if(r >= k) {
+            needed[ir->grad_items[r]] = 1;
+            any = true;
+          }
+        }
+      }
+    }
+    if(!any)
+      continue;
+
+    lower_tangents(std::move(needed));
+    for(int k = 0; k < num_vars; ++k) {
+      if(c == colors[k]) {
+        for(int r : cols[k]) {
+          if(r >= k)
+            entries.push_back({ r, k, 
+              tangent_slots[ir->grad_items[r]] });
+        }
+      }
+    }
+  }
+
+  std::sort(entries.begin(), entries.end(), 
+    [](const entry_t& a, const entry_t& b) {
+      return a.row < b.row || (a.row == b.row && a.col < b.col);
+    });
+  for(const entry_t& entry : entries) {
+    hessian_rows.push_back(entry.row);
+    hessian_cols.push_back(entry.col);
+    hessian_slots.push_back(entry.slot);
+  }
+}
+
+void program_builder_t::allocate() {
+  // Every slot but the outputs must be dead by the end of the program.
+  std::vector<int*> outputs { &value_slot };
+  for(std::vector<int>* slots : { &grad_slots, &hvp_slots, &hessian_slots }) {
+    for(int& slot : *slots)
+      outputs.push_back(&slot);
+  }
+
+  // Remove instructions whose results are never read. op_literal reads a 
+  // literal, not a slot, and op_accum reads its destination. Fused 
+  // instructions with only one result read go back to the single function.
+  const int end = instrs.size();
+  std::vector<char> live(num_slots);
+  for(int* slot : outputs)
+    live[*slot] = 1;
+
+  std::vector<char> keep(end);
+  for(int i = end - 1; i >= 0; --i) {
+    instr_t& instr = instrs[i];
+    if(is_fused(instr.op)) {
+      bool trig = op_sincos == instr.op;
+      if(!live[instr.b]) {
+        instr.op = trig ? op_sin : op_sinh;
+        instr.b = -1;
+      } else if(!live[instr.dest]) {
+        instr.op = trig ? op_cos : op_cosh;
+        instr.dest = instr.b;
+        instr.b = -1;
+      }
+    }
+
+    if(!live[instr.dest])
+      continue;
+    keep[i] = 1;
+    if(op_literal != instr.op) live[instr.a] = 1;
+    if(-1 != instr.b && !is_fused(instr.op)) live[instr.b] = 1;
+  }
+
+  int count = 0, forward = 0;
+  for(int i = 0; i < end; ++i) {
+    if(keep[i])
+      instrs[count++] = instrs[i];
+    if(i + 1 == num_forward)
+      forward = count;
+  }
+  stats.dead_instrs = end - count;
+  instrs.resize(count);
+  num_forward = forward;
+
+  // Find the last read of each slot. Outputs stay live to the end.
+  std::vector<int> last_use(num_slots, -1);
+  for(int i = 0; i < count; ++i) {
+    const instr_t& instr = instrs[i];
+    if(op_literal != instr.op) last_use[instr.a] = i;
+    if(-1 != instr.b && !is_fused(instr.op)) last_use[instr.b] = i;
+    if(op_accum == instr.op) last_use[instr.dest] = i;
+  }
+  for(int* slot : outputs)
+    last_use[*slot] = count;
+
+  // Inputs and the direction keep their positions. Walk the instructions
+  // in order, releasing each operand after its last read and giving the 
+  // destination the most recently released slot, which is likely still in
+  // cache. An operand's slot may be reused as the destination of the same
+  // instruction, because every kernel reads its operands before writing.
+  std::vector<int> phys(num_slots, -1);
+  int peak = num_inputs;
+  for(int i = 0; i < num_inputs; ++i)
+    phys[i] = i;
+  if(-1 != direction_slot) {
+    for(int i = 0; i < num_inputs; ++i)
+      phys[direction_slot + i] = peak++;
+    direction_slot = num_inputs;
+  }
+
+  std::vector<int> free_slots;
+  auto release = [&](int slot, int i) {
+    if(last_use[slot] == i) {
+      free_slots.push_back(phys[slot]);
+      last_use[slot] = -1;
+    }
+  };
+  auto define = [&](int slot) {
+    if(-1 == phys[slot]) {
+      if(free_slots.size()) {
+        phys[slot] = free_slots.back();
+        free_slots.pop_back();
+      } else
+        phys[slot] = peak++;
+    }
+    return phys[slot];
+  };
+  for(int i = 0; i < count; ++i) {
+    instr_t& instr = instrs[i];
+    bool fused = is_fused(instr.op);
+    if(op_literal != instr.op) {
+      int a = instr.a;
+      instr.a = phys[a];
+      release(a, i);
+    }
+    if(-1 != instr.b && !fused) {
+      int b = instr.b;
+      instr.b = phys[b];
+      release(b, i);
+    }
+
+    int dest = instr.dest;
+    instr.dest = define(dest);
+    if(fused)
+      instr.b = define(instr.b);
+    release(dest, i);
+  }
+
+  for(int* slot : outputs)
+    *slot = phys[*slot];
+  stats.virtual_slots = num_slots;
+  stats.peak_slots = peak;
+  num_slots = peak;
+}
+
+autodiff_program_view_t::autodiff_program_view_t(
+  const autodiff_program_t& program) :
+  mode(program.mode), instrs(program.instrs.data()),
+  num_instrs(program.instrs.size()), literals(program.literals.data()),
+  num_literals(program.literals.size()), num_slots(program.num_slots),
+  num_inputs(program.num_inputs), num_forward(program.num_forward),
+  value_slot(program.value_slot), grad_slots(program.grad_slots.data()),
+  direction_slot(program.direction_slot), 
+  hvp_slots(program.hvp_slots.size() ? program.hvp_slots.data() : nullptr),
+  num_hessian(program.hessian_slots.size()), 
+  hessian_rows(program.hessian_rows.data()),
+  hessian_cols(program.hessian_cols.data()),
+  hessian_slots(program.hessian_slots.data()), 
+  num_colors(program.num_colors) { }
+
+autodiff_program_t make_autodiff_program(const autodiff_ir_t& ir) {
+  program_builder_t builder;
+  builder.build(ir);
+  builder.allocate();
+  return std::move(builder);
+}
+
+autodiff_program_t make_hvp_program(const autodiff_ir_t& ir) {
+  if(2 != ir.order)
+    throw ad_exeption_t("Hessian-vector products need a second-order tape");
+
+  program_builder_t builder;
+  builder.build(ir);
+  builder.build_hvp();
+  builder.allocate();
+  return std::move(builder);
+}
+
+autodiff_program_t make_hessian_program(const autodiff_ir_t& ir) {
+  if(2 != ir.order)
+    throw ad_exeption_t("Hessians need a second-order tape");
+
+  program_builder_t builder;
+  builder.build(ir);
+  builder.build_hessian();
+  builder.allocate();
+  return std::move(builder);
+}
+
+autodiff_program_t make_autodiff_program(const autodiff_t& autodiff) {
+  return make_autodiff_program(make_autodiff_ir(autodiff));
+}
+
+autodiff_program_t make_hvp_program(const autodiff_t& autodiff) {
+  return make_hvp_program(make_autodiff_ir(autodiff));
+}
+
+autodiff_program_t make_hessian_program(const autodiff_t& autodiff) {
+  return make_hessian_program(make_autodiff_ir(autodiff));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// sinh and cosh from a single exponential. sinh x = (u + u / (u + 1)) / 2
+// with u = expm1 |x| keeps full precision near zero. Past 700, the 
+// exponential overflows before sinh and cosh do, so it's split in two.
+static void sinhcosh(double x, double& sinh_x, double& cosh_x) {
+  double ax = std::abs(x);
+  double s, c;
+  if(ax < 700) {
+    double u = std::expm1(ax);
+    double e = u + 1;
+    s = .5 * (u + u / e);
+    c = .5 * (e + 1 / e);
+  } else {
+    double h = std::exp(.5 * ax);
+    s = c = (.5 * h) * h;
+  }
+  sinh_x = std::copysign(s, x);
+  cosh_x = c;
+}
+
+static void eval_instrs(const autodiff_program_view_t& program, int count,
+  double* r) {
+
+  const double* literals = program.literals;
+  const autodiff_program_t::instr_t* instrs = program.instrs;
+  for(int i = 0; i < count; ++i) {
+    auto instr = instrs[i];
+    double a = r[instr.a];
+    double& dest = r[instr.dest];
+    switch(instr.op) {
+      case autodiff_program_t::op_literal: dest = literals[instr.a]; break;
+      case autodiff_program_t::op_neg:     dest = -a; break;
+      case autodiff_program_t::op_add:     dest = a + r[instr.b]; break;
+      case autodiff_program_t::op_sub:     dest = a - r[instr.b]; break;
+      case autodiff_program_t::op_mul:     dest = a * r[instr.b]; break;
+      case autodiff_program_t::op_div:     dest = a / r[instr.b]; break;
+      case autodiff_program_t::op_accum:   dest += a * r[instr.b]; break;
+      case autodiff_program_t::op_sq:      dest = a * a; break;
+      case autodiff_program_t::op_sqrt:    dest = std::sqrt(a); break;
+      case autodiff_program_t::op_exp:     dest = std::exp(a); break;
+      case autodiff_program_t::op_log:     dest = std::log(a); break;
+      case autodiff_program_t::op_sin:     dest = std::sin(a); break;
+      case autodiff_program_t::op_cos:     dest = std::cos(a); break;
+      case autodiff_program_t::op_tan:     dest = std::tan(a); break;
+      case autodiff_program_t::op_sinh:    dest = std::sinh(a); break;
+      case autodiff_program_t::op_cosh:    dest = std::cosh(a); break;
+      case autodiff_program_t::op_tanh:    dest = std::tanh(a); break;
+      case autodiff_program_t::op_abs:     dest = std::abs(a); break;
+      case autodiff_program_t::op_pow:     dest = std::pow(a, r[instr.b]); break;
+      case autodiff_program_t::op_sincos:  
+        ::sincos(a, &dest, &r[instr.b]); 
+        break;
+      case autodiff_program_t::op_sinhcosh: 
+        sinhcosh(a, dest, r[instr.b]);
+        break;
+    }
+  }
+}
+
+double autodiff_eval(const autodiff_program_view_t& program, 
+  const double* inputs, double* grad, double* scratch) {
+
+  double* r = scratch;
+  int num_inputs = program.num_inputs;
+  for(int i = 0; i < num_inputs; ++i)
+    r[i] = inputs[i];
+
+  eval_instrs(program, grad ? program.num_instrs : program.num_forward, r);
+
+  if(grad) {
+    for(int i = 0; i < num_inputs; ++i)
+      grad[i] = r[program.grad_slots[i]];
+  }
+  return r[program.value_slot];
+}
+
+double autodiff_eval_hvp(const autodiff_program_view_t& program, 
+  const double* inputs, const double* direction, double* grad, double* hvp,
+  double* scratch) {
+
+  double* r = scratch;
+  int num_inputs = program.num_inputs;
+  for(int i = 0; i < num_inputs; ++i) {
+    r[i] = inputs[i];
+    r[program.direction_slot + i] = direction[i];
+  }
+
+  eval_instrs(program, program.num_instrs, r);
+
+  for(int i = 0; i < num_inputs; ++i) {
+    grad[i] = r[program.grad_slots[i]];
+    hvp[i] = r[program.hvp_slots[i]];
+  }
+  return r[program.value_slot];
+}
+
+double autodiff_eval_hessian(const autodiff_program_view_t& program,
+  const double* inputs, double* grad, double* hessian, double* scratch) {
+
+  double* r = scratch;
+  int num_inputs = program.num_inputs;
+  for(int i = 0; i < num_inputs; ++i)
+    r[i] = inputs[i];
+
+  eval_instrs(program, program.num_instrs, r);
+
+  for(int i = 0; i < num_inputs; ++i)
+    grad[i] = r[program.grad_slots[i]];
+  for(int i = 0; i < program.num_hessian; ++i)
+    hessian[i] = r[program.hessian_slots[i]];
+  return r[program.value_slot];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static const char* op_names[] {
+  "literal", "neg", "add", "sub", "mul", "div", "accum", "sq", "sqrt", "exp",
+  "log", "sin", "cos", "tan", "sinh", "cosh", "tanh", "abs", "pow", "sincos",
+  "sinhcosh"
+};
+
+std::string print_autodiff_program(const autodiff_program_t& program) {
+  std::ostringstream oss;
+  for(int i = 0; i < (int)program.instrs.size(); ++i) {
+    if(i == program.num_forward)
+      oss<< (autodiff_mode_forward == program.mode ? "tangents:\n" : 
+        "reverse:\n");
+
+    const auto& instr = program.instrs[i];
+    oss<< "  r"<< instr.dest;
+    if(is_fused(instr.op))
+      oss<< ", r"<< instr.b;
+    oss<< " = "<< op_names[instr.op];
+    if(autodiff_program_t::op_literal == instr.op)
+      oss<< " "<< program.literals[instr.a];
+    else
+      oss<< " r"<< instr.a;
+    if(-1 != instr.b && !is_fused(instr.op))
+      oss<< " r"<< instr.b;
+    oss<< "\n";
+  }
+
+  oss<< "value = r"<< program.value_slot<< "\n";
+  int input = 0;
+  for(const autodiff_var_t& var : program.vars) {
+    if(!var.dim) {
+      oss<< "grad "<< var.name<< " = r"<< program.grad_slots[input]<< "\n";
+      if(program.hvp_slots.size())
+        oss<< "hvp "<< var.name<< " = r"<< program.hvp_slots[input]<< "\n";
+      ++input;
+
+    } else {
+      for(int k = 0; k < var.dim; ++k)
+        oss<< "grad "<< var.name<< "["<< k<< "] = r"<< 
+          program.grad_slots[input++]<< "\n";
+    }
+  }
+  for(size_t i = 0; i < program.hessian_slots.size(); ++i)
+    oss<< "hessian "<< program.vars[program.hessian_rows[i]].name<< " "<<
+      program.vars[program.hessian_cols[i]].name<< " = r"<< 
+      program.hessian_slots[i]<< "\n";
+  return oss.str();
+}
+
+END_APEX_NAMESPACE
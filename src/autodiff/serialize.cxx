@@ -0,0 +1,235 @@
+#include <apex/autodiff_ir.hxx>
+#include <cstring>
+
+BEGIN_APEX_NAMESPACE
+
+// Tapes are written as the arrays of their flat IR (see autodiff_ir.hxx),
+// so writing is a handful of bulk copies and reading rebuilds the ad_t
+// nodes in one forward scan. Bump the version whenever the layout or the
+// meaning of an opcode changes.
+static const char tape_magic[8] = { 'A', 'P', 'E', 'X', 'T', 'A', 'P', 'E' };
+static const int tape_format_version = 2;
+static const int tape_byte_order = 0x01020304;
+
+namespace {
+
+struct tape_writer_t {
+  void write(const void* p, size_t size) {
+    data.append((const char*)p, size);
+  }
+  void i32(int x) { write(&x, sizeof(int)); }
+  void str(const std::string& s) {
+    i32(s.size());
+    write(s.data(), s.size());
+  }
+  template<typename type_t>
+  void array(const std::vector<type_t>& v) {
+    i32(v.size());
+    write(v.data(), sizeof(type_t) * v.size());
+  }
+
+  void write_tape(const autodiff_ir_t& ir);
+
+  std::string data;
+};
+
+struct tape_reader_t {
+  void read(void* p, size_t size) {
+    if(size > (size_t)(end - cur))
+      throw ad_exeption_t("truncated tape file");
+    // Empty arrays may have null data.
+    if(size)
+      memcpy(p, cur, size);
+    cur += size;
+  }
+  int i32() { int x; read(&x, sizeof(int)); return x; }
+  std::string str() {
+    size_t size = count(1);
+    std::string s(size, ' ');
+    read(&s[0], size);
+    return s;
+  }
+  size_t count(size_t elem) {
+    int x = i32();
+    if(x < 0 || (size_t)x > (end - cur) / elem)
+      throw ad_exeption_t("corrupt tape file");
+    return x;
+  }
+  template<typename type_t>
+  void array(std::vector<type_t>& v) {
+    v.resize(count(sizeof(type_t)));
+    read(v.data(), sizeof(type_t) * v.size());
+  }
+
+  void read_tape(autodiff_ir_t& ir);
+
+  const char* cur;
+  const char* end;
+};
+
+} // namespace
+
+void tape_writer_t::write_tape(const autodiff_ir_t& ir) {
+  write(tape_magic, sizeof(tape_magic));
+  i32(tape_format_version);
+  i32(tape_byte_order);
+
+  i32(ir.vars.size());
+  for(const autodiff_var_t& var : ir.vars) {
+    str(var.name);
+    i32(var.dim);
+  }
+
+  i32(ir.mode);
+  i32(ir.root);
+  i32(ir.order);
+  array(ir.grad_items);
+
+  const autodiff_stats_t& stats = ir.stats;
+  for(int x : { stats.cse_hits, stats.cse_misses, stats.ad_nodes,
+    stats.ad_hits, stats.ad_tape_reuses })
+    i32(x);
+
+  array(ir.ops);
+  array(ir.a);
+  array(ir.b);
+  array(ir.literals);
+  array(ir.items);
+  array(ir.grad_offsets);
+  array(ir.grads);
+}
+
+void tape_reader_t::read_tape(autodiff_ir_t& ir) {
+  char magic[sizeof(tape_magic)];
+  read(magic, sizeof(magic));
+  if(memcmp(magic, tape_magic, sizeof(magic)))
+    throw ad_exeption_t("not a tape file");
+  int version = i32();
+  if(tape_format_version != version)
+    throw ad_exeption_t(format("tape file has version %d; expected %d",
+      version, tape_format_version));
+  if(tape_byte_order != i32())
+    throw ad_exeption_t("tape file has the wrong byte order");
+
+  ir.vars.resize(count(2 * sizeof(int)));
+  for(autodiff_var_t& var : ir.vars) {
+    var.name = str();
+    var.dim = i32();
+  }
+
+  ir.mode = (autodiff_mode_t)i32();
+  ir.root = i32();
+  ir.order = i32();
+  array(ir.grad_items);
+
+  autodiff_stats_t& stats = ir.stats;
+  for(int* x : { &stats.cse_hits, &stats.cse_misses, &stats.ad_nodes,
+    &stats.ad_hits, &stats.ad_tape_reuses })
+    *x = i32();
+
+  array(ir.ops);
+  array(ir.a);
+  array(ir.b);
+  array(ir.literals);
+  array(ir.items);
+  array(ir.grad_offsets);
+  array(ir.grads);
+
+  if(cur != end)
+    throw ad_exeption_t("trailing data in tape file");
+
+  // Check every index that make_autodiff and the program builder trust.
+  // Operands precede the nodes that use them, so the DAG is acyclic.
+  auto check = [](bool valid) {
+    if(!valid)
+      throw ad_exeption_t("corrupt tape file");
+  };
+  int count = ir.items.size();
+  int num_vars = ir.vars.size();
+  int num_nodes = ir.size();
+  check(num_vars <= count);
+  check(ir.root >= num_vars && ir.root < count);
+  check(autodiff_mode_reverse == ir.mode ||
+    autodiff_mode_forward == ir.mode);
+  check(num_nodes == (int)ir.a.size() && num_nodes == (int)ir.b.size());
+  check(count + 1 == (int)ir.grad_offsets.size());
+
+  int num_inputs = 0;
+  for(int i = 0; i < num_vars; ++i) {
+    check(ir.vars[i].dim == ir.items[i].dim);
+    num_inputs += std::max(1, ir.vars[i].dim);
+  }
+  check(1 == ir.order ? ir.grad_items.empty() :
+    2 == ir.order && num_inputs == (int)ir.grad_items.size());
+  for(int item : ir.grad_items)
+    check(item >= 0 && item < count);
+
+  auto item_dim = [&](int index) { return std::max(1, ir.items[index].dim); };
+  for(int i = 0; i < num_nodes; ++i) {
+    int a = ir.a[i], b = ir.b[i];
+    switch(ir.ops[i]) {
+      case autodiff_ir_t::op_tape:
+      case autodiff_ir_t::op_tangent:
+        check(a >= 0 && a < count && -1 == b);
+        break;
+
+      case autodiff_ir_t::op_component:
+        check(a >= 0 && a < count && b >= 0 && b < ir.items[a].dim);
+        break;
+
+      case autodiff_ir_t::op_literal:
+        check(a >= 0 && a < (int)ir.literals.size() && -1 == b);
+        break;
+
+      case autodiff_ir_t::op_add:
+      case autodiff_ir_t::op_sub:
+      case autodiff_ir_t::op_mul:
+      case autodiff_ir_t::op_div:
+      case autodiff_ir_t::op_pow:
+        check(a >= 0 && a < i && b >= 0 && b < i);
+        break;
+
+      default:
+        check(ir.ops[i] <= autodiff_ir_t::op_pow && a >= 0 && a < i &&
+          -1 == b);
+        break;
+    }
+  }
+
+  auto node = [&](int id, bool required) {
+    return required ? id >= 0 && id < num_nodes :
+      id >= -1 && id < num_nodes;
+  };
+  bool tangents = autodiff_mode_forward == ir.mode || 2 == ir.order;
+  int prev = 0;
+  for(int i = 0; i < count; ++i) {
+    const autodiff_ir_t::item_t& item = ir.items[i];
+    check(item.dim >= 0 && node(item.val, i >= num_vars));
+    check(node(item.tangent, i >= num_vars && tangents));
+
+    int first = ir.grad_offsets[i], last = ir.grad_offsets[i + 1];
+    check(prev == first && first <= last && last <= (int)ir.grads.size());
+    prev = last;
+    for(int g = first; g < last; ++g) {
+      const autodiff_ir_t::grad_t& grad = ir.grads[g];
+      check(grad.index >= 0 && grad.index < i && node(grad.coef, true) &&
+        grad.component >= -1 && grad.component < item_dim(grad.index));
+    }
+  }
+  check(prev == (int)ir.grads.size());
+}
+
+std::string save_autodiff(const autodiff_t& autodiff) {
+  tape_writer_t writer;
+  writer.write_tape(make_autodiff_ir(autodiff));
+  return std::move(writer.data);
+}
+
+autodiff_t load_autodiff(const char* data, size_t size) {
+  autodiff_ir_t ir;
+  tape_reader_t reader { data, data + size };
+  reader.read_tape(ir);
+  return make_autodiff(ir);
+}
+
+END_APEX_NAMESPACE
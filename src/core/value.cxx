@@ -108,6 +108,32 @@ number_t value_binary(expr_op_t op, number_t left, number_t right) {
     case expr_op_mul:
     case expr_op_div:
       // Promote to a common type.
+      if(left.is_arithmetic() && right.is_arithmetic()) {
+        if(left.is_floating() || right.is_floating()) {
+          double a = left.convert<double>();
+          double b = right.convert<double>();
+          double x = 0;
+          switch(op) {
+            case expr_op_add: x = a + b; break;
+            case expr_op_sub: x = a - b; break;
+            case expr_op_mul: x = a * b; break;
+            case expr_op_div: x = a / b; break;
+          }
+          result = number_t(x);
+
+        } else if(expr_op_div != op || right.i) {
+          // Integer division by zero can't be folded.
+          int64_t x = 0;
+          switch(op) {
+            case expr_op_add: x = left.i + right.i; break;
+            case expr_op_sub: x = left.i - right.i; break;
+            case expr_op_mul: x = left.i * right.i; break;
+            case expr_op_div: x = left.i / right.i; break;
+          }
+          result = number_t(x);
+        }
+      }
+      break;
 
     case expr_op_shl:
     case expr_op_shr:
@@ -194,7 +220,7 @@ number_t value_binary(expr_op_t op, number_t left, number_t right) {
       bool x = false;
       switch(op) {
         case expr_op_log_and: x = left.b && right.b; break;
-        case expr_op_log_or:  x = left.b && right.b; break;
+        case expr_op_log_or:  x = left.b || right.b; break;
       }
       result = number_t(x);
       break;
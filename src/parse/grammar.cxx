@@ -1,4 +1,5 @@
 #include <apex/parse.hxx>
+#include <algorithm>
 #include <stack>
 #include <cstring>
 #include <cstdarg>
@@ -66,10 +67,27 @@ const char* expr_op_names[] {
 
 namespace parse {
 
+enum ast_prec_t : uint8_t {
+  // lowest precedence.
+  ast_prec_any = 0,
+  ast_prec_comma,
+  ast_prec_assign,
+  ast_prec_log_or,
+  ast_prec_log_and,
+  ast_prec_bit_or,
+  ast_prec_bit_xor,
+  ast_prec_bit_and,
+  ast_prec_eq,
+  ast_prec_cmp,
+  ast_prec_shift,
+  ast_prec_add,
+  ast_prec_mul,
+  ast_prec_ptr_to_mem,
+  // highest precedence.
+};
+
 struct grammar_t {
-  token_it advance_brace(range_t range);
-  token_it advance_paren(range_t range);
-  token_it advance_bracket(range_t range);
+  token_it advance_group(range_t range);
 
   result_t<range_t> parse_paren(range_t range);
   result_t<range_t> parse_brace(range_t range);
@@ -92,8 +110,8 @@ struct grammar_t {
   result_t<node_list_t> paren_initializer(range_t range);
   result_t<node_ptr_t> unary_expression(range_t range, bool expect);
   result_t<node_ptr_t> binary_expression(range_t range, bool expect);
-  result_t<node_ptr_t> logical_and_expression(range_t range, bool expect);
-  result_t<node_ptr_t> logical_or_expression(range_t range, bool expect);
+  node_ptr_t binary_rhs(range_t& range, node_ptr_t lhs, source_loc_t lhs_loc,
+    ast_prec_t min_prec);
   result_t<node_ptr_t> assignment_expression(range_t range, bool expect);
 
   result_t<node_ptr_t> paren_expression(range_t range);
@@ -106,104 +124,103 @@ struct grammar_t {
   node_ptr_t make_binary(expr_op_t op, node_ptr_t a, node_ptr_t b,
     source_loc_t loc);
 
-  void throw_error(token_it pos, const char* fmt, ...);
-  void throw_error(source_loc_t loc, const char* fmt, ...);
+  // Record a diagnostic. The parser never throws: a rule that can't match
+  // what it expects records the error and returns the node from recover.
+  void error(token_it pos, diag_code_t code, const char* fmt, ...);
+  void error(source_loc_t loc, diag_code_t code, const char* fmt, ...);
+  void verror(token_it pos, diag_code_t code, const char* fmt, va_list args);
   void unexpected_token(token_it pos, const char* rule);
 
+  // Panic-mode recovery. Skip to the next ',' outside of brackets or to
+  // the end of the range, which ends at the enclosing bracket, and return
+  // an error node spanning the skipped tokens. Callers carry on as if they
+  // had parsed an expression, so every argument and bracketed group reports
+  // its own errors.
+  result_t<node_ptr_t> recover(token_it begin, range_t range);
+
   source_loc_t loc(token_it it) const;
 
+  template<typename node_type_t, typename... args_t>
+  node_type_t* make(args_t&&... args) {
+    return arena.make<node_type_t>(std::forward<args_t>(args)...);
+  }
+
   const tok::tokenizer_t& tokenizer;
+  arena_t& arena;
+  std::vector<diagnostic_t>& diagnostics;
+
+  // For each opening token, the index of the token past its closer, -1 if
+  // it has none, or closer_unknown before the group has been matched.
+  enum { closer_unknown = -2 };
+  std::vector<int> closers;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
 
-token_it grammar_t::advance_brace(range_t range) {
-  int count = 1;
-  while(token_t token = range.next()) {
-    if(tk_sym_paren_l == token)
-      range.begin = advance_paren(range);
-    else if(tk_sym_paren_r == token) 
-      throw_error(range.begin - 1, "unbalanced ')' in brace set { }");
-
-    else if(tk_sym_bracket_l == token)
-      range.begin = advance_bracket(range);
-    else if(tk_sym_bracket_r == token)
-      throw_error(range.begin - 1, "unbalanced ']' in brace set { }");
-
-    else if(tk_sym_brace_l == token)
-      ++count;
-    else if(tk_sym_brace_r == token) 
-      --count;
-
-    if(!count) break;
-  }
+token_it grammar_t::advance_group(range_t range) {
+  // Return the token past the closer matching the opener at range.begin - 1,
+  // or null if there isn't one. Groups nested inside are matched by
+  // recursion and their closers saved, so when the parser descends into
+  // them it doesn't scan them again, however deeply they nest. Closers of
+  // the other kinds that match nothing are left in place for the parser to
+  // report as unexpected tokens.
+  token_it open = range.begin - 1;
+  const token_t* tokens = tokenizer.tokens.data();
+  int& closer = closers[open - tokens];
+  if(closer_unknown != closer)
+    return -1 != closer ? tokens + closer : nullptr;
+
+  tk_kind_t close_kind = tk_none;
+  const char* msg = nullptr;
+  switch(open->kind) {
+    case tk_sym_paren_l:
+      close_kind = tk_sym_paren_r;
+      msg = "no closing ')' in paren set ( )";
+      break;
 
-  if(count)
-    throw_error(range.begin, "no closing '}' in brace set { }");
+    case tk_sym_bracket_l:
+      close_kind = tk_sym_bracket_r;
+      msg = "no closing ']' in bracket set [ ]";
+      break;
 
-  return range.begin;
-}
+    case tk_sym_brace_l:
+      close_kind = tk_sym_brace_r;
+      msg = "no closing '}' in brace set { }";
+      break;
 
-token_it grammar_t::advance_paren(range_t range) {
-  int count = 1;
-  while(token_t token = range.next()) {
-    if(tk_sym_bracket_l == token)
-      range.begin = advance_bracket(range);
-    else if(tk_sym_bracket_r == token)
-      throw_error(range.begin - 1, "unbalanced ']' in paren set ( )");
-
-    else if(tk_sym_brace_l == token)
-      range.begin = advance_brace(range);
-    else if(tk_sym_brace_r == token)
-      throw_error(range.begin - 1, "unbalanced '}' in paren set ( )");
-
-    else if(tk_sym_paren_l == token)
-      ++count;
-    else if(tk_sym_paren_r == token)
-      --count;
-
-    if(!count) break;
+    default:
+      assert(false);
+      break;
   }
 
-  if(count)
-    throw_error(range.begin, "no closing ')' in paren set ( )");
-
-  return range.begin;
-}
-
-token_it grammar_t::advance_bracket(range_t range) {
-  int count = 1;
+  token_it end = nullptr;
   while(token_t token = range.next()) {
-    if(tk_sym_brace_l == token)
-      range.begin = advance_brace(range);
-    else if(tk_sym_brace_r == token)
-      throw_error(range.begin - 1, "unbalanced '}' in bracket set [ ]");
-
-    else if(tk_sym_paren_l == token)
-      range.begin = advance_paren(range);
-    else if(tk_sym_paren_r == token) 
-      throw_error(range.begin - 1, "unbalanced ')' in bracket set [ ]");
-
-    else if(tk_sym_bracket_l == token )
-      ++count;
-    else if(tk_sym_bracket_r == token)
-      --count;
-
-    if(!count) break;
+    if(close_kind == token) {
+      end = range.begin;
+      break;
+    }
+
+    if(tk_sym_paren_l == token || tk_sym_bracket_l == token ||
+      tk_sym_brace_l == token) {
+      token_it end2 = advance_group(range);
+      range.begin = end2 ? end2 : range.end;
+    }
   }
 
-  if(count)
-    throw_error(range.begin, "no closing ']' in bracket set [ ]");
+  if(!end)
+    error(open, diag_unclosed, msg);
 
-  return range.begin;
+  closer = end ? end - tokens : -1;
+  return end;
 }
 
 result_t<range_t> grammar_t::parse_brace(range_t range) {
   result_t<range_t> result;
   token_it begin = range.begin;
   if(range.advance_if(tk_sym_brace_l)) {
-    token_it end = advance_brace(range);
-    result = make_result(begin, end, range_t { range.begin, end - 1 });
+    token_it end = advance_group(range);
+    range_t inner { range.begin, end ? end - 1 : range.end };
+    result = make_result(begin, inner.end + !!end, inner);
   }
   return result;
 }
@@ -212,8 +229,9 @@ result_t<range_t> grammar_t::parse_paren(range_t range) {
   result_t<range_t> result;
   token_it begin = range.begin;
   if(range.advance_if(tk_sym_paren_l)) {
-    token_it end = advance_paren(range);
-    result = make_result(begin, end, range_t { range.begin, end - 1 });
+    token_it end = advance_group(range);
+    range_t inner { range.begin, end ? end - 1 : range.end };
+    result = make_result(begin, inner.end + !!end, inner);
   }
   return result;
 }
@@ -222,8 +240,9 @@ result_t<range_t> grammar_t::parse_bracket(range_t range) {
   result_t<range_t> result;
   token_it begin = range.begin;
   if(range.advance_if(tk_sym_bracket_l)) {
-    token_it end = advance_bracket(range);
-    result = make_result(begin, end, range_t { range.begin, end - 1 });
+    token_it end = advance_group(range);
+    range_t inner { range.begin, end ? end - 1 : range.end };
+    result = make_result(begin, inner.end + !!end, inner);
   }
   return result;
 }
@@ -234,48 +253,51 @@ result_t<node_ptr_t> grammar_t::entity(range_t range, bool expect) {
   result_t<node_ptr_t> result;
   token_it begin = range.begin;
   if(token_t token = range.advance_if(tk_ident)) {
-    auto ident = std::make_unique<node_ident_t>(loc(begin));
-    ident->s = tokenizer.strings[token.store];
+    auto ident = make<node_ident_t>(loc(begin));
+    ident->s = tokenizer.ident(token);
     result = make_result(begin, range.begin, std::move(ident));
 
-  } else if(expect)
-    throw_error(range.begin, "expected entity in expression");
+  } else if(expect) {
+    error(range.begin, diag_expected_expression,
+      "expected entity in expression");
+    result = recover(begin, range);
+  }
 
   return result;
 }
 
 result_t<node_ptr_t> grammar_t::literal(range_t range) {
   token_it begin = range.begin;
-  node_ptr_t node;
+  node_ptr_t node = nullptr;
   switch(token_t token = range.next()) {
     case tk_int: {
-      int64_t i = tokenizer.ints[token.store];
-      node = std::make_unique<node_number_t>(i, loc(begin));
+      int64_t i = tokenizer.int_value(token);
+      node = make<node_number_t>(i, loc(begin));
       break;
     }
 
     case tk_float: {
-      double d = tokenizer.floats[token.store];
-      node = std::make_unique<node_number_t>(d, loc(begin));
+      double d = tokenizer.float_value(token);
+      node = make<node_number_t>(d, loc(begin));
       break;
     }
 
     case tk_char:
-      node = std::make_unique<node_char_t>((char32_t)token.store, loc(begin));
+      node = make<node_char_t>(tokenizer.char_value(token), loc(begin));
       break;
 
     case tk_string: {
-      const std::string& s = tokenizer.strings[token.store];
-      node = std::make_unique<node_string_t>(s, loc(begin));
+      std::string s(tokenizer.string(token.store));
+      node = make<node_string_t>(std::move(s), loc(begin));
       break;    
     }
 
     case tk_kw_false:
-      node = std::make_unique<node_bool_t>(false, loc(begin));
+      node = make<node_bool_t>(false, loc(begin));
       break;
 
     case tk_kw_true:
-      node = std::make_unique<node_bool_t>(true, loc(begin));
+      node = make<node_bool_t>(true, loc(begin));
       break;
 
     default:
@@ -346,6 +368,18 @@ result_t<node_ptr_t> grammar_t::postfix_operator(range_t range,
 
     case tk_sym_bracket_l: {
       // Subscript operation.
+      --range.begin;
+      auto bracket = parse_bracket(range);
+      range.advance(bracket);
+
+      auto list = init_list(bracket->attr);
+      if(!list->attr.size())
+        error(begin, diag_expected_subscript, "expected subscript index");
+
+      auto subscript = make<node_subscript_t>(loc(begin));
+      subscript->lhs = node;
+      subscript->args = std::move(list->attr);
+      node = subscript;
       break;
     }
 
@@ -354,7 +388,7 @@ result_t<node_ptr_t> grammar_t::postfix_operator(range_t range,
       auto paren = paren_initializer(range);
       range.advance(paren);
 
-      auto call = std::make_unique<node_call_t>(loc(begin));
+      auto call = make<node_call_t>(loc(begin));
       call->f = std::move(node);
       call->args = std::move(paren->attr);
       node = std::move(call);
@@ -414,25 +448,6 @@ result_t<node_ptr_t> grammar_t::unary_expression(range_t range, bool expect) {
 
 ////////////////////////////////////////////////////////////////////////////////
 
-enum ast_prec_t : uint8_t {
-  // lowest precedence.
-  ast_prec_any = 0,
-  ast_prec_comma,
-  ast_prec_assign,
-  ast_prec_log_or,
-  ast_prec_log_and,
-  ast_prec_bit_or,
-  ast_prec_bit_xor,
-  ast_prec_bit_and,
-  ast_prec_eq,
-  ast_prec_cmp,
-  ast_prec_shift,
-  ast_prec_add,
-  ast_prec_mul,
-  ast_prec_ptr_to_mem,
-  // highest precedence.
-};
-
 struct binary_desc_t {
   expr_op_t op;
   ast_prec_t prec;
@@ -479,129 +494,59 @@ binary_desc_t switch_binary(tk_kind_t kind) {
     // bitwise OR |
     case tk_sym_pipe:       desc = { expr_op_bit_or,  ast_prec_bit_or     }; break;
 
+    // logical AND &&
+    case tk_sym_ampamp:     desc = { expr_op_log_and, ast_prec_log_and    }; break;
+
+    // logical OR ||
+    case tk_sym_pipepipe:   desc = { expr_op_log_or,  ast_prec_log_or     }; break;
+
     default:                                                                 break;
   }
   return desc;
 }
 
-struct item_t {
-  node_ptr_t node;
-  source_loc_t loc;
-  binary_desc_t desc;
-};
-
+// Precedence climbing. Parse a unary-expression and fold in the binary
+// operators that follow, left to right. An operator that binds more tightly
+// than the one before it takes that operator's right operand as its own left
+// operand, so binary_rhs recurses for it first. Each recursion is to a
+// higher precedence, so the depth is bounded by the number of precedence
+// levels, and nothing is allocated but the nodes.
 result_t<node_ptr_t> grammar_t::binary_expression(range_t range, bool expect) {
-
-  std::vector<item_t> stack;
-  auto fold = [&]() {
-    while(stack.size() >= 2) {
-      size_t size = stack.size();
-      auto& lhs = stack[size - 2];
-      auto& rhs = stack[size - 1];
-
-      if(lhs.desc.prec >= rhs.desc.prec) {
-        // Fold the two right-most expressions together.
-        lhs.node = make_binary(lhs.desc.op, std::move(lhs.node),
-          std::move(rhs.node), lhs.loc);
-
-        // Use the descriptor for the rhs for this subexpression.
-        lhs.loc = rhs.loc;
-        lhs.desc = rhs.desc;
-
-        // Pop the rhs.
-        stack.pop_back();
-      } else
-        break;
-    }
-  };
-
   token_it begin = range.begin;
   result_t<node_ptr_t> result;
-  if(auto lhs = unary_expression(range, false)) {
+  if(auto lhs = unary_expression(range, expect)) {
     range.advance(lhs);
-    stack.push_back({ std::move(lhs->attr), loc(lhs->range.begin) });
-
-    while(true) {
-      item_t& item = stack.back();
-      if(auto op = parse_switch(range, switch_binary)) {
-        range.advance(op);
-        item.desc = op->attr;
-      } else
-        // No operator found. This is the end of the binary-expression.
-        break;
-
-      // Fold the expressions to the left with equal or lesser precedence.
-      fold();
-
-      // Read the next expression.
-      auto rhs = unary_expression(range, true);
-      assert(rhs);
-      range.advance(rhs);
-      stack.push_back({ std::move(rhs->attr) });
-      assert(stack.back().node);
-    }
-
-    // Fold all the remaining expressions.
-    stack.back().desc.prec = ast_prec_any;
-    fold();
-
-    assert(1 == stack.size());
-    result = make_result(begin, range.begin, std::move(stack[0].node));
+    node_ptr_t node = binary_rhs(range, lhs->attr, loc(begin), ast_prec_any);
+    result = make_result(begin, range.begin, node);
   }
 
   return result;
 }
 
-////////////////////////////////////////////////////////////////////////////////
-
-result_t<node_ptr_t> grammar_t::logical_and_expression(range_t range, 
-  bool expect) {
-  
-  token_it begin = range.begin;
-  result_t<node_ptr_t> result = binary_expression(range, expect);
-
-  while(result) {
-    range.advance(result);
+node_ptr_t grammar_t::binary_rhs(range_t& range, node_ptr_t lhs,
+  source_loc_t lhs_loc, ast_prec_t min_prec) {
 
-    if(range.advance_if(tk_sym_ampamp)) {
-      auto rhs = binary_expression(range, true);
-      range.advance(rhs);
-
-      auto binary = make_binary(expr_op_log_and, std::move(result->attr),
-        std::move(rhs->attr), loc(begin));
-      result = make_result(begin, range.begin, std::move(binary));
-
-    } else 
-      break;
-  }
-
-  return result;
-}
-
-result_t<node_ptr_t> grammar_t::logical_or_expression(range_t range,
-  bool expect) {
-
-  token_it begin = range.begin;
-  result_t<node_ptr_t> result = logical_and_expression(range, expect);
-  while(result) {
-    range.advance(result);
+  binary_desc_t desc;
+  while((desc = switch_binary(range.peek())) && desc.prec >= min_prec) {
+    ++range.begin;
 
-    if(range.advance_if(tk_sym_ampamp)) {
-      auto rhs = logical_and_expression(range, true);
-      range.advance(rhs);
+    token_it begin = range.begin;
+    auto rhs = unary_expression(range, true);
+    assert(rhs);
+    range.advance(rhs);
+    node_ptr_t node = rhs->attr;
 
-      auto binary = make_binary(expr_op_log_or, std::move(result->attr),
-        std::move(rhs->attr), loc(begin));
-      result = make_result(begin, range.begin, std::move(binary));
+    // Let operators that bind more tightly take the operand first.
+    binary_desc_t next;
+    while((next = switch_binary(range.peek())) && next.prec > desc.prec)
+      node = binary_rhs(range, node, loc(begin), next.prec);
 
-    } else 
-      break;
+    lhs = make_binary(desc.op, lhs, node, lhs_loc);
   }
 
-  return result;
+  return lhs;
 }
 
-
 ////////////////////////////////////////////////////////////////////////////////
 
 expr_op_t switch_assign(tk_kind_t kind) {
@@ -628,7 +573,7 @@ result_t<node_ptr_t> grammar_t::assignment_expression(range_t range,
 
   token_it begin = range.begin;
   result_t<node_ptr_t> result;
-  if(auto a = logical_or_expression(range, expect)) {
+  if(auto a = binary_expression(range, expect)) {
     range.advance(a);
 
     if(auto op = parse_switch(range, switch_assign)) {
@@ -638,7 +583,7 @@ result_t<node_ptr_t> grammar_t::assignment_expression(range_t range,
       auto b = initializer_clause(range, true);
       range.advance(b);
 
-      auto assign = std::make_unique<node_assign_t>(loc(begin));
+      auto assign = make<node_assign_t>(loc(begin));
       assign->a = std::move(a->attr);
       assign->b = std::move(b->attr);
 
@@ -649,13 +594,16 @@ result_t<node_ptr_t> grammar_t::assignment_expression(range_t range,
       auto b = assignment_expression(range, true);
       range.advance(b);
 
-      if(!range.advance_if(tk_sym_col))
-        throw_error(range.begin, "expected ':' in conditional-expression");
+      if(!range.advance_if(tk_sym_col)) {
+        error(range.begin, diag_expected_colon,
+          "expected ':' in conditional-expression");
+        return recover(begin, range);
+      }
 
       auto c = assignment_expression(range, true);
       range.advance(c);
 
-      auto ternary = std::make_unique<node_ternary_t>(loc(begin));
+      auto ternary = make<node_ternary_t>(loc(begin));
       ternary->a = std::move(a->attr);
       ternary->b = std::move(b->attr);
       ternary->c = std::move(c->attr);
@@ -712,16 +660,14 @@ result_t<node_ptr_t> grammar_t::paren_expression(range_t range) {
     range.advance(paren);
     range_t range2 = paren->attr;
 
-    if(auto expr = expression(range2, true)) {
-      range2.advance(expr);
+    // An expected expression always matches, if only as an error node.
+    auto expr = expression(range2, true);
+    range2.advance(expr);
 
-      if(range2)
-        unexpected_token(range2.begin, "expression");
+    if(range2)
+      unexpected_token(range2.begin, "expression");
 
-      result = make_result(begin, range.begin, std::move(expr->attr));
-
-    } else
-      throw_error(range.begin, "expected expression");
+    result = make_result(begin, range.begin, std::move(expr->attr));
   }
   
   return result;
@@ -779,18 +725,17 @@ node_ptr_t grammar_t::make_unary(expr_op_t op, node_ptr_t a, source_loc_t loc) {
     if(number_t n = value_unary(op, a2->x)) {
       a2->x = n;
       a2->loc = loc;
-      return std::move(a);
-
-    } else {
-      throw_error(loc, "illegal constant folding operation");
+      return a;
     }
 
-  } else {
-    auto result = std::make_unique<node_unary_t>(loc);
-    result->op = op;
-    result->a = std::move(a);
-    return result;
+    // Report the operation and keep it unfolded.
+    error(loc, diag_bad_constant, "illegal constant folding operation");
   }
+
+  auto result = make<node_unary_t>(loc);
+  result->op = op;
+  result->a = std::move(a);
+  return result;
 }
 
 node_ptr_t grammar_t::make_binary(expr_op_t op, node_ptr_t a, node_ptr_t b,
@@ -802,45 +747,85 @@ node_ptr_t grammar_t::make_binary(expr_op_t op, node_ptr_t a, node_ptr_t b,
     if(number_t n = value_binary(op, a2->x, b2->x)) {
       a2->x = n;
       a2->loc = loc;
-      return std::move(a);
-
-    } else {
-      throw_error(loc, "illegal constant folding operation");
+      return a;
     }
 
-  } else {
-    auto result = std::make_unique<node_binary_t>(loc);
-    result->op = op;
-    result->a = std::move(a);
-    result->b = std::move(b);
-    return result;
+    error(loc, diag_bad_constant, "illegal constant folding operation");
   }
+
+  auto result = make<node_binary_t>(loc);
+  result->op = op;
+  result->a = std::move(a);
+  result->b = std::move(b);
+  return result;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-void grammar_t::throw_error(source_loc_t loc, const char* fmt, ...) {
+void grammar_t::verror(token_it pos, diag_code_t code, const char* fmt,
+  va_list args) {
+
+  // Errors past the last token are reported at the end of the text.
+  const auto& tokens = tokenizer.tokens;
+  int offset = (pos < tokens.data() + tokens.size()) ?
+    pos->offset :
+    tokenizer.source().size();
+
+  std::pair<int, int> linecol = tokenizer.token_linecol(offset);
+  diagnostics.push_back({
+    code, offset, linecol.first, linecol.second, vformat(fmt, args)
+  });
+}
+
+void grammar_t::error(token_it pos, diag_code_t code, const char* fmt, ...) {
   va_list args;
   va_start(args, fmt);
-  std::string msg = vformat(fmt, args);
+  verror(pos, code, fmt, args);
   va_end(args);
-
-  throw parse_exception_t(msg);
-
 }
 
-void grammar_t::throw_error(token_it pos, const char* fmt, ...) {
-  
+void grammar_t::error(source_loc_t loc, diag_code_t code, const char* fmt,
+  ...) {
+  va_list args;
+  va_start(args, fmt);
+  verror(tokenizer.tokens.data() + loc.index, code, fmt, args);
+  va_end(args);
 }
 
 void grammar_t::unexpected_token(token_it pos, const char* rule) {
-  const char* begin = pos->begin;
-  const char* end = pos->end;
-  int len = end - begin;
+  std::string_view s = tokenizer.spelling(*pos);
+  error(pos, diag_unexpected_token, "unexpected token '%.*s' in %s",
+    (int)s.size(), s.data(), rule);
+}
 
-  std::string msg = format("unexpected token '%.*s' in %s", len, begin, rule);
+result_t<node_ptr_t> grammar_t::recover(token_it begin, range_t range) {
+  int depth = 0;
+  while(range) {
+    tk_kind_t kind = range.peek();
+    if(!depth && tk_sym_comma == kind)
+      break;
 
-  throw parse_exception_t(msg);
+    switch(kind) {
+      case tk_sym_paren_l:
+      case tk_sym_bracket_l:
+      case tk_sym_brace_l:
+        ++depth;
+        break;
+
+      case tk_sym_paren_r:
+      case tk_sym_bracket_r:
+      case tk_sym_brace_r:
+        if(depth) --depth;
+        break;
+
+      default:
+        break;
+    }
+    ++range.begin;
+  }
+
+  node_ptr_t node = make<node_error_t>(loc(begin));
+  return make_result(begin, range.begin, node);
 }
 
 source_loc_t grammar_t::loc(token_it it) const {
@@ -851,28 +836,41 @@ source_loc_t grammar_t::loc(token_it it) const {
 
 ////////////////////////////////////////////////////////////////////////////////
 
-parse_t parse_expression(const char* begin, const char* end) {
-  // Tokenize the input.
-  parse_t parse;
-  parse.tokenizer.text = std::string(begin, end);
-  parse.tokenizer.tokenize();
-
-  // Parse the tokens.
-  grammar_t g { parse.tokenizer };
+void parse_tokens(parse_t& parse) {
+  parse.diagnostics = parse.tokenizer.diagnostics;
+  std::vector<int> closers(parse.tokenizer.tokens.size(),
+    grammar_t::closer_unknown);
+  grammar_t g { parse.tokenizer, parse.arena, parse.diagnostics,
+    std::move(closers) };
   range_t range = parse.tokenizer.token_range();
 
   auto expr = g.expression(range, true);
   range.advance(expr);
   if(range)
     g.unexpected_token(range.begin, "expression");
-  parse.root = std::move(expr->attr);
+  parse.root = expr->attr;
 
-  return std::move(parse);
+  // Groups report their own errors before an enclosing unclosed group does.
+  // Put the lexer and parser diagnostics together in source order.
+  std::stable_sort(parse.diagnostics.begin(), parse.diagnostics.end(),
+    [](const diagnostic_t& a, const diagnostic_t& b) {
+      return a.offset < b.offset;
+    });
 }
 
+parse_t parse_expression(const char* begin, const char* end) {
+  parse_t parse;
+  parse.tokenizer.tokenize(begin, end);
+  parse_tokens(parse);
+  return parse;
+}
 
 parse_t parse_expression(const char* str) {
-  return parse_expression(str, str + strlen(str));
+  parse_t parse;
+  parse.tokenizer.text = str;
+  parse.tokenizer.tokenize();
+  parse_tokens(parse);
+  return parse;
 }
 
 } // namespace parse
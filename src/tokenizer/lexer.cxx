@@ -1,28 +1,98 @@
 #include <apex/tokenizer.hxx>
-#include <cctype>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 BEGIN_APEX_NAMESPACE
 
 namespace tok {
 
+#if defined(__SSE2__)
+
+namespace {
+
+typedef uint8_t bytes_t __attribute__((vector_size(16)));
+
+// Advance 16 bytes at a time while every byte satisfies pred, which maps a
+// vector of bytes to a vector of -1 (match) or 0. Return the first byte
+// that doesn't match, or the start of the tail shorter than 16 bytes.
+template<typename pred_t>
+inline const char* scan_bytes(const char* p, const char* end, pred_t pred) {
+  for(; end - p >= 16; p += 16) {
+    bytes_t x;
+    memcpy(&x, p, 16);
+    unsigned mask = _mm_movemask_epi8((__m128i)pred(x));
+    if(0xffff != mask)
+      return p + __builtin_ctz(~mask);
+  }
+  return p;
+}
+
+} // namespace
+
+#endif
+
+const char* scan_space(const char* p, const char* end) {
+#if defined(__SSE2__)
+  p = scan_bytes(p, end, [](bytes_t x) {
+    return (' ' == x) | ((bytes_t)(x - '\t') <= '\r' - '\t');
+  });
+#endif
+  while(p < end && is_char_class(*p, cc_space)) ++p;
+  return p;
+}
+
+const char* scan_ident(const char* p, const char* end) {
+#if defined(__SSE2__)
+  p = scan_bytes(p, end, [](bytes_t x) {
+    return ((bytes_t)((x | 0x20) - 'a') <= 'z' - 'a') |
+      ((bytes_t)(x - '0') <= 9) | ('_' == x);
+  });
+#endif
+  while(p < end && is_char_class(*p, cc_alpha | cc_digit)) ++p;
+  return p;
+}
+
+const char* scan_digits(const char* p, const char* end) {
+#if defined(__SSE2__)
+  p = scan_bytes(p, end, [](bytes_t x) {
+    return (bytes_t)(x - '0') <= 9;
+  });
+#endif
+  while(p < end && is_char_class(*p, cc_digit)) ++p;
+  return p;
+}
+
 result_t<token_t> lexer_t::char_literal(range_t range) {
   const char* begin = range.begin;
   result_t<token_t> result;
 
   if(range.advance_if('\'')) {
-    char32_t char_;
+    char32_t char_ = 0;
     if(auto c = c_char(range)) {
       char_ = c->attr;
+      range.advance(c);
 
-    } else
-      throw_error(range.begin, "expected character in literal");
+      if(!range.advance_if('\''))
+        error(range.begin, diag_bad_char_literal,
+          "expected \"'\" to end character literal");
 
-    if(!range.advance_if('\''))
-      throw_error(range.begin, "expected \"'\" to end character literal");
+    } else {
+      error(range.begin, diag_bad_char_literal,
+        "expected character in literal");
 
-    result = make_result(begin, range.begin, token_t {
-      tk_char, (int)char_, begin, range.begin
-    });
+      // Skip through the closing quote, if there is one on this line.
+      const char* p = range.begin;
+      while(p < range.end && '\'' != *p && '\n' != *p) ++p;
+      range.begin = (p < range.end && '\'' == *p) ? p + 1 : p;
+    }
+
+    literal_t literal;
+    literal.c = char_;
+    token_t token = make_literal(tk_char, literal, begin, range.begin);
+    result = make_result(begin, range.begin, token);
   }
   return result;
 }
@@ -46,13 +116,11 @@ result_t<char32_t> lexer_t::identifier_char(range_t range, bool digit) {
   const char* begin = range.begin;
   result_t<char32_t> result;
 
-  if(char c = range.next()) {
-    bool c1 = digit && isdigit(c);
-    if(c1 || isalpha(c) || '_' == c) 
-      result = make_result(begin, range.begin, (char32_t)c);
-    else
-      result = ucs(range);
-  }
+  char c = range.peek();
+  if(is_char_class(c, digit ? cc_alpha | cc_digit : cc_alpha))
+    result = make_result(begin, begin + 1, (char32_t)c);
+  else
+    result = ucs(range);
   return result;
 }
 
@@ -61,33 +129,54 @@ result_t<char32_t> lexer_t::ucs(range_t range) {
   result_t<char32_t> result;
 
   if(range && (0x80 & range.begin[0])) {
-    std::pair<int, int> p = from_utf8(range.begin);
-    range.begin += p.first;
-    result = make_result(begin, range.begin, (char32_t)p.second);
+    // Take the length from the lead byte, so a sequence truncated by the end
+    // of the range isn't decoded past it. Malformed sequences decode to 0
+    // bytes and don't match.
+    uint8_t c = range.begin[0];
+    int len = 0xc0 == (0xe0 & c) ? 2 : 0xe0 == (0xf0 & c) ? 3 :
+      0xf0 == (0xf8 & c) ? 4 : 0;
+    std::pair<int, int> p { };
+    if(len && len <= range.end - range.begin)
+      p = from_utf8(range.begin);
+    if(p.first) {
+      range.begin += p.first;
+      result = make_result(begin, range.begin, (char32_t)p.second);
+    }
   }
   return result;
 }
 
 const char* lexer_t::skip_comment(range_t range) {
   while(true) {
-    // Eat the blank characters.
-    while(range.advance_if(isblank));
+    // Eat the whitespace, including newlines.
+    range.begin = scan_space(range.begin, range.end);
 
     const char* begin = range.begin;
     if(range.match_advance("//")) {
       // Match a C++-style comment.
-      auto f = [](char c) {
-        return '\n' != c;
-      };
-
-      while(range.advance_if(f));
+      size_t size = range.end - range.begin;
+      const void* newline = memchr(range.begin, '\n', size);
+      range.begin = newline ? (const char*)newline : range.end;
 
     } else if(range.match_advance("/*")) {
       // Match a C-style comment.
-      while(!range.match("*/") && range.next());
-
-      if(!range.match_advance("*/"))
-        throw_error(begin, "unterminated C-style comment: expected */");
+      while(const void* star = memchr(range.begin, '*',
+        range.end - range.begin)) {
+        range.begin = (const char*)star;
+        if(range.match("*/")) break;
+        ++range.begin;
+      }
+
+      if(!range.match_advance("*/")) {
+        if(partial) {
+          // It may close in the next chunk.
+          range.begin = begin;
+          break;
+        }
+        error(begin, diag_unterminated_comment,
+          "unterminated C-style comment: expected */");
+        range.begin = range.end;
+      }
 
     } else
       break;
@@ -106,7 +195,8 @@ result_t<token_t> lexer_t::literal(range_t range) {
 result_t<token_t> lexer_t::operator_(range_t range) {
   result_t<token_t> result;
   if(auto match = match_operator(range)) {
-    token_t token { match->attr, 0, match->range.begin, match->range.end };
+    int size = match->range.end - match->range.begin;
+    token_t token = make_token(match->attr, size, match->range.begin);
     return make_result(match->range, token);
   }
   return result;
@@ -119,17 +209,27 @@ result_t<token_t> lexer_t::identifier(range_t range) {
   if(auto c = identifier_char(range, false)) {
     range.advance(c);
 
-    while(auto c = identifier_char(range, true))
-      range.advance(c);
+    // Scan ASCII runs in bulk and decode UCS characters between them.
+    while(true) {
+      range.begin = scan_ident(range.begin, range.end);
+      if(auto c = ucs(range))
+        range.advance(c);
+      else
+        break;
+    }
 
     int ident = tokenizer.reg_string(range_t { begin, range.begin });
-    token_t token { tk_ident, ident, begin, range.begin };
+    token_t token = make_token(tk_ident, ident, begin);
     result = make_result(begin, range.begin, token);
   }
   return result;
 }
 
 result_t<token_t> lexer_t::token(range_t range) {
+  // Only identifiers start with a letter or a UCS.
+  if(is_char_class(range.peek(), cc_alpha | cc_ucs))
+    return identifier(range);
+
   result_t<token_t> result = literal(range);
   if(!result) result = identifier(range);
   if(!result) result = operator_(range);
@@ -144,9 +244,29 @@ bool lexer_t::advance_skip(range_t& range) {
   return advance;
 }
 
-void lexer_t::throw_error(const char* p, const char* msg) {
-  printf("Error thrown %s\n", msg);
-  exit(0);
+void lexer_t::error(const char* pos, diag_code_t code, const char* msg) {
+  int offset = pos - base;
+  std::pair<int, int> linecol = tokenizer.token_linecol(offset);
+  tokenizer.diagnostics.push_back({
+    code, offset, linecol.first, linecol.second, msg
+  });
+}
+
+token_t lexer_t::make_token(tk_kind_t kind, int store, const char* begin) {
+  if(store >= max_token_store) {
+    if(max_token_store == store)
+      error(begin, diag_limit, "too many literals or identifiers in source");
+    store = 0;
+  }
+  return token_t { kind, (unsigned)store, (int)(begin - base) };
+}
+
+token_t lexer_t::make_literal(tk_kind_t kind, literal_t literal,
+  const char* begin, const char* end) {
+  literal.size = end - begin;
+  int store = tokenizer.literals.size();
+  tokenizer.literals.push_back(literal);
+  return make_token(kind, store, begin);
 }
 
 } // namespace tok
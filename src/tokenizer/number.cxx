@@ -1,5 +1,7 @@
 #include <apex/tokenizer.hxx>
 #include <climits>
+#include <charconv>
+#include <cstdlib>
 
 BEGIN_APEX_NAMESPACE
 
@@ -14,19 +16,29 @@ result_t<unused_t> lexer_t::pp_number(range_t range) {
   //   digit
   //   . digit
   range.advance_if('.');
-  if(range.advance_if(isdigit)) {
-    while(char c0 = toupper(range[0])) {
-      char c1 = range[1];
-      if(('E' == c0 || 'P' == c0) && ('+' == c1 || '-' == c1)) {
+  if(range.advance_if([](char c) { return is_char_class(c, cc_digit); })) {
+    while(true) {
+      // pp-number digit
+      // pp-number identifier-nondigit
+      // Consume the ASCII run in bulk.
+      const char* p = scan_ident(range.begin, range.end);
+      if(p > range.begin) {
+        range.begin = p;
+
         // pp-number e sign
         // pp-number E sign
         // pp-number p sign
         // pp-number P sign
-        range.begin += 2;
+        char e = toupper(p[-1]);
+        char sign = range.peek();
+        if(('E' == e || 'P' == e) && ('+' == sign || '-' == sign))
+          ++range.begin;
         continue;
       }
 
-      if('\'' == c0 && (isalnum(c1) || '_' == c1)) {
+      char c0 = range[0];
+      char c1 = range[1];
+      if('\'' == c0 && is_char_class(c1, cc_alpha | cc_digit)) {
         // pp-number ' digit
         // pp-number ' non-digit
         range.begin += 2;
@@ -39,8 +51,7 @@ result_t<unused_t> lexer_t::pp_number(range_t range) {
         continue;
       }
 
-      if(auto c = identifier_char(range, true)) {
-        // pp-number digit
+      if(auto c = ucs(range)) {
         // pp-number identifier-nondigit
         range.advance(c);
         continue;
@@ -62,10 +73,12 @@ struct floating_parts_t {
 };
 
 result_t<unused_t> lexer_t::decimal_sequence(range_t range) {
+  result_t<unused_t> result;
   const char* begin = range.begin;
-  while(isdigit(range.peek()))
-    ++range.begin;
-  return make_result(begin, range.begin, { });
+  range.begin = scan_digits(range.begin, range.end);
+  if(range.begin > begin)
+    result = make_result(begin, range.begin, { });
+  return result;
 }
 
 result_t<uint64_t> lexer_t::decimal_number(range_t range) {
@@ -77,8 +90,11 @@ result_t<uint64_t> lexer_t::decimal_number(range_t range) {
     for(const char* p = digits->range.begin; p != digits->range.end; ++p) {
       int y = *p - '0';
       uint64_t x2 = 10 * x + y;
-      if(x2 < x)
-        throw_error(p, "integer overflow in decimal literal");
+      if(x2 / 10 != x) {
+        // Report the literal once and keep its leading digits.
+        error(p, diag_int_overflow, "integer overflow in decimal literal");
+        break;
+      }
       x = x2;
     }
     result = make_result(digits->range, x);
@@ -97,16 +113,20 @@ result_t<int> lexer_t::exponent_part(range_t range) {
     // Expect a digit-sequence here.
     if(auto exp = decimal_number(range)) {
       range.advance(exp);
+      int exponent = 0;
       if(exp->attr > INT_MAX)
-        throw_error(exp->range.begin, "exponent is too large");
-
-      int exponent = exp->attr;
+        error(exp->range.begin, diag_bad_exponent, "exponent is too large");
+      else
+        exponent = exp->attr;
       if(sign) exponent = -exponent;
 
       result = make_result(begin, range.begin, exponent);
 
-    } else
-      throw_error(range.begin, "expected digit-sequence in exponent-part");
+    } else {
+      error(range.begin, diag_bad_exponent,
+        "expected digit-sequence in exponent-part");
+      result = make_result(begin, range.begin, 0);
+    }
   }
   return result;
 }
@@ -153,11 +173,12 @@ result_t<double> lexer_t::floating_point_literal(range_t range) {
   } else
     return { };
  
-  // TODO: Assemble the floating-point literal by hand.
-  // sscanf the floating point literal into double.
-  std::string s(begin, range.begin);
-  double x;
-  sscanf(s.c_str(), "%lf", &x);
+  // from_chars reads exactly the matched range, without copying it or
+  // consulting the locale. It doesn't store values out of range, so let
+  // strtod round those to inf or 0.
+  double x = 0;
+  if(std::errc() != std::from_chars(begin, range.begin, x).ec)
+    x = strtod(std::string(begin, range.begin).c_str(), nullptr);
 
   return make_result(begin, range.begin, x);
 }
@@ -181,28 +202,26 @@ result_t<token_t> lexer_t::number(range_t range) {
     if(auto floating = floating_point_literal(range)) {
       range.advance(floating);
 
-      result = make_result(range, token_t {
-        tk_float,
-        (int)tokenizer.floats.size(), 
-        floating->range.begin, 
-        floating->range.end
-      });
-      tokenizer.floats.push_back(floating->attr);
+      literal_t literal;
+      literal.f = floating->attr;
+      token = make_literal(tk_float, literal, floating->range.begin,
+        floating->range.end);
+      result = make_result(range, token);
 
     } else if(auto integer = integer_literal(range)) {
       range.advance(integer);
 
-      result = make_result(range, token_t {
-        tk_int,
-        (int)tokenizer.ints.size(), 
-        integer->range.begin, 
-        integer->range.end
-      });
-      tokenizer.ints.push_back(integer->attr);
+      literal_t literal;
+      literal.i = integer->attr;
+      token = make_literal(tk_int, literal, integer->range.begin,
+        integer->range.end);
+      result = make_result(range, token);
     }
 
+    // The token still spans the whole pp-number, so lexing resumes after it.
     if(range)
-      throw_error(range.begin, "unexpected character in numeric literal");
+      error(range.begin, diag_bad_number,
+        "unexpected character in numeric literal");
   }
   return result;
 }
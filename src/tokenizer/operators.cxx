@@ -1,6 +1,5 @@
 #include <apex/tokenizer.hxx>
-#include <cstring>
-#include <algorithm>
+#include <array>
 
 BEGIN_APEX_NAMESPACE
 
@@ -70,102 +69,82 @@ const size_t num_op_symbols = sizeof(tk_op_symbols) / sizeof(tk_symbol_t);
 
 ////////////////////////////////////////////////////////////////////////////////
 
-typedef std::pair<size_t, size_t> pair_t;
-
+// Match operators with a DFA. Each byte maps to a column, with column 0 for
+// bytes that begin or continue no operator. Each state is a prefix of one or
+// more operators, and state 0 is the dead state. Matching follows one
+// transition per byte and remembers the last state that spells a complete
+// operator, so the longest operator wins.
 class match_operator_t {
 public:
   match_operator_t();
   result_t<tk_kind_t> substring(range_t range) const;
 
 private:
-  // Return the range of operators matching the first character.
-  pair_t first_char(size_t c) const;
+  enum { max_columns = 32, root = 1 };
+  typedef std::array<uint8_t, max_columns> row_t;
+
+  int add_state();
 
-  // Return the range of operators matching a subsequent character.
-  pair_t next_char(pair_t pair, int pos, char c) const;
+  uint8_t columns[256] { };
+  std::vector<row_t> next;
 
-  std::vector<const char*> tokens;
+  // The operator spelled by each state, or tk_none.
   std::vector<tk_kind_t> kinds;
-  std::vector<size_t> first_char_map;
 };
 
+int match_operator_t::add_state() {
+  next.push_back(row_t { });
+  kinds.push_back(tk_none);
+  return (int)next.size() - 1;
+}
+
 match_operator_t::match_operator_t() {
-  std::vector<tk_symbol_t> symbols(tk_op_symbols, 
-    tk_op_symbols + num_op_symbols);
-  auto cmp = [](tk_symbol_t a, tk_symbol_t b) {
-    return strcmp(a.symbol, b.symbol) < 0;
-  };
-  std::sort(symbols.begin(), symbols.end(), cmp);
-
-  tokens.resize(num_op_symbols);
-  kinds.resize(num_op_symbols);
-  for(size_t i = 0; i < num_op_symbols; ++i) {
-    tokens[i] = symbols[i].symbol;
-    kinds[i] = symbols[i].kind;
+  int num_columns = 1;
+  for(const tk_symbol_t& symbol : tk_op_symbols) {
+    for(const char* s = symbol.symbol; *s; ++s) {
+      uint8_t& column = columns[(uint8_t)*s];
+      if(!column)
+        column = num_columns++;
+    }
   }
-
-  first_char_map.resize(257);
-  for(size_t i = 0; i < 256; ++i) {
-    auto cmp = [](const char* p, char c) {
-      return (uint8_t)p[0] < (uint8_t)c;
-    };
-
-    auto it = std::lower_bound(tokens.begin(), tokens.end(), (char)i, cmp);
-    first_char_map[i] = it - tokens.begin();
+  assert(num_columns <= max_columns);
+
+  add_state();
+  add_state();
+  for(const tk_symbol_t& symbol : tk_op_symbols) {
+    int state = root;
+    for(const char* s = symbol.symbol; *s; ++s) {
+      int column = columns[(uint8_t)*s];
+      if(!next[state][column]) {
+        int state2 = add_state();
+        assert(state2 <= UINT8_MAX);
+        next[state][column] = state2;
+      }
+      state = next[state][column];
+    }
+    kinds[state] = symbol.kind;
   }
-  first_char_map[256] = tokens.size();
-}
-
-inline pair_t match_operator_t::first_char(size_t c) const {
-  // Build a map so the range of the first character is a direct lookup.
-  size_t begin = first_char_map[c];
-  size_t end = first_char_map[c + 1];
-  return std::make_pair(begin, end);
-}
-
-inline pair_t match_operator_t::next_char(pair_t pair, int pos, char c) const {
-  assert('\0' != c);
-
-  // Scan from left-to-right until we hit a match.
-  size_t begin2 = pair.first;
-  while(begin2 != pair.second && c != tokens[begin2][pos])
-    ++begin2;
-
-  // Scan from left-to-right until we hit a miss.
-  size_t end2 = begin2;
-  while(end2 != pair.second && c == tokens[end2][pos])
-    ++end2;
-
-  return std::make_pair(begin2, end2);
 }
 
 result_t<tk_kind_t> match_operator_t::substring(range_t range) const {
-  const char* begin = range.begin;
-  result_t<tk_kind_t> result;
-
-  pair_t match = first_char((uint8_t)range.peek());
-  if(match.first < match.second) {
-    int pos = 0;
-    pair_t match2 = match;
-    while(match2.first < match2.second && range) {
-      ++pos;
-      ++range.begin;
-      
-      match = match2;
-      if(char c = range.peek())
-        match2 = next_char(match, pos, c);
-      else
-        match2.first = match2.second;
-    }
-
-    assert(match.first < match.second);
-    if('\0' == tokens[match.first][pos]) {
-      // We've run out of matches. Test the first operator from the input
-      // range.
-      result = make_result(begin, range.begin, kinds[match.first]);
+  const char* end = range.begin;
+  tk_kind_t kind = tk_none;
+
+  int state = root;
+  for(const char* p = range.begin; p < range.end; ++p) {
+    state = next[state][columns[(uint8_t)*p]];
+    if(!state)
+      break;
+
+    if(tk_none != kinds[state]) {
+      kind = kinds[state];
+      end = p + 1;
     }
   }
 
+  result_t<tk_kind_t> result;
+  if(tk_none != kind)
+    result = make_result(range.begin, end, kind);
   return result;
 }
 
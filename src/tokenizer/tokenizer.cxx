@@ -1,6 +1,9 @@
 #include <apex/tokenizer.hxx>
 #include <apex/parse.hxx>
 #include <algorithm>
+#include <cstring>
+#include <cctype>
+#include <climits>
 
 BEGIN_APEX_NAMESPACE
 
@@ -14,49 +17,151 @@ int tokenizer_t::reg_string(range_t range) {
   int id = find_string(range);
   if(-1 == id) {
     id = (int)strings.size();
-    strings.push_back(std::string(range.begin, range.end));
+    int size = range.end - range.begin;
+    strings.push_back({ (int)(range.begin - source().data()), size });
+    string_index.insert(hash_bytes(range.begin, size), id);
   }
   return id;
 }
 
 int tokenizer_t::find_string(range_t range) const {
-  for(size_t i = 0; i < strings.size(); ++i) { 
-    if(0 == strings[i].compare(range.begin))
-      return i;
-  }
-  return -1;
+  std::string_view s(range.begin, range.end - range.begin);
+  auto eq = [&](int id) { return string(id) == s; };
+  return string_index.find(hash_bytes(s.data(), s.size()), eq);
+}
+
+void tokenizer_t::reset() {
+  // Drop everything that holds offsets into the previous source. text is
+  // the caller's input to tokenize(), so it stays.
+  buffer = { };
+  stream_end = 0;
+  tokens.clear();
+  strings.clear();
+  string_index = hash_index_t();
+  literals.clear();
+  diagnostics.clear();
+
+  // Lines and columns are indexed on demand.
+  line_offsets.clear();
+  lines_end = 0;
+  col_checkpoints.clear();
 }
 
 void tokenizer_t::tokenize() {
-  // Mark the byte of each line offset.
-  size_t len = text.size();
-  line_offsets.push_back(0);
-  for(size_t i = 0; i < len; ++i) {
-    if('\n' == text[i])
-      line_offsets.push_back(i);
-  }
-  line_offsets.push_back(len);
+  reset();
+  lex(text.data(), text.data() + text.size(), false);
+  stream_end = text.size();
+}
+
+void tokenizer_t::tokenize(const char* begin, const char* end) {
+  reset();
+  buffer = std::string_view(begin, end - begin);
+  lex(begin, end, false);
+}
+
+void tokenizer_t::append(const char* data, size_t size) {
+  // Streams extend text. A caller's buffer can't be extended.
+  assert(!buffer.data());
+  text.append(data, size);
+
+  // Lex through the last newline in the chunk.
+  const char* end = text.data() + text.size();
+  const char* chunk = end - size;
+  while(end > chunk && '\n' != end[-1])
+    --end;
+  if(end > chunk)
+    stream_end = lex(text.data() + stream_end, end, true) - text.data();
+}
+
+void tokenizer_t::finish() {
+  assert(!buffer.data());
+  lex(text.data() + stream_end, text.data() + text.size(), false);
+  stream_end = text.size();
+}
+
+const char* tokenizer_t::lex(const char* begin, const char* end,
+  bool partial) {
 
   lexer_t lexer(*this);
-  range_t range { text.data(), text.data() + text.size() };
+  lexer.base = source().data();
+  lexer.partial = partial;
+  range_t range { begin, end };
+
+  // Token offsets are ints.
+  if(end - lexer.base > INT_MAX) {
+    lexer.error(lexer.base, diag_limit, "source is larger than 2GB");
+    return end;
+  }
 
   while(true) {
     // Skip past whitespace and comments.
     lexer.advance_skip(range);
+    if(!range)
+      break;
+
+    // Stop at a block comment that closes in a later chunk.
+    if(partial && range.match("/*"))
+      break;
 
     if(auto token = lexer.token(range)) {
       range.advance(token);
       tokens.push_back(token->attr);
-    } else
-      break;
+
+    } else {
+      // Report a byte that starts no token and skip it.
+      uint8_t c = *range.begin;
+      std::string msg = isprint(c) ?
+        format("unexpected character '%c'", c) :
+        format("unexpected byte 0x%02x", c);
+      lexer.error(range.begin, diag_bad_char, msg.c_str());
+      ++range.begin;
+    }
   }
+  return range.begin;
 }
 
 int tokenizer_t::token_offset(source_loc_t loc) const {
-  return tokens[loc.index].begin - text.c_str();
+  return tokens[loc.index].offset;
+}
+
+int tokenizer_t::token_size(token_t token) const {
+  switch(token.kind) {
+    case tk_ident:
+    case tk_string:
+      return strings[token.store].size;
+
+    case tk_int:
+    case tk_float:
+    case tk_char:
+      return literals[token.store].size;
+
+    default:
+      return token.store;
+  }
+}
+
+void tokenizer_t::index_lines(int offset) const {
+  if(line_offsets.empty())
+    line_offsets.push_back(0);
+
+  // Search only as far as the first newline past offset. memchr finds the
+  // newlines a vector at a time.
+  std::string_view source = this->source();
+  int len = source.size();
+  const char* data = source.data();
+  while(lines_end <= offset && lines_end < len) {
+    const void* p = memchr(data + lines_end, '\n', len - lines_end);
+    if(p) {
+      lines_end = (const char*)p - data + 1;
+      line_offsets.push_back(lines_end);
+    } else
+      lines_end = len;
+  }
 }
 
 int tokenizer_t::token_line(int offset) const {
+  index_lines(offset);
+
   // Binary search to find the line for this byte offset.
   auto it = std::upper_bound(line_offsets.begin(), line_offsets.end(), offset);
   int line = it - line_offsets.begin() - 1;
@@ -64,19 +169,38 @@ int tokenizer_t::token_line(int offset) const {
 }
 
 int tokenizer_t::token_col(int offset, int line) const {
-  // Walk forward, decoding UTF-8 and count the column adjustment to reach 
-  // the offset from the line offset.
-  int col = 0;
-  int pos = line_offsets[line];
-  while(pos < offset) {
-    std::pair<int, int> ucs = from_utf8(text.data() + pos);
+  index_lines(offset);
 
-    // Advance by the number of bytes in the character.
-    pos += ucs.first;
+  // Start from the last checkpoint at or before offset, if it's on this line.
+  auto cmp = [](int offset, col_checkpoint_t checkpoint) {
+    return offset < checkpoint.offset;
+  };
+  auto it = std::upper_bound(col_checkpoints.begin(), col_checkpoints.end(),
+    offset, cmp);
 
-    // Advance by one column.
-    ++col;
+  const char* data = source().data();
+  int pos = line_offsets[line];
+  int col = 0;
+  if(it != col_checkpoints.begin() && it[-1].offset >= pos) {
+    pos = it[-1].offset;
+    col = it[-1].col;
   }
+  if(pos == offset)
+    return col;
+
+  // Count one column for each byte that starts a UTF-8 character, which is
+  // every byte but continuation bytes 10xxxxxx. Nothing is decoded, so
+  // malformed text can't stall the walk.
+  std::vector<col_checkpoint_t> checkpoints;
+  while(pos < offset) {
+    col += 0x80 != (0xc0 & data[pos++]);
+    if(0 == pos % col_checkpoint_interval || pos == offset)
+      checkpoints.push_back({ pos, col });
+  }
+
+  // No checkpoint lies between the one we started from and offset, so the
+  // new ones go in as a block.
+  col_checkpoints.insert(it, checkpoints.begin(), checkpoints.end());
   return col;
 }
 
@@ -0,0 +1,63 @@
+#include <apex/util.hxx>
+
+BEGIN_APEX_NAMESPACE
+
+arena_t::arena_t(arena_t&& rhs) :
+  blocks(std::move(rhs.blocks)), dtors(std::move(rhs.dtors)),
+  cur(rhs.cur), end(rhs.end), next_block_size(rhs.next_block_size),
+  num_objects(rhs.num_objects) {
+
+  rhs.blocks.clear();
+  rhs.dtors.clear();
+  rhs.cur = rhs.end = nullptr;
+  rhs.num_objects = 0;
+}
+
+arena_t& arena_t::operator=(arena_t&& rhs) {
+  if(this != &rhs) {
+    release();
+    blocks = std::move(rhs.blocks);
+    dtors = std::move(rhs.dtors);
+    cur = rhs.cur;
+    end = rhs.end;
+    next_block_size = rhs.next_block_size;
+    num_objects = rhs.num_objects;
+
+    rhs.blocks.clear();
+    rhs.dtors.clear();
+    rhs.cur = rhs.end = nullptr;
+    rhs.num_objects = 0;
+  }
+  return *this;
+}
+
+void* arena_t::allocate(size_t size, size_t align) {
+  uintptr_t p = ((uintptr_t)cur + align - 1) & ~(uintptr_t)(align - 1);
+  if(!cur || p + size > (uintptr_t)end) {
+    // Start a new block. Grow the block size geometrically so large trees
+    // need few heap allocations, and give oversized requests their own 
+    // block.
+    size_t block_size = std::max(next_block_size, size + align);
+    next_block_size = std::min<size_t>(2 * next_block_size, 1<< 20);
+
+    blocks.push_back(std::unique_ptr<char[]>(new char[block_size]));
+    cur = blocks.back().get();
+    end = cur + block_size;
+    p = ((uintptr_t)cur + align - 1) & ~(uintptr_t)(align - 1);
+  }
+
+  cur = (char*)(p + size);
+  return (void*)p;
+}
+
+void arena_t::release() {
+  // Destroy objects in reverse order of construction.
+  for(size_t i = dtors.size(); i--; )
+    dtors[i].destroy(dtors[i].object);
+  dtors.clear();
+  blocks.clear();
+  cur = end = nullptr;
+  num_objects = 0;
+}
+
+END_APEX_NAMESPACE
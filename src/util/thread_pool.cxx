@@ -0,0 +1,101 @@
+#include <apex/thread_pool.hxx>
+
+BEGIN_APEX_NAMESPACE
+
+thread_pool_t::thread_pool_t(int num_threads) {
+  if(num_threads <= 0)
+    num_threads = std::max<int>(1, std::thread::hardware_concurrency());
+  this->num_threads = num_threads;
+
+  workers.reserve(num_threads - 1);
+  for(int i = 1; i < num_threads; ++i)
+    workers.emplace_back([this] { worker_loop(); });
+}
+
+thread_pool_t::~thread_pool_t() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stop = true;
+  }
+  start_cv.notify_all();
+  for(std::thread& worker : workers)
+    worker.join();
+}
+
+void thread_pool_t::run_job() {
+  // Claim indices until the job is exhausted.
+  while(true) {
+    int index = next_index.fetch_add(1, std::memory_order_relaxed);
+    if(index >= job_count)
+      break;
+
+    try {
+      (*job)(index);
+
+    } catch(...) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if(!error) error = std::current_exception();
+    }
+  }
+}
+
+void thread_pool_t::worker_loop() {
+  uint64_t seen = 0;
+  while(true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      start_cv.wait(lock, [&] { return stop || generation != seen; });
+      if(stop)
+        return;
+      seen = generation;
+    }
+
+    run_job();
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if(!--num_running)
+        done_cv.notify_one();
+    }
+  }
+}
+
+void thread_pool_t::parallel_for(int count, 
+  const std::function<void(int)>& func) {
+
+  if(count <= 0)
+    return;
+
+  // Don't wake the workers for a single task.
+  if(1 == count || workers.empty()) {
+    for(int i = 0; i < count; ++i)
+      func(i);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    job = &func;
+    job_count = count;
+    next_index.store(0, std::memory_order_relaxed);
+    num_running = workers.size();
+    error = nullptr;
+    ++generation;
+  }
+  start_cv.notify_all();
+
+  run_job();
+
+  std::exception_ptr e;
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    done_cv.wait(lock, [&] { return !num_running; });
+    job = nullptr;
+    e = error;
+    error = nullptr;
+  }
+  if(e)
+    std::rethrow_exception(e);
+}
+
+END_APEX_NAMESPACE